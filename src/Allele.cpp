@@ -52,7 +52,7 @@ const int Allele::subquality(int startpos, int len) const {
 }
 
 // quality of subsequence of allele
-const long double Allele::lnsubquality(int startpos, int len) const {
+const Real Allele::lnsubquality(int startpos, int len) const {
     return phred2ln(subquality(startpos, len));
 }
 
@@ -126,7 +126,7 @@ const int Allele::subquality(const Allele &a) const {
     return sum * (l / L);
 }
 
-const long double Allele::lnsubquality(const Allele& a) const {
+const Real Allele::lnsubquality(const Allele& a) const {
     return phred2ln(subquality(a));
 }
 
@@ -182,7 +182,7 @@ const short Allele::currentQuality(void) const {
     }
 }
 
-const long double Allele::lncurrentQuality(void) const {
+const Real Allele::lncurrentQuality(void) const {
     return phred2ln(currentQuality());
 }
 
@@ -224,6 +224,17 @@ string Allele::typeStr(void) const {
 
 }
 
+// haplotype alleles may carry an average quality, or a log quality which
+// does not match their quality
+int Allele::phredQuality(void) const {
+    int q = (int) quality;
+    if (q == quality && lnquality == phred2ln(q)) {
+        return q;
+    } else {
+        return -1;
+    }
+}
+
 bool Allele::isReference(void) const {
     return type == ALLELE_REFERENCE;
 }
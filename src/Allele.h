@@ -12,6 +12,7 @@
 #include <sstream>
 #include <assert.h>
 #include "Utility.h"
+#include "SymbolTable.h"
 #include "convert.h"
 #include "api/BamAlignment.h"
 
@@ -117,13 +118,14 @@ public:
     AlleleStrand strand;          // strand, true = +, false = -
     string sampleID;        // representative sample ID
     string readGroupID;     // read group membership
+    int readGroupIndex;     // id of readGroupID in readGroupSymbols, or -1 if it has none
     string readID;          // id of the read which the allele is drawn from
     vector<short> baseQualities;
-    long double quality;          // base quality score associated with this allele, updated every position in the case of reference alleles
-    long double lnquality;  // log version of above
+    Real quality;          // base quality score associated with this allele, updated every position in the case of reference alleles
+    Real lnquality;  // log version of above
     string currentBase;       // current base, meant to be updated every position
     short mapQuality;       // map quality for the originating read
-    long double lnmapQuality;       // map quality for the originating read
+    Real lnmapQuality;       // map quality for the originating read
     double readMismatchRate; // per-base mismatch rate for the read
     double readIndelRate;  // only considering gaps
     double readSNPRate;    // only considering snps/mnps
@@ -153,7 +155,7 @@ public:
            string& readgroupid,
            string& sqtech,
            bool strnd, 
-           long double qual,
+           Real qual,
            string qstr, 
            short mapqual,
            bool ispair,
@@ -162,7 +164,8 @@ public:
            string cigarstr,
            vector<Allele>* ra,
            long int bas,
-           long int bae)
+           long int bae,
+           int rgindex = -1)
         : type(t)
         , referenceName(refname)
         , position(pos)
@@ -177,6 +180,7 @@ public:
         , sampleID(sampleid)
         , readID(readid)
         , readGroupID(readgroupid)
+        , readGroupIndex(rgindex)
         , sequencingTechnology(sqtech)
         , strand(strnd ? STRAND_FORWARD : STRAND_REVERSE)
         , quality((qual == -1) ? averageQuality(qstr) : qual) // passing -1 as quality triggers this calculation
@@ -220,6 +224,7 @@ public:
         , quality(0)
         , lnquality(1)
         , position(pos)
+        , readGroupIndex(-1)
         , genotypeAllele(true)
         , readMismatchRate(0)
         , readIndelRate(0)
@@ -244,11 +249,12 @@ public:
     bool isNull(void) const; // true if type == ALLELE_NULL
     int referenceOffset(void) const;
     const short currentQuality(void) const;  // for getting the quality of a given position in multi-bp alleles
-    const long double lncurrentQuality(void) const;
+    const Real lncurrentQuality(void) const;
+    int phredQuality(void) const; // quality as an integer phred score, or -1 if lnquality is not of one
     const int subquality(int startpos, int len) const;
-    const long double lnsubquality(int startpos, int len) const;
+    const Real lnsubquality(int startpos, int len) const;
     const int subquality(const Allele &a) const;
-    const long double lnsubquality(const Allele &a) const;
+    const Real lnsubquality(const Allele &a) const;
     //const int basesLeft(void) const; // returns the bases left within the read of the current position within the allele
     //const int basesRight(void) const; // returns the bases right within the read of the current position within the allele
     bool sameSample(Allele &other);  // if the other allele has the same sample as this one
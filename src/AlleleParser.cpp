@@ -94,10 +94,25 @@ void AlleleParser::openTraceFile(void) {
     }
 }
 
+// reopens a file written by an earlier run, discarding what it wrote after
+// its last checkpoint
+void resumeFile(ofstream& file, const string& filename, long int offset) {
+    if (truncate(filename.c_str(), offset) != 0) {
+        cerr << "could not truncate " << filename << " to resume from the checkpoint" << endl;
+        exit(1);
+    }
+    file.open(filename.c_str(), ios::in | ios::out);
+    file.seekp(0, ios::end);
+}
+
 void AlleleParser::openFailedFile(void) {
     if (!parameters.failedFile.empty()) {
-        failedFile.open(parameters.failedFile.c_str(), ios::out);
         DEBUG("Opening failed alleles file: " << parameters.failedFile << " ...");
+        if (checkpoint && checkpoint->resuming) {
+            resumeFile(failedFile, parameters.failedFile, checkpoint->failedOffset);
+        } else {
+            failedFile.open(parameters.failedFile.c_str(), ios::out);
+        }
         if (!failedFile) {
             ERROR(" unable to open failed alleles file: " << parameters.failedFile );
             exit(1);
@@ -106,9 +121,17 @@ void AlleleParser::openFailedFile(void) {
 }
 
 void AlleleParser::openOutputFile(void) {
-    if (parameters.outputFile != "") {
-        outputFile.open(parameters.outputFile.c_str(), ios::out);
+    if (parameters.outputBgzf) {
+        DEBUG("Opening BGZF output: " << parameters.outputFile << " ...");
+        bgzfWriter = new BgzfWriter(parameters.outputFile, parameters.threads);
+        output = new ostream(bgzfWriter);
+    } else if (parameters.outputFile != "") {
         DEBUG("Opening output file: " << parameters.outputFile << " ...");
+        if (checkpoint && checkpoint->resuming) {
+            resumeFile(outputFile, parameters.outputFile, checkpoint->outputOffset);
+        } else {
+            outputFile.open(parameters.outputFile.c_str(), ios::out);
+        }
         if (!outputFile) {
             ERROR(" unable to open output file: " << parameters.outputFile);
             exit(1);
@@ -173,6 +196,37 @@ void AlleleParser::getSequencingTechnologies(void) {
 
 }
 
+// gives the samples, read groups and technologies ids, and records which
+// belong to which by id, so that we needn't look them up by name for each
+// alignment.  every parser assigns the same ids, as they read the same headers.
+void AlleleParser::assignSymbolIds(void) {
+
+    for (vector<string>::iterator s = sampleList.begin(); s != sampleList.end(); ++s) {
+        sampleSymbols.id(*s);
+    }
+    for (map<string, string>::iterator r = readGroupToSampleNames.begin(); r != readGroupToSampleNames.end(); ++r) {
+        int readGroup = readGroupSymbols.id(r->first);
+        if (readGroup >= readGroupSamples.size()) {
+            readGroupSamples.resize(readGroup + 1, -1);
+        }
+        readGroupSamples.at(readGroup) = sampleSymbols.id(r->second);
+    }
+    for (map<string, string>::iterator r = readGroupToTechnology.begin(); r != readGroupToTechnology.end(); ++r) {
+        int readGroup = readGroupSymbols.id(r->first);
+        if (readGroup >= readGroupTechnologies.size()) {
+            readGroupTechnologies.resize(readGroup + 1, -1);
+        }
+        readGroupTechnologies.at(readGroup) = technologySymbols.id(r->second);
+    }
+    readGroupSamples.resize(readGroupSymbols.size(), -1);
+    readGroupTechnologies.resize(readGroupSymbols.size(), -1);
+
+    for (vector<string>::iterator s = sampleList.begin(); s != sampleList.end(); ++s) {
+        samplePopulations.push_back(samplePopulation[*s]);
+    }
+
+}
+
 void AlleleParser::getPopulations(void) {
 
     map<string, string> allSamplePopulation;
@@ -682,6 +736,20 @@ void AlleleParser::eraseReferenceSequence(int leftErasure) {
     currentSequenceStart += leftErasure;
 }
 
+// extends each target by margin on either side, without leaving its bounds
+vector<BedTarget> widenTargets(vector<BedTarget>& owned, vector<BedTarget>& bounds, long int margin) {
+    vector<BedTarget> widened;
+    for (int i = 0; i < owned.size(); ++i) {
+        BedTarget& t = owned.at(i);
+        BedTarget& b = bounds.at(i);
+        widened.push_back(BedTarget(t.seq,
+                                    max((long int) b.left, t.left - margin),
+                                    min((long int) b.right, t.right + margin),
+                                    t.desc));
+    }
+    return widened;
+}
+
 void AlleleParser::loadTargets(void) {
 
     // if we have a targets file, use it...
@@ -781,6 +849,19 @@ void AlleleParser::loadTargets(void) {
         }
     }
 
+    // with --region-margin, the targets are pieces of the sequences which are
+    // called separately, so take the margin from their neighbours
+    if (parameters.regionMargin > 0 && !targets.empty()) {
+        vector<BedTarget> owned = targets;
+        vector<BedTarget> bounds;
+        for (vector<BedTarget>::iterator t = owned.begin(); t != owned.end(); ++t) {
+            bounds.push_back(BedTarget(t->seq, 0, reference.sequenceLength(t->seq) - 1));
+        }
+        targets = widenTargets(owned, bounds, parameters.regionMargin);
+        bedReader.targets = targets;
+        ownedTargets = owned;
+    }
+
     bedReader.buildIntervals(); // set up interval tree in the bedreader
 
     DEBUG("Number of target regions: " << targets.size());
@@ -796,7 +877,7 @@ void AlleleParser::loadTargetsFromBams(void) {
     for( ; refIter != refEnd; ++refIter) {
         RefData refData = *refIter;
         string refName = refData.RefName;
-        BedTarget bd(refName, 0, refData.RefLength); // 0-based inclusive internally
+        BedTarget bd(refName, 0, refData.RefLength - 1); // 0-based inclusive internally
         DEBUG2("will process reference sequence " << refName << ":" << bd.left << ".." << bd.right + 1);
         targets.push_back(bd);
     }
@@ -869,10 +950,59 @@ bool AlleleParser::inTarget(void) {
     }
 }
 
+void AlleleParser::setTargets(vector<BedTarget>& newTargets) {
+
+    targets = newTargets;
+    ownedTargets.clear();
+    bedReader.targets = newTargets;
+    bedReader.intervals.clear();
+    bedReader.buildIntervals();
+
+    // return to the state we are in before the first call to getNextAlleles
+    clearRegisteredAlignments();
+    inputVariantAlleles.clear();
+    haplotypeBasisAlleles.clear();
+    cachedRepeatCounts.clear();
+    currentTarget = NULL;
+    currentSequenceName.clear();
+    currentSequence.clear();
+    currentSequenceStart = 0;
+    currentPosition = 0;
+    currentRefID = 0;
+    lastHaplotypeLength = 0;
+    justSwitchedTargets = false;
+    hasMoreAlignments = true;
+    rightmostHaplotypeBasisAllelePosition = 0;
+    rightmostInputAllelePosition = 0;
+
+}
+
+void AlleleParser::setSoftTargets(vector<BedTarget>& owned, vector<BedTarget>& bounds, long int margin) {
+    vector<BedTarget> widened = widenTargets(owned, bounds, margin);
+    setTargets(widened);
+    ownedTargets = owned;
+}
+
+BedTarget* AlleleParser::currentOwnedTarget(void) {
+    if (ownedTargets.empty() || !currentTarget) {
+        return NULL;
+    }
+    return &ownedTargets.at(currentTarget - &targets.front());
+}
+
 // initialization function
 // sets up environment so we can start registering alleles
 AlleleParser::AlleleParser(int argc, char** argv) : parameters(Parameters(argc, argv))
 {
+    initialize(true);
+}
+
+AlleleParser::AlleleParser(Parameters& params) : parameters(params)
+{
+    initialize(false);
+}
+
+void AlleleParser::initialize(bool openOutputFiles) {
 
     oneSampleAnalysis = false;
     currentRefID = 0; // will get set properly via toNextRefID
@@ -889,11 +1019,30 @@ AlleleParser::AlleleParser(int argc, char** argv) : parameters(Parameters(argc,
     rightmostInputAllelePosition = 0;
     nullSample = new Sample();
     referenceSampleName = "reference_sample";
+    alignmentQueue = NULL;
+    readingAlignments = false;
+    stopReadingAlignments = false;
 
     // initialization
-    openTraceFile();
-    openFailedFile();
-    openOutputFile();
+    checkpoint = NULL;
+    bgzfWriter = NULL;
+    if (openOutputFiles) {
+        if (!parameters.checkpointFile.empty()) {
+            checkpoint = new Checkpoint(parameters.checkpointFile, parameters.commandline);
+            checkpoint->load();
+        }
+        openTraceFile();
+        openFailedFile();
+        openOutputFile();
+        if (checkpoint) {
+            checkpoint->output = &outputFile;
+            checkpoint->failed = &failedFile;
+            checkpoint->outputName = parameters.outputFile;
+            checkpoint->failedName = parameters.failedFile;
+        }
+    } else {
+        output = NULL;
+    }
 
     loadFastaReference();
     // when we open the bam files we can use the number of targets to decide if
@@ -905,6 +1054,7 @@ AlleleParser::AlleleParser(int argc, char** argv) : parameters(Parameters(argc,
     getSampleNames();
     getPopulations();
     getSequencingTechnologies();
+    assignSymbolIds();
 
     // sample CNV
     loadSampleCNVMap();
@@ -922,6 +1072,9 @@ AlleleParser::AlleleParser(int argc, char** argv) : parameters(Parameters(argc,
 
 AlleleParser::~AlleleParser(void) {
 
+    stopAlignmentReader();
+    delete alignmentQueue;
+
     delete nullSample;
 
     // close trace file?  seems to get closed properly on object deletion...
@@ -929,6 +1082,15 @@ AlleleParser::~AlleleParser(void) {
 
     if (variantCallInputFile.is_open()) delete currentVariant;
 
+    delete checkpoint;
+
+    // the writer finishes compressing the output and writes its index
+    if (bgzfWriter) {
+        output->flush();
+        delete output;
+        delete bgzfWriter;
+    }
+
 }
 
 // position of alignment relative to current sequence
@@ -1259,7 +1421,7 @@ Allele AlleleParser::makeAllele(RegisteredAlignment& ra,
                                 string& sampleName,
                                 BamAlignment& alignment,
                                 string& sequencingTech,
-                                long double qual,
+                                Real qual,
                                 string& qualstr
     ) {
 
@@ -1395,7 +1557,7 @@ Allele AlleleParser::makeAllele(RegisteredAlignment& ra,
                   ra.readgroup,
                   sequencingTech,
                   !alignment.IsReverseStrand(),
-                  max(qual, (long double) 0), // ensure qual is at least 0
+                  max(qual, (Real) 0), // ensure qual is at least 0
                   qualstr,
                   alignment.MapQuality,
                   alignment.IsPaired(),
@@ -1404,7 +1566,8 @@ Allele AlleleParser::makeAllele(RegisteredAlignment& ra,
                   cigar,
                   &ra.alleles,
                   alignment.Position,
-                  alignment.GetEndPosition());
+                  alignment.GetEndPosition(),
+                  ra.readGroupIndex);
 
 }
 
@@ -1510,7 +1673,7 @@ RegisteredAlignment& AlleleParser::registerAlignment(BamAlignment& alignment, Re
                 }
 
                 // convert base quality value into short int
-                long double qual = qualityChar2LongDouble(rQual.at(rp));
+                Real qual = qualityChar2LongDouble(rQual.at(rp));
 
                 // get reference allele
                 string sb;
@@ -1574,7 +1737,7 @@ RegisteredAlignment& AlleleParser::registerAlignment(BamAlignment& alignment, Re
                     string readSequence = rDna.substr(rp - length, length);
                     string qualstr = rQual.substr(rp - length, length);
                     for (int j = 0; j < length; ++j) {
-                        long double lqual = qualityChar2LongDouble(qualstr.at(j));
+                        Real lqual = qualityChar2LongDouble(qualstr.at(j));
                         string qualp = qualstr.substr(j, 1);
                         string rs = readSequence.substr(j, 1);
                         if (allATGC(rs)) {
@@ -1624,7 +1787,7 @@ RegisteredAlignment& AlleleParser::registerAlignment(BamAlignment& alignment, Re
                 string readSequence = rDna.substr(rp - length, length);
                 string qualstr = rQual.substr(rp - length, length);
                 for (int j = 0; j < length; ++j) {
-                    long double lqual = qualityChar2LongDouble(qualstr.at(j));
+                    Real lqual = qualityChar2LongDouble(qualstr.at(j));
                     string qualp = qualstr.substr(j, 1);
                     string rs = readSequence.substr(j, 1);
                     if (allATGC(rs)) {
@@ -1715,7 +1878,7 @@ RegisteredAlignment& AlleleParser::registerAlignment(BamAlignment& alignment, Re
 
             string qualstr = rQual.substr(spanstart, L);
 
-            long double qual;
+            Real qual;
             if (parameters.useMinIndelQuality) {
                 qual = minQuality(qualstr);
                 //qual = averageQuality(qualstr);
@@ -1728,8 +1891,8 @@ RegisteredAlignment& AlleleParser::registerAlignment(BamAlignment& alignment, Re
                 // the quality string X a scaling constant derived from the ratio
                 // between the length of the quality string and the length of the
                 // allele
-                //qual += ln2phred(log((long double) l / (long double) L));
-                qual += ln2phred(log((long double) L / (long double) l));
+                //qual += ln2phred(log((Real) l / (Real) L));
+                qual += ln2phred(log((Real) L / (Real) l));
                 qual /= harmonicSum(l);
             }
 
@@ -1796,7 +1959,7 @@ RegisteredAlignment& AlleleParser::registerAlignment(BamAlignment& alignment, Re
 
             string qualstr = rQual.substr(spanstart, L);
 
-            long double qual;
+            Real qual;
             if (parameters.useMinIndelQuality) {
                 qual = minQuality(qualstr);
                 //qual = averageQuality(qualstr); // does not work as well as the min
@@ -1809,8 +1972,8 @@ RegisteredAlignment& AlleleParser::registerAlignment(BamAlignment& alignment, Re
                 // the quality string X a scaling constant derived from the ratio
                 // between the length of the quality string and the length of the
                 // allele
-                //qual += ln2phred(log((long double) l / (long double) L));
-                qual += ln2phred(log((long double) L / (long double) l));
+                //qual += ln2phred(log((Real) l / (Real) L));
+                qual += ln2phred(log((Real) L / (Real) l));
                 qual /= harmonicSum(l);
             }
 
@@ -2031,7 +2194,9 @@ void AlleleParser::updateAlignmentQueue(long int position,
             }
 
             // skip this alignment if we are not analyzing the sample it is drawn from
-            if (readGroupToSampleNames.find(readGroup) == readGroupToSampleNames.end()) {
+            int readGroupIndex = readGroupSymbols.find(readGroup);
+            if (readGroupIndex < 0 || readGroupIndex >= readGroupSamples.size()
+                || readGroupSamples.at(readGroupIndex) < 0) {
                 ERROR("could not find sample matching read group id " << readGroup);
                 continue;
             }
@@ -2081,11 +2246,10 @@ void AlleleParser::updateAlignmentQueue(long int position,
                                     currentSequence.substr(currentSequencePosition(currentAlignment), length));
                 }
                 // get sample name
-                string sampleName = readGroupToSampleNames[readGroup];
+                string sampleName = sampleSymbols.name(readGroupSamples.at(readGroupIndex));
                 string sequencingTech;
-                map<string, string>::iterator t = readGroupToTechnology.find(readGroup);
-                if (t != readGroupToTechnology.end()) {
-                    sequencingTech = t->second;
+                if (readGroupTechnologies.at(readGroupIndex) >= 0) {
+                    sequencingTech = technologySymbols.name(readGroupTechnologies.at(readGroupIndex));
                 }
                 // limit base quality if cap set
                 if (parameters.baseQualityCap != 0) {
@@ -2097,6 +2261,8 @@ void AlleleParser::updateAlignmentQueue(long int position,
                 // and insert the registered alignment into that deque
                 rq.push_front(RegisteredAlignment(currentAlignment, parameters));
                 RegisteredAlignment& ra = rq.front();
+                // alignments without a read group are of the "unknown" one, but keep no id
+                ra.readGroupIndex = (ra.readgroup == readGroup) ? readGroupIndex : -1;
                 registerAlignment(currentAlignment, ra, sampleName, sequencingTech);
                 // backtracking if we have too many mismatches
                 // or if there are no recorded alleles
@@ -2113,7 +2279,7 @@ void AlleleParser::updateAlignmentQueue(long int position,
                     }
                 }
             }
-        } while ((hasMoreAlignments = bamMultiReader.GetNextAlignment(currentAlignment))
+        } while ((hasMoreAlignments = getNextAlignment(currentAlignment))
                  && currentAlignment.Position <= position
                  && currentAlignment.RefID == currentRefID);
     }
@@ -2454,7 +2620,7 @@ void AlleleParser::addCurrentGenotypeLikelihoods(map<int, vector<Genotype> >& ge
     // check if there are any genotype likelihoods at the current position
     if (inputGenotypeLikelihoods.find(currentPosition) != inputGenotypeLikelihoods.end()) {
 
-        map<string, map<string, long double> >& inputLikelihoodsBySample = inputGenotypeLikelihoods[currentPosition];
+        map<string, map<string, Real> >& inputLikelihoodsBySample = inputGenotypeLikelihoods[currentPosition];
 
         vector<Genotype*> genotypePtrs;
         for (map<int, vector<Genotype> >::iterator gp = genotypesByPloidy.begin(); gp != genotypesByPloidy.end(); ++gp) {
@@ -2464,14 +2630,14 @@ void AlleleParser::addCurrentGenotypeLikelihoods(map<int, vector<Genotype> >& ge
             }
         }
         // if there are, add them to the sample data likelihoods
-        for (map<string, map<string, long double> >::iterator gls = inputLikelihoodsBySample.begin();
+        for (map<string, map<string, Real> >::iterator gls = inputLikelihoodsBySample.begin();
                 gls != inputLikelihoodsBySample.end(); ++gls) {
             const string& sampleName = gls->first;
-            map<string, long double>& likelihoods = gls->second;
-            map<Genotype*, long double> likelihoodsPtr;
-            for (map<string, long double>::iterator gl = likelihoods.begin(); gl != likelihoods.end(); ++gl) {
+            map<string, Real>& likelihoods = gls->second;
+            map<Genotype*, Real> likelihoodsPtr;
+            for (map<string, Real>::iterator gl = likelihoods.begin(); gl != likelihoods.end(); ++gl) {
                 const string& genotype = gl->first;
-                long double l = gl->second;
+                Real l = gl->second;
                 for (vector<Genotype*>::iterator g = genotypePtrs.begin(); g != genotypePtrs.end(); ++g) {
                     if (convert(**g) == genotype) {
                         likelihoodsPtr[*g] = l;
@@ -2483,7 +2649,7 @@ void AlleleParser::addCurrentGenotypeLikelihoods(map<int, vector<Genotype> >& ge
             sampleData.name = sampleName;
             // TODO add null sample object to sampleData
             // do you need to????
-            for (map<Genotype*, long double>::iterator p = likelihoodsPtr.begin(); p != likelihoodsPtr.end(); ++p) {
+            for (map<Genotype*, Real>::iterator p = likelihoodsPtr.begin(); p != likelihoodsPtr.end(); ++p) {
                 sampleData.push_back(SampleDataLikelihood(sampleName, nullSample, p->first, p->second, 0));
             }
             sortSampleDataLikelihoods(sampleData);
@@ -2680,6 +2846,9 @@ bool AlleleParser::loadTarget(BedTarget* target) {
     currentPosition = currentTarget->left;
     rightmostHaplotypeBasisAllelePosition = currentTarget->left;
 
+    // the reader thread must not be reading while we jump
+    stopAlignmentReader();
+
     if (!bamMultiReader.SetRegion(refSeqID, currentTarget->left, refSeqID, currentTarget->right + 1)) { // bamtools expects 0-based, half-open
         ERROR("Could not SetRegion to " << currentTarget->seq << ":" << currentTarget->left << ".." << currentTarget->right + 1);
         cerr << bamMultiReader.GetErrorString() << endl;
@@ -2712,14 +2881,120 @@ bool AlleleParser::loadTarget(BedTarget* target) {
 
 }
 
+void* readAlignments(void* arg) {
+    ((AlleleParser*) arg)->readAlignments();
+    return NULL;
+}
+
+// decodes alignments ahead of the parser, dropping those which we would never
+// register, until we run out of alignments in the region or are asked to stop
+void AlleleParser::readAlignments(void) {
+    bool ok = true;
+    while (ok && !stopReadingAlignments) {
+        PrefetchedAlignment& next = alignmentQueue->back();
+        while ((ok = bamMultiReader.GetNextAlignment(next.alignment))
+               && !usableAlignment(next.alignment)) { }
+        next.ok = ok;
+        alignmentQueue->push();
+    }
+    // the consumer waits for this to know we are done
+    if (ok) {
+        alignmentQueue->back().ok = false;
+        alignmentQueue->push();
+    }
+}
+
+// the subset of the filters in updateAlignmentQueue which depend only on the
+// alignment itself, applied on the reader thread.  updateAlignmentQueue checks
+// the read group of an alignment before filtering it, exiting or reporting
+// an error if it has none or one we don't know, so we pass on the
+// alignments we would drop if their read groups would fail those checks.
+bool AlleleParser::usableAlignment(BamAlignment& alignment) {
+    if ((alignment.IsDuplicate() && !parameters.useDuplicateReads)
+        || !alignment.IsMapped()
+        || alignment.AlignedBases.size() == 0
+        || !alignment.IsPrimaryAlignment()
+        || alignment.MapQuality < parameters.MQL0) {
+        return !knownReadGroup(alignment);
+    }
+    if (parameters.baseQualityCap != 0) {
+        capBaseQuality(alignment, parameters.baseQualityCap);
+    }
+    return true;
+}
+
+// true if the alignment has a read group exactly when the header has them,
+// and its read group belongs to a sample we are analyzing
+bool AlleleParser::knownReadGroup(BamAlignment& alignment) {
+    string readGroup;
+    if (!alignment.GetTag("RG", readGroup)) {
+        if (!oneSampleAnalysis) {
+            return false;
+        }
+        readGroup = "unknown";
+    } else if (oneSampleAnalysis) {
+        return false;
+    }
+    int readGroupIndex = readGroupSymbols.find(readGroup);
+    return readGroupIndex >= 0 && readGroupIndex < readGroupSamples.size()
+        && readGroupSamples.at(readGroupIndex) >= 0;
+}
+
+void AlleleParser::startAlignmentReader(void) {
+    if (!alignmentQueue) {
+        alignmentQueue = new BoundedQueue<PrefetchedAlignment>(ALIGNMENT_QUEUE_SIZE);
+    }
+    stopReadingAlignments = false;
+    if (pthread_create(&alignmentReader, NULL, ::readAlignments, this)) {
+        ERROR("could not create alignment reader thread");
+        exit(1);
+    }
+    readingAlignments = true;
+}
+
+void AlleleParser::stopAlignmentReader(void) {
+    if (!readingAlignments) {
+        return;
+    }
+    stopReadingAlignments = true;
+    // drain the queue so the reader can't block on a full queue
+    while (alignmentQueue->front().ok) {
+        alignmentQueue->pop();
+    }
+    alignmentQueue->pop();
+    pthread_join(alignmentReader, NULL);
+    readingAlignments = false;
+}
+
+bool AlleleParser::getNextAlignment(BamAlignment& alignment) {
+    if (!parameters.pipeline) {
+        return bamMultiReader.GetNextAlignment(alignment);
+    }
+    // the reader is started lazily, as we may jump before we read anything
+    if (!readingAlignments) {
+        startAlignmentReader();
+    }
+    PrefetchedAlignment& next = alignmentQueue->front();
+    bool ok = next.ok;
+    if (ok) {
+        alignment = next.alignment;
+    }
+    alignmentQueue->pop();
+    if (!ok) {
+        pthread_join(alignmentReader, NULL);
+        readingAlignments = false;
+    }
+    return ok;
+}
+
 bool AlleleParser::getFirstAlignment(void) {
 
     bool hasAlignments = true;
-    if (!bamMultiReader.GetNextAlignment(currentAlignment)) {
+    if (!getNextAlignment(currentAlignment)) {
         hasAlignments = false;
     } else {
         while (!currentAlignment.IsMapped()) {
-            if (!bamMultiReader.GetNextAlignment(currentAlignment)) {
+            if (!getNextAlignment(currentAlignment)) {
                 hasAlignments = false;
                 break;
             }
@@ -2836,7 +3111,7 @@ bool AlleleParser::toNextPosition(void) {
         // here we loop over unaligned reads at the beginning of a target
         // we need to get to a mapped read to figure out where we are
         while (hasMoreAlignments && !currentAlignment.IsMapped()) {
-            hasMoreAlignments = bamMultiReader.GetNextAlignment(currentAlignment);
+            hasMoreAlignments = getNextAlignment(currentAlignment);
         }
         // now, if the current position of this alignment is outside of the reference sequence length, switch references
         if (hasMoreAlignments) {
@@ -2940,7 +3215,7 @@ bool AlleleParser::dummyProcessNextTarget(void) {
         return false;
     }
 
-    while (bamMultiReader.GetNextAlignment(currentAlignment)) {
+    while (getNextAlignment(currentAlignment)) {
     }
 
     return true;
@@ -3716,6 +3991,8 @@ void AlleleParser::getAlleles(Samples& samples, int allowedAlleleTypes,
         samples.erase(*name);
     }
 
+    samples.binObservations();
+
     DEBUG2("done getting alleles");
 
 }
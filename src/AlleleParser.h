@@ -13,6 +13,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <cmath>
+#include <pthread.h>
 #include "split.h"
 #include "join.h"
 #include "api/BamReader.h"
@@ -30,6 +31,9 @@
 #include "LeftAlign.h"
 #include "Variant.h"
 #include "version_git.h"
+#include "BoundedQueue.h"
+#include "Checkpoint.h"
+#include "BgzfWriter.h"
 
 // the size of the window of the reference which is always cached in memory
 #define CACHED_REFERENCE_WINDOW 300
@@ -38,6 +42,10 @@
 // increasing this reduces disk access when using haplotype basis alleles, but increases memory usage
 #define CACHED_BASIS_HAPLOTYPE_WINDOW 1000
 
+// the number of decoded alignments which may wait to be registered when
+// reading alignments on a separate thread (--pipeline)
+#define ALIGNMENT_QUEUE_SIZE 1024
+
 using namespace std;
 using namespace BamTools;
 
@@ -53,6 +61,7 @@ public:
     int refid;
     string name;
     string readgroup;
+    int readGroupIndex;  // id of readgroup (see SymbolTable.h)
     vector<Allele> alleles;
     int mismatches;
     int snpCount;
@@ -66,6 +75,7 @@ public:
         , end(alignment.GetEndPosition())
         , refid(alignment.RefID)
         , name(alignment.Name)
+        , readGroupIndex(-1)
         , mismatches(0)
         , snpCount(0)
         , indelCount(0)
@@ -131,6 +141,9 @@ public:
     Parameters parameters; // holds operational parameters passed at program invocation
     
     AlleleParser(int argc, char** argv);
+    // builds a parser from already-parsed parameters without opening the
+    // output, trace, or failed alleles files, for use by worker threads
+    AlleleParser(Parameters& params);
     ~AlleleParser(void); 
 
     vector<string> sampleList; // list of sample names, indexed by sample id
@@ -142,6 +155,11 @@ public:
     map<string, string> readGroupToTechnology; // maps read groups to technologies
     vector<string> sequencingTechnologies;  // a list of the present technologies
 
+    // the above by id (see SymbolTable.h), for use while reading alignments
+    vector<int> readGroupSamples;      // sample id of each read group, or -1
+    vector<int> readGroupTechnologies; // technology id of each read group, or -1
+    vector<string> samplePopulations;  // population of each sample, as sampleList
+
     CNVMap sampleCNV;
 
     // reference
@@ -155,9 +173,29 @@ public:
     // returns true if we are within a target
     // useful for controlling output when we are reading from stdin
     bool inTarget(void);
+    // replaces the targets and rewinds the parser to the start of the first
+    void setTargets(vector<BedTarget>& newTargets);
+
+    // soft target boundaries
+    // we process each target plus a margin on either side (within its
+    // bounds), so that the parser reaches the edges of the target in the same
+    // state as it would if it processed all of the bounds.  only sites which
+    // start in the target itself should be reported.  when target boundaries
+    // are soft, targets holds the widened targets and ownedTargets the
+    // targets themselves.
+    vector<BedTarget> ownedTargets;
+    void setSoftTargets(vector<BedTarget>& owned, vector<BedTarget>& bounds, long int margin);
+    // the part of the current target whose sites we report, or NULL if its
+    // boundaries are hard
+    BedTarget* currentOwnedTarget(void);
 
     // bamreader
     BamMultiReader bamMultiReader;
+    // gets the next alignment from bamMultiReader, or from the alignment
+    // reader thread when running with --pipeline
+    bool getNextAlignment(BamAlignment& alignment);
+    // body of the alignment reader thread
+    void readAlignments(void);
 
     // bed reader
     BedReader bedReader;
@@ -189,7 +227,7 @@ public:
 		      string& sampleName,
 		      BamAlignment& alignment,
 		      string& sequencingTech,
-		      long double qual,
+		      Real qual,
 		      string& qualstr);
 
 
@@ -201,7 +239,7 @@ public:
     void getInputVariantsInRegion(string& seq, long start = 0, long end = 0);
     void getAllInputVariants(void);
     //  position         sample     genotype  likelihood
-    map<string, map<long int, map<string, map<string, long double> > > > inputGenotypeLikelihoods; // drawn from input VCF
+    map<string, map<long int, map<string, map<string, Real> > > > inputGenotypeLikelihoods; // drawn from input VCF
     map<string, map<long int, map<Allele, int> > > inputAlleleCounts; // drawn from input VCF
     Sample* nullSample;
 
@@ -231,6 +269,7 @@ public:
     void getSampleNames(void);
     void getPopulations(void);
     void getSequencingTechnologies(void);
+    void assignSymbolIds(void);
     void loadSampleCNVMap(void);
     int currentSamplePloidy(string const& sample);
     int copiesOfLocus(Samples& samples);
@@ -249,6 +288,7 @@ public:
     bool getFirstVariant(void);
     void loadTargetsFromBams(void);
     void initializeOutputFiles(void);
+    void initialize(bool openOutputFiles);
     RegisteredAlignment& registerAlignment(BamAlignment& alignment, RegisteredAlignment& ra, string& sampleName, string& sequencingTech);
     void clearRegisteredAlignments(void);
     void updateAlignmentQueue(long int position, vector<Allele*>& newAlleles, bool gettingPartials = false);
@@ -329,6 +369,10 @@ public:
     // output files
     ofstream logFile, outputFile, traceFile, failedFile;
     ostream* output;
+    BgzfWriter* bgzfWriter;  // with --output-bgzf, the buffer of output
+
+    // the progress of the run, with --checkpoint
+    Checkpoint* checkpoint;
 
     // utility
     bool isCpG(string& altbase);
@@ -357,6 +401,20 @@ private:
     BamAlignment currentAlignment;
     vcf::Variant* currentVariant;
 
+    // alignments decoded ahead of the parser by the alignment reader thread
+    struct PrefetchedAlignment {
+        BamAlignment alignment;
+        bool ok; // false marks the end of the alignments in the current region
+    };
+    BoundedQueue<PrefetchedAlignment>* alignmentQueue;
+    pthread_t alignmentReader;
+    bool readingAlignments;
+    volatile bool stopReadingAlignments;
+    void startAlignmentReader(void);
+    void stopAlignmentReader(void);
+    bool usableAlignment(BamAlignment& alignment);
+    bool knownReadGroup(BamAlignment& alignment);
+
 };
 
 #endif
@@ -0,0 +1,382 @@
+#include "BgzfWriter.h"
+#include <stdlib.h>
+#include <string.h>
+#include "BGZF.h"
+
+using namespace BamTools;
+
+// marks the absence of a bin
+#define NO_BIN 0xffffffff
+
+// the tabix index format code for VCF
+#define TABIX_VCF 2
+
+// the bin of the smallest interval of the binning index which holds
+// [begin, end), as in the SAM specification
+uint32_t regionToBin(long int begin, long int end) {
+    --end;
+    if (begin >> 14 == end >> 14) return ((1 << 15) - 1) / 7 + (begin >> 14);
+    if (begin >> 17 == end >> 17) return ((1 << 12) - 1) / 7 + (begin >> 17);
+    if (begin >> 20 == end >> 20) return ((1 << 9) - 1) / 7 + (begin >> 20);
+    if (begin >> 23 == end >> 23) return ((1 << 6) - 1) / 7 + (begin >> 23);
+    if (begin >> 26 == end >> 26) return ((1 << 3) - 1) / 7 + (begin >> 26);
+    return 0;
+}
+
+// indexes are little-endian, as are the hosts we build on
+template <class T>
+void appendValue(string& data, T value) {
+    data.append(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+TabixIndex::TabixIndex(void)
+    : currentBin(NO_BIN)
+    , chunkStart(0)
+    , lastStop(0)
+{ }
+
+void TabixIndex::closeChunk(void) {
+    if (currentBin != NO_BIN) {
+        references.back().bins[currentBin].push_back(make_pair(chunkStart, lastStop));
+    }
+    currentBin = NO_BIN;
+}
+
+void TabixIndex::add(const string& sequence, long int begin, long int end, uint64_t start, uint64_t stop) {
+
+    if (names.empty() || names.back() != sequence) {
+        closeChunk();
+        names.push_back(sequence);
+        references.push_back(Reference());
+    }
+    Reference& reference = references.back();
+
+    if (end <= begin) {
+        end = begin + 1;
+    }
+
+    // the linear index holds the first record overlapping each 16kb window
+    for (long int w = begin >> 14; w <= (end - 1) >> 14; ++w) {
+        if (w >= reference.offsets.size()) {
+            reference.offsets.resize(w + 1, 0);
+        }
+        if (!reference.offsets.at(w)) {
+            reference.offsets.at(w) = start;
+        }
+    }
+
+    // consecutive records in the same bin form one chunk
+    uint32_t bin = regionToBin(begin, end);
+    if (bin != currentBin) {
+        closeChunk();
+        currentBin = bin;
+        chunkStart = start;
+    }
+    lastStop = stop;
+
+}
+
+string TabixIndex::data(void) {
+
+    closeChunk();
+
+    string data("TBI\1", 4);
+    appendValue(data, (int32_t) names.size());
+    appendValue(data, (int32_t) TABIX_VCF);
+    appendValue(data, (int32_t) 1);   // sequence column
+    appendValue(data, (int32_t) 2);   // start column
+    appendValue(data, (int32_t) 0);   // no end column
+    appendValue(data, (int32_t) '#'); // header lines
+    appendValue(data, (int32_t) 0);   // lines to skip
+    int32_t namesLength = 0;
+    for (vector<string>::iterator n = names.begin(); n != names.end(); ++n) {
+        namesLength += n->size() + 1;
+    }
+    appendValue(data, namesLength);
+    for (vector<string>::iterator n = names.begin(); n != names.end(); ++n) {
+        data.append(n->c_str(), n->size() + 1);
+    }
+
+    for (vector<Reference>::iterator r = references.begin(); r != references.end(); ++r) {
+        appendValue(data, (int32_t) r->bins.size());
+        for (map<uint32_t, vector<pair<uint64_t, uint64_t> > >::iterator b = r->bins.begin();
+             b != r->bins.end(); ++b) {
+            appendValue(data, (uint32_t) b->first);
+            appendValue(data, (int32_t) b->second.size());
+            for (vector<pair<uint64_t, uint64_t> >::iterator c = b->second.begin(); c != b->second.end(); ++c) {
+                appendValue(data, c->first);
+                appendValue(data, c->second);
+            }
+        }
+        // windows without records start where the previous one does
+        for (int w = 1; w < r->offsets.size(); ++w) {
+            if (!r->offsets.at(w)) {
+                r->offsets.at(w) = r->offsets.at(w - 1);
+            }
+        }
+        appendValue(data, (int32_t) r->offsets.size());
+        for (vector<uint64_t>::iterator o = r->offsets.begin(); o != r->offsets.end(); ++o) {
+            appendValue(data, *o);
+        }
+    }
+
+    return data;
+
+}
+
+int compressBgzfBlock(const char* data, int length, char* out) {
+
+    memset(out, 0, BLOCK_HEADER_LENGTH);
+    out[0]  = GZIP_ID1;
+    out[1]  = (char) GZIP_ID2;
+    out[2]  = CM_DEFLATE;
+    out[3]  = FLG_FEXTRA;
+    out[9]  = (char) OS_UNKNOWN;
+    out[10] = BGZF_XLEN;
+    out[12] = BGZF_ID1;
+    out[13] = BGZF_ID2;
+    out[14] = BGZF_LEN;
+
+    // data which doesn't compress is stored, which always fits
+    int compressedLength = 0;
+    for (int level = Z_DEFAULT_COMPRESSION; ; level = Z_NO_COMPRESSION) {
+        z_stream zs;
+        zs.zalloc = NULL;
+        zs.zfree = NULL;
+        zs.opaque = NULL;
+        zs.next_in = (Bytef*) data;
+        zs.avail_in = length;
+        zs.next_out = (Bytef*) &out[BLOCK_HEADER_LENGTH];
+        zs.avail_out = MAX_BLOCK_SIZE - BLOCK_HEADER_LENGTH - BLOCK_FOOTER_LENGTH;
+        if (deflateInit2(&zs, level, Z_DEFLATED, GZIP_WINDOW_BITS, Z_DEFAULT_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+            cerr << "BGZF ERROR: zlib deflate initialization failed." << endl;
+            exit(1);
+        }
+        int status = deflate(&zs, Z_FINISH);
+        deflateEnd(&zs);
+        if (status == Z_STREAM_END) {
+            compressedLength = zs.total_out + BLOCK_HEADER_LENGTH + BLOCK_FOOTER_LENGTH;
+            break;
+        } else if (level == Z_NO_COMPRESSION) {
+            cerr << "BGZF ERROR: could not compress block." << endl;
+            exit(1);
+        }
+    }
+
+    BgzfData::PackUnsignedShort(&out[16], (unsigned short) (compressedLength - 1));
+    unsigned int crc = crc32(crc32(0, NULL, 0), (Bytef*) data, length);
+    BgzfData::PackUnsignedInt(&out[compressedLength - 8], crc);
+    BgzfData::PackUnsignedInt(&out[compressedLength - 4], length);
+
+    return compressedLength;
+
+}
+
+// a batch of blocks, compressed by the threads of the pool
+class BgzfBlocks {
+public:
+    const char* data;
+    size_t length;
+    vector<vector<char> > blocks;
+    vector<int> sizes;
+    BgzfBlocks(const char* d, size_t l, int count)
+        : data(d)
+        , length(l)
+        , blocks(count, vector<char>(MAX_BLOCK_SIZE))
+        , sizes(count)
+    { }
+};
+
+void compressBgzfBlocks(int i, int thread, void* data) {
+    BgzfBlocks* batch = (BgzfBlocks*) data;
+    size_t start = (size_t) i * BGZF_BLOCK_SIZE;
+    int length = min((size_t) BGZF_BLOCK_SIZE, batch->length - start);
+    batch->sizes.at(i) = compressBgzfBlock(batch->data + start, length, &batch->blocks.at(i).front());
+}
+
+void* writeBgzfChunks(void* arg) {
+    ((BgzfWriter*) arg)->writeChunks();
+    return NULL;
+}
+
+BgzfWriter::BgzfWriter(const string& f, int threads)
+    : filename(f)
+    , chunks(BGZF_QUEUE_SIZE)
+    , pool(threads)
+    , addresses(1, 0)
+    , lineStart(0)
+    , indexing(!f.empty())
+{
+    if (filename.empty()) {
+        file = stdout;
+    } else {
+        file = fopen(filename.c_str(), "wb");
+        if (!file) {
+            cerr << "could not open " << filename << " for writing" << endl;
+            exit(1);
+        }
+    }
+    if (pthread_create(&writer, NULL, writeBgzfChunks, this)) {
+        cerr << "could not create BGZF writer thread" << endl;
+        exit(1);
+    }
+}
+
+BgzfWriter::~BgzfWriter(void) {
+    handOff();
+    chunks.push(NULL);
+    pthread_join(writer, NULL);
+    if (file != stdout) {
+        fclose(file);
+    }
+    if (indexing) {
+        writeIndex();
+    }
+}
+
+int BgzfWriter::overflow(int c) {
+    if (c != EOF) {
+        buffer += (char) c;
+        if (buffer.size() >= BGZF_BLOCK_SIZE) {
+            handOff();
+        }
+    }
+    return traits_type::not_eof(c);
+}
+
+streamsize BgzfWriter::xsputn(const char* s, streamsize n) {
+    buffer.append(s, n);
+    if (buffer.size() >= BGZF_BLOCK_SIZE) {
+        handOff();
+    }
+    return n;
+}
+
+// flushing the stream passes on what we have, but doesn't wait for it to be
+// written, or close the block it will go in
+int BgzfWriter::sync(void) {
+    handOff();
+    return 0;
+}
+
+void BgzfWriter::handOff(void) {
+    if (buffer.empty()) {
+        return;
+    }
+    string* chunk = new string;
+    chunk->swap(buffer);
+    chunks.push(chunk);
+}
+
+void BgzfWriter::writeChunks(void) {
+    string* chunk;
+    while ((chunk = chunks.front())) {
+        chunks.pop();
+        if (indexing) {
+            indexLines(*chunk);
+        }
+        pending.append(*chunk);
+        delete chunk;
+        // compress once there's enough to keep the pool busy, or when we've
+        // caught up with the stream
+        if (pending.size() >= (size_t) BGZF_BLOCK_SIZE * pool.size() * 4
+            || (chunks.empty() && pending.size() >= BGZF_BLOCK_SIZE)) {
+            writeBlocks(false);
+        }
+    }
+    chunks.pop();
+    writeBlocks(true);
+    // an empty block marks the end of the file
+    char block[MAX_BLOCK_SIZE];
+    int length = compressBgzfBlock(NULL, 0, block);
+    fwrite(block, 1, length, file);
+    fflush(file);
+}
+
+// finds the lines of the output, and the sequence range of each record
+void BgzfWriter::indexLines(const string& chunk) {
+    size_t start = 0;
+    while (start < chunk.size()) {
+        size_t newline = chunk.find('\n', start);
+        if (newline == string::npos) {
+            line.append(chunk, start, string::npos);
+            break;
+        }
+        line.append(chunk, start, newline - start);
+        uint64_t stop = lineStart + line.size() + 1;
+        if (!line.empty() && line[0] != '#') {
+            // CHROM, POS, ID, REF
+            size_t tab1 = line.find('\t');
+            size_t tab2 = line.find('\t', tab1 + 1);
+            size_t tab3 = line.find('\t', tab2 + 1);
+            size_t tab4 = line.find('\t', tab3 + 1);
+            if (tab4 != string::npos) {
+                Line record;
+                record.sequence = line.substr(0, tab1);
+                record.begin = atol(line.c_str() + tab1 + 1) - 1;
+                record.end = record.begin + (tab4 - tab3 - 1);
+                record.start = lineStart;
+                record.stop = stop;
+                unindexed.push_back(record);
+            }
+        }
+        lineStart = stop;
+        line.clear();
+        start = newline + 1;
+    }
+}
+
+// compresses and writes the complete blocks of pending output, or all of it
+void BgzfWriter::writeBlocks(bool all) {
+
+    size_t length = pending.size();
+    if (!all) {
+        length -= length % BGZF_BLOCK_SIZE;
+    }
+    if (!length) {
+        return;
+    }
+
+    int count = (length + BGZF_BLOCK_SIZE - 1) / BGZF_BLOCK_SIZE;
+    BgzfBlocks batch(pending.data(), length, count);
+    pool.run(count, compressBgzfBlocks, &batch);
+    for (int i = 0; i < count; ++i) {
+        if (fwrite(&batch.blocks.at(i).front(), 1, batch.sizes.at(i), file) != batch.sizes.at(i)) {
+            cerr << "BGZF ERROR: could not write output" << endl;
+            exit(1);
+        }
+        addresses.push_back(addresses.back() + batch.sizes.at(i));
+    }
+    pending.erase(0, length);
+
+    // now we know where the lines in these blocks are
+    while (!unindexed.empty() && unindexed.front().stop / BGZF_BLOCK_SIZE < addresses.size()) {
+        Line& record = unindexed.front();
+        index.add(record.sequence, record.begin, record.end,
+                  virtualOffset(record.start), virtualOffset(record.stop));
+        unindexed.pop_front();
+    }
+
+}
+
+uint64_t BgzfWriter::virtualOffset(uint64_t offset) {
+    return addresses.at(offset / BGZF_BLOCK_SIZE) << 16 | offset % BGZF_BLOCK_SIZE;
+}
+
+void BgzfWriter::writeIndex(void) {
+    string indexFilename = filename + ".tbi";
+    FILE* indexFile = fopen(indexFilename.c_str(), "wb");
+    if (!indexFile) {
+        cerr << "could not open " << indexFilename << " for writing" << endl;
+        exit(1);
+    }
+    string data = index.data();
+    char block[MAX_BLOCK_SIZE];
+    for (size_t start = 0; start < data.size(); start += BGZF_BLOCK_SIZE) {
+        int length = compressBgzfBlock(data.data() + start, min((size_t) BGZF_BLOCK_SIZE, data.size() - start), block);
+        fwrite(block, 1, length, indexFile);
+    }
+    int length = compressBgzfBlock(NULL, 0, block);
+    fwrite(block, 1, length, indexFile);
+    fclose(indexFile);
+}
@@ -0,0 +1,123 @@
+#ifndef BGZFWRITER_H
+#define BGZFWRITER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "BoundedQueue.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+// the uncompressed size of each BGZF block, as written by bgzip, which
+// leaves room for the block to grow when it can't be compressed
+#define BGZF_BLOCK_SIZE 0xff00
+
+// the number of chunks of output which may wait for the writer thread
+#define BGZF_QUEUE_SIZE 256
+
+// a tabix index of a BGZF-compressed VCF file, built as it is written
+class TabixIndex {
+
+public:
+
+    TabixIndex(void);
+
+    // adds a record on sequence, covering [begin, end) (0-based), which
+    // is stored between the virtual file offsets start and stop
+    void add(const string& sequence, long int begin, long int end, uint64_t start, uint64_t stop);
+
+    // the uncompressed index
+    string data(void);
+
+private:
+
+    class Reference {
+    public:
+        map<uint32_t, vector<pair<uint64_t, uint64_t> > > bins;
+        vector<uint64_t> offsets; // the linear index
+    };
+
+    void closeChunk(void);
+
+    vector<string> names;
+    vector<Reference> references;
+    uint32_t currentBin;
+    uint64_t chunkStart;
+    uint64_t lastStop;
+
+};
+
+// a stream buffer which writes BGZF-compressed output, compressing on a
+// thread of its own so that writing to the stream never waits for the disk
+// or for compression
+//
+// output is passed to the writer thread in large chunks.  it packs them into
+// blocks, which are compressed in parallel with a ThreadPool and written in
+// order.  if the output is a file, a tabix index of it is written alongside,
+// as filename.tbi, when the writer is destroyed.
+class BgzfWriter : public streambuf {
+
+public:
+
+    // writes to stdout if filename is empty
+    BgzfWriter(const string& filename, int threads);
+    ~BgzfWriter(void);
+
+    // body of the writer thread
+    void writeChunks(void);
+
+protected:
+
+    int overflow(int c);
+    streamsize xsputn(const char* s, streamsize n);
+    int sync(void);
+
+private:
+
+    // a record of the output which we have yet to index
+    class Line {
+    public:
+        string sequence;
+        long int begin;
+        long int end;
+        uint64_t start;  // uncompressed offsets of the line
+        uint64_t stop;
+    };
+
+    // passes what we've buffered to the writer thread
+    void handOff(void);
+
+    // writer thread side
+    void indexLines(const string& chunk);
+    void writeBlocks(bool all);
+    uint64_t virtualOffset(uint64_t offset);
+    void writeIndex(void);
+
+    string filename;
+    FILE* file;
+    string buffer;
+    BoundedQueue<string*> chunks;
+    pthread_t writer;
+
+    ThreadPool pool;
+    string pending;              // uncompressed output not yet in a block
+    vector<uint64_t> addresses;  // of each block written, and of the next
+    string line;                 // the line we are reading for the index
+    uint64_t lineStart;
+    bool indexing;
+    TabixIndex index;
+    deque<Line> unindexed;       // lines whose blocks aren't all written
+
+};
+
+// compresses length bytes of data into a BGZF block in out, which must
+// hold 65536 bytes, returning the size of the block
+int compressBgzfBlock(const char* data, int length, char* out);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <vector>
+#include <sched.h>
+
+using namespace std;
+
+// a fixed-size ring buffer connecting one producer thread to one consumer
+// thread without locks
+//
+// the producer fills the slot returned by back() and then calls push(), the
+// consumer reads the slot returned by front() and then calls pop().  both
+// wait (yielding the processor) while the queue is full or empty.  slots are
+// reused, so items which hold buffers keep their allocations between uses.
+template <class T>
+class BoundedQueue {
+
+public:
+
+    BoundedQueue(int capacity)
+        : items(capacity + 1)
+        , head(0)
+        , tail(0)
+    { }
+
+    bool empty(void) {
+        return head == tail;
+    }
+
+    bool full(void) {
+        return next(tail) == head;
+    }
+
+    // producer side
+    T& back(void) {
+        while (full()) {
+            sched_yield();
+        }
+        // don't write into the slot before the consumer is done with it
+        __sync_synchronize();
+        return items[tail];
+    }
+
+    void push(void) {
+        // make the contents of the slot visible before the slot itself
+        __sync_synchronize();
+        tail = next(tail);
+    }
+
+    void push(const T& item) {
+        back() = item;
+        push();
+    }
+
+    // consumer side
+    T& front(void) {
+        while (empty()) {
+            sched_yield();
+        }
+        __sync_synchronize();
+        return items[head];
+    }
+
+    void pop(void) {
+        __sync_synchronize();
+        head = next(head);
+    }
+
+private:
+
+    int next(int i) {
+        return (i + 1) % items.size();
+    }
+
+    vector<T> items;
+    volatile int head; // written only by the consumer
+    volatile int tail; // written only by the producer
+
+};
+
+#endif
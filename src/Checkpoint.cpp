@@ -0,0 +1,131 @@
+#include "Checkpoint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "convert.h"
+
+Checkpoint::Checkpoint(const string& f, const string& commandline)
+    : resuming(false)
+    , target(0)
+    , position(-1)
+    , outputOffset(0)
+    , failedOffset(0)
+    , firstTarget(0)
+    , output(NULL)
+    , failed(NULL)
+    , filename(f)
+    , options(commandline)
+    , lastSaved(time(NULL))
+{
+    pthread_mutex_init(&mutex, NULL);
+}
+
+Checkpoint::~Checkpoint(void) {
+    pthread_mutex_destroy(&mutex);
+}
+
+// writes the contents of a file through to the disk.  the streams hide their
+// descriptors, so we open our own; fdatasync applies to the file, not to the
+// descriptor it is called on.
+static bool syncFile(const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fdatasync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+bool Checkpoint::load(void) {
+
+    ifstream in(filename.c_str());
+    if (!in.is_open()) {
+        return false;
+    }
+
+    string line;
+    string savedOptions;
+    while (getline(in, line)) {
+        size_t tab = line.find('\t');
+        if (tab == string::npos) {
+            continue;
+        }
+        string key = line.substr(0, tab);
+        string value = line.substr(tab + 1);
+        if (key == "options") {
+            savedOptions = value;
+        } else if (key == "target") {
+            convert(value, target);
+        } else if (key == "position") {
+            convert(value, position);
+        } else if (key == "output") {
+            convert(value, outputOffset);
+        } else if (key == "failed") {
+            convert(value, failedOffset);
+        }
+    }
+
+    if (savedOptions != options) {
+        cerr << "checkpoint " << filename << " was made by a run with different options:" << endl
+             << savedOptions << endl
+             << "remove it to start again" << endl;
+        exit(1);
+    }
+
+    resuming = true;
+    return true;
+
+}
+
+void Checkpoint::update(int t, long int p) {
+
+    if (time(NULL) - lastSaved < CHECKPOINT_INTERVAL) {
+        return;
+    }
+
+    target = firstTarget + t;
+    position = p;
+    // the output must reach the disk before a checkpoint which refers to it
+    output->flush();
+    outputOffset = output->tellp();
+    bool synced = syncFile(outputName);
+    if (failed->is_open()) {
+        failed->flush();
+        failedOffset = failed->tellp();
+        synced = synced && syncFile(failedName);
+    }
+    if (!synced) {
+        cerr << "could not write the output to disk for checkpoint " << filename << endl;
+        exit(1);
+    }
+
+    string temporary = filename + ".tmp";
+    ofstream out(temporary.c_str());
+    out << "options\t" << options << endl
+        << "target\t" << target << endl
+        << "position\t" << position << endl
+        << "output\t" << outputOffset << endl
+        << "failed\t" << failedOffset << endl;
+    out.close();
+    if (!out || rename(temporary.c_str(), filename.c_str()) != 0) {
+        cerr << "could not write checkpoint " << filename << endl;
+        exit(1);
+    }
+
+    lastSaved = time(NULL);
+
+}
+
+void Checkpoint::remove(void) {
+    unlink(filename.c_str());
+}
+
+void Checkpoint::lock(void) {
+    pthread_mutex_lock(&mutex);
+}
+
+void Checkpoint::unlock(void) {
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,71 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <pthread.h>
+#include <time.h>
+
+using namespace std;
+
+// the minimum number of seconds between checkpoints
+#define CHECKPOINT_INTERVAL 60
+
+// records how far a run has got, so that it can be resumed if it is killed
+//
+// a checkpoint holds the last position up to which every site has been
+// written, and the sizes of the output files at that point.  it is replaced
+// atomically, so a crash leaves either the old or the new checkpoint.
+// a run with the same command line which finds the checkpoint truncates its
+// output files to those sizes and continues from the next position.
+class Checkpoint {
+
+public:
+
+    Checkpoint(const string& f, const string& commandline);
+    ~Checkpoint(void);
+
+    // reads the checkpoint left by an earlier run with the same command
+    // line, returning true if we should resume from it
+    bool load(void);
+
+    bool resuming;
+    int target;             // the index of the target holding position
+    long int position;      // 0-based, inclusive
+    long int outputOffset;
+    long int failedOffset;
+
+    // the index, among the targets of the original run, of the first of the
+    // targets we are now processing
+    int firstTarget;
+
+    // the files whose progress we record, and their names; failed may be
+    // closed
+    ofstream* output;
+    ofstream* failed;
+    string outputName;
+    string failedName;
+
+    // records that every site up to and including position in target (an
+    // index into the targets we are processing) has been written, if it is
+    // time for a new checkpoint
+    void update(int t, long int p);
+
+    // removes the checkpoint, when the run is complete
+    void remove(void);
+
+    // serializes output and updates when they come from several threads
+    void lock(void);
+    void unlock(void);
+
+private:
+
+    string filename;
+    string options;
+    time_t lastSaved;
+    pthread_mutex_t mutex;
+
+};
+
+#endif
@@ -28,6 +28,7 @@ void Contamination::open(string& file) {
         ContaminationEstimate c;
         convert(fields[1], c.probRefGivenHet);
         convert(fields[2], c.probRefGivenHomAlt);
+        c.update();
         if (sample == "*") { // default
             defaultEstimate = c;
         } else {
@@ -64,7 +65,29 @@ double Contamination::refBias(string& sample) {
     }
 }
 
-ContaminationEstimate& Contamination::of(string& sample) {
+void ContaminationEstimate::update(void) {
+    refBias = probRefGivenHet * 2 - 1;
+    lnRefGivenHetScale = log(probRefGivenHet / 0.5);
+    lnAltGivenHetScale = log((1 - probRefGivenHet) / 0.5);
+    lnHomScale = log(1 - probRefGivenHomAlt);
+}
+
+void Contamination::resolveReadGroups(void) {
+    readGroupEstimates.clear();
+    for (int i = 0; i < readGroupSymbols.size(); ++i) {
+        readGroupEstimates.push_back(&of(readGroupSymbols.name(i)));
+    }
+}
+
+ContaminationEstimate& Contamination::of(int readGroupIndex) {
+    if (readGroupIndex < readGroupEstimates.size()) {
+        return *readGroupEstimates[readGroupIndex];
+    } else {
+        return of(readGroupSymbols.name(readGroupIndex));
+    }
+}
+
+ContaminationEstimate& Contamination::of(const string& sample) {
     Contamination::iterator s = find(sample);
     if (s != end()) {
         return s->second;
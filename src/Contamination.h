@@ -9,6 +9,7 @@
 #include <cstdlib>
 #include <cmath>
 #include "split.h"
+#include "SymbolTable.h"
 
 using namespace std;
 
@@ -17,11 +18,16 @@ public:
     double probRefGivenHet;
     double probRefGivenHomAlt;
     double refBias;
-ContaminationEstimate(void) : probRefGivenHet(0.5), probRefGivenHomAlt(0), refBias(0) { }
-ContaminationEstimate(double ra, double aa) : probRefGivenHet(ra), probRefGivenHomAlt(aa)
-    {
-        refBias = probRefGivenHet * 2 - 1;
-    }
+    // the logs of the factors by which the estimate scales the probability
+    // of sampling an observation of an allele in a heterozygote, if it is of
+    // the reference or not, and in a homozygote
+    double lnRefGivenHetScale;
+    double lnAltGivenHetScale;
+    double lnHomScale;
+ContaminationEstimate(void) : probRefGivenHet(0.5), probRefGivenHomAlt(0) { update(); }
+ContaminationEstimate(double ra, double aa) : probRefGivenHet(ra), probRefGivenHomAlt(aa) { update(); }
+    // recomputes the derived terms after the probabilities are set
+    void update(void);
 };
 
 class Contamination : public map<string, ContaminationEstimate> {
@@ -31,9 +37,16 @@ public:
     double probRefGivenHet(string& sample);
     double probRefGivenHomAlt(string& sample);
     double refBias(string& sample);
-    ContaminationEstimate& of(string& sample);
+    ContaminationEstimate& of(const string& sample);
+    // the estimate for the read group with the given id (see SymbolTable.h)
+    ContaminationEstimate& of(int readGroupIndex);
+    // resolves the estimate of each read group in readGroupSymbols, which
+    // must be done once they are all known, before calling begins
+    void resolveReadGroups(void);
 Contamination(void) : defaultEstimate(ContaminationEstimate(0.5, 0)) { }
 Contamination(double ra, double aa) : defaultEstimate(ContaminationEstimate(ra, aa)) { }
+private:
+    vector<ContaminationEstimate*> readGroupEstimates;  // by read group id
 };
 
 #endif
@@ -17,10 +17,22 @@
 #include "Dirichlet.h"
 #include "Bias.h"
 #include "Contamination.h"
+#include "ObservationBuffer.h"
 
 using namespace std;
 
-long double
+// the log likelihood of the observations of sample, as bucketed in
+// observations, given genotype
+Real
+probObservedAllelesGivenGenotype(
+        ObservationBuffer& observations,
+        Sample& sample,
+        Genotype& genotype,
+        double dependenceFactor,
+        Bias& observationBias,
+        bool standardGLs);
+
+Real
 probObservedAllelesGivenGenotype(
         Sample& sample,
         Genotype& genotype,
@@ -32,7 +44,18 @@ probObservedAllelesGivenGenotype(
         Contamination& contaminations,
         map<string, double>& freqs);
 
-vector<pair<Genotype*, long double> >
+// the log likelihoods of the observations of sample, as bucketed in
+// observations, given each of genotypes
+vector<pair<Genotype*, Real> >
+probObservedAllelesGivenGenotypes(
+        ObservationBuffer& observations,
+        Sample& sample,
+        vector<Genotype*>& genotypes,
+        double dependenceFactor,
+        Bias& observationBias,
+        bool standardGLs);
+
+vector<pair<Genotype*, Real> >
 probObservedAllelesGivenGenotypes(
         Sample& sample,
         vector<Genotype*>& genotypes,
@@ -4,17 +4,17 @@
 #include <iostream>
 
 
-long double dirichlet(const vector<long double>& probs, 
+Real dirichlet(const vector<Real>& probs, 
         const vector<int>& obs, 
-        long double s) {
+        Real s) {
 
-    vector<long double> alphas;
+    vector<Real> alphas;
     for (vector<int>::const_iterator o = obs.begin(); o != obs.end(); ++o)
         alphas.push_back(*o + 1 * s);
 
-    vector<long double> obsProbs;
-    vector<long double>::const_iterator a = alphas.begin();
-    vector<long double>::const_iterator p = probs.begin();
+    vector<Real> obsProbs;
+    vector<Real>::const_iterator a = alphas.begin();
+    vector<Real>::const_iterator p = probs.begin();
     for (; p != probs.end() && a != alphas.end(); ++p, ++a) {
         obsProbs.push_back(pow(*p, *a - 1));
     }
@@ -23,10 +23,10 @@ long double dirichlet(const vector<long double>& probs,
 
 }
 
-long double dirichletMaximumLikelihoodRatio(const vector<long double>& probs,
+Real dirichletMaximumLikelihoodRatio(const vector<Real>& probs,
         const vector<int>& obs, 
-        long double s) {
-    long double maximizingObs = obs.size() / sum(obs);
+        Real s) {
+    Real maximizingObs = obs.size() / sum(obs);
     vector<int> m(obs.size(), maximizingObs);
     return dirichlet(probs, obs, s) / dirichlet(probs, m, s);
 }
@@ -34,17 +34,17 @@ long double dirichletMaximumLikelihoodRatio(const vector<long double>& probs,
 
 // XXX the logspace versions are broken
 
-long double dirichletln(const vector<long double>& probs, 
+Real dirichletln(const vector<Real>& probs, 
         const vector<int>& obs, 
-        long double s) {
+        Real s) {
 
-    vector<long double> alphas;
+    vector<Real> alphas;
     for (vector<int>::const_iterator o = obs.begin(); o != obs.end(); ++o)
         alphas.push_back(*o + 1 * s);
 
-    vector<long double> obsProbs;
-    vector<long double>::const_iterator a = alphas.begin();
-    vector<long double>::const_iterator p = probs.begin();
+    vector<Real> obsProbs;
+    vector<Real>::const_iterator a = alphas.begin();
+    vector<Real>::const_iterator p = probs.begin();
     for (; p != probs.end() && a != alphas.end(); ++p, ++a) {
         obsProbs.push_back(powln(log(*p), *a - 1));
     }
@@ -53,10 +53,10 @@ long double dirichletln(const vector<long double>& probs,
 
 }
 
-long double dirichletMaximumLikelihoodRatioln(const vector<long double>& probs,
+Real dirichletMaximumLikelihoodRatioln(const vector<Real>& probs,
         const vector<int>& obs, 
-        long double s) {
-    long double maximizingObs = (long double) obs.size() / (long double) sum(obs);
+        Real s) {
+    Real maximizingObs = (Real) obs.size() / (Real) sum(obs);
     vector<int> m(obs.size(), maximizingObs);
     return dirichletln(probs, obs, s) - dirichletln(probs, m, s);
 }
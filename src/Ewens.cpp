@@ -1,10 +1,11 @@
 #include "Ewens.h"
+#include <pthread.h>
 
 
-long double alleleFrequencyProbability(const map<int, int>& alleleFrequencyCounts, long double theta) {
+Real alleleFrequencyProbability(const map<int, int>& alleleFrequencyCounts, Real theta) {
 
     int M = 0;
-    long double p = 1;
+    Real p = 1;
 
     for (map<int, int>::const_iterator f = alleleFrequencyCounts.begin(); f != alleleFrequencyCounts.end(); ++f) {
         int frequency = f->first;
@@ -13,7 +14,7 @@ long double alleleFrequencyProbability(const map<int, int>& alleleFrequencyCount
         p *= (double) pow((double) theta, (double) count) / ((double) pow((double) frequency, (double) count) * factorial(count));
     }
 
-    long double thetaH = 1;
+    Real thetaH = 1;
     for (int h = 1; h < M; ++h)
         thetaH *= theta + h;
 
@@ -21,19 +22,36 @@ long double alleleFrequencyProbability(const map<int, int>& alleleFrequencyCount
 
 }
 
-AlleleFrequencyProbabilityCache alleleFrequencyProbabilityCache;
+// the cache is filled as it is used, so each thread keeps its own, freed
+// by the key's destructor when the thread exits
+__thread AlleleFrequencyProbabilityCache* alleleFrequencyProbabilityCache = NULL;
+static pthread_key_t alleleFrequencyProbabilityCacheKey;
+static pthread_once_t alleleFrequencyProbabilityCacheKeyOnce = PTHREAD_ONCE_INIT;
 
-long double alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, long double theta) {
-    return alleleFrequencyProbabilityCache.alleleFrequencyProbabilityln(alleleFrequencyCounts, theta);
+static void deleteAlleleFrequencyProbabilityCache(void* cache) {
+    delete (AlleleFrequencyProbabilityCache*) cache;
+}
+
+static void makeAlleleFrequencyProbabilityCacheKey(void) {
+    pthread_key_create(&alleleFrequencyProbabilityCacheKey, deleteAlleleFrequencyProbabilityCache);
+}
+
+Real alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, Real theta) {
+    if (!alleleFrequencyProbabilityCache) {
+        alleleFrequencyProbabilityCache = new AlleleFrequencyProbabilityCache;
+        pthread_once(&alleleFrequencyProbabilityCacheKeyOnce, makeAlleleFrequencyProbabilityCacheKey);
+        pthread_setspecific(alleleFrequencyProbabilityCacheKey, alleleFrequencyProbabilityCache);
+    }
+    return alleleFrequencyProbabilityCache->alleleFrequencyProbabilityln(alleleFrequencyCounts, theta);
 }
 
 // Implements Ewens' Sampling Formula, which provides probability of a given
 // partition of alleles in a sample from a population
-long double __alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, long double theta) {
+Real __alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, Real theta) {
 
     int M = 0; // multiplicity of site
-    long double p = 0;
-    long double thetaln = log(theta);
+    Real p = 0;
+    Real thetaln = log(theta);
 
     for (map<int, int>::const_iterator f = alleleFrequencyCounts.begin(); f != alleleFrequencyCounts.end(); ++f) {
         int frequency = f->first;
@@ -42,7 +60,7 @@ long double __alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyC
         p += powln(thetaln, count) - (powln(log(frequency), count) + factorialln(count));
     }
 
-    long double thetaH = 0;
+    Real thetaH = 0;
     for (int h = 1; h < M; ++h)
         thetaH += log(theta + h);
 
@@ -65,6 +65,15 @@ int Genotype::alleleCount(Allele& allele) {
     }
 }
 
+int Genotype::alleleCount(int alleleIndex) {
+    for (Genotype::iterator g = begin(); g != end(); ++g) {
+        if (g->alleleIndex == alleleIndex) {
+            return g->count;
+        }
+    }
+    return 0;
+}
+
 // returns true when the genotype is composed of a subset of the alleles
 bool Genotype::matchesAlleles(vector<Allele>& alleles) {
     int p = 0;
@@ -233,24 +242,24 @@ bool Genotype::isHomozygousReference(void) {
 }
 
 // the probability of drawing each allele out of the genotype, ordered by allele
-vector<long double> Genotype::alleleProbabilities(void) {
-    vector<long double> probs;
+vector<Real> Genotype::alleleProbabilities(void) {
+    vector<Real> probs;
     for (vector<GenotypeElement>::const_iterator a = this->begin(); a != this->end(); ++a) {
-        probs.push_back((long double) a->count / (long double) ploidy);
+        probs.push_back((Real) a->count / (Real) ploidy);
     }
     return probs;
 }
 
 // the probability of drawing each allele out of the genotype, ordered by allele, adjusted for reference bias
-vector<long double> Genotype::alleleProbabilities(Bias& observationBias) {
-    vector<long double> probs;
+vector<Real> Genotype::alleleProbabilities(Bias& observationBias) {
+    vector<Real> probs;
     for (vector<GenotypeElement>::const_iterator a = this->begin(); a != this->end(); ++a) {
-	long double bias = 1;
+	Real bias = 1;
 	if (!a->allele.isReference()) {
 	    int alleleLengthDifference = a->allele.alternateSequence.size() - a->allele.referenceLength;
 	    bias = observationBias.bias(alleleLengthDifference);
 	}
-        probs.push_back(((long double) a->count / (long double) ploidy) * bias);
+        probs.push_back(((Real) a->count / (Real) ploidy) * bias);
     }
     normalizeSumToOne(probs);
     return probs;
@@ -361,10 +370,45 @@ vector<Genotype> allPossibleGenotypes(int ploidy, vector<Allele>& potentialAllel
 }
 
 
+void AlleleCounter::addObservations(const Sample& sample, const string& base, int sign) {
+    map<string, vector<ObservationBin> >::const_iterator g = sample.bins.find(base);
+    if (g == sample.bins.end()) {
+        return;
+    }
+    const vector<ObservationBin>& bins = g->second;
+    for (vector<ObservationBin>::const_iterator b = bins.begin(); b != bins.end(); ++b) {
+        int count = sign * b->count;
+        observations += count;
+        if (b->strand == STRAND_FORWARD) {
+            forwardStrand += count;
+        } else {
+            reverseStrand += count;
+        }
+        if (b->placedLeft) {
+            placedLeft += count;
+        } else {
+            placedRight += count;
+        }
+        if (b->placedStart()) {
+            placedStart += count;
+        } else {
+            placedEnd += count;
+        }
+    }
+}
+
+vector<AlleleCounter> sampleObservationCounters(const Sample& sample, vector<Allele>& genotypeAlleles) {
+    vector<AlleleCounter> counters(genotypeAlleles.size());
+    for (int i = 0; i < genotypeAlleles.size(); ++i) {
+        counters[i].addObservations(sample, genotypeAlleles[i].currentBase);
+    }
+    return counters;
+}
+
 int GenotypeCombo::numberOfAlleles(void) {
     int count = 0;
-    for (map<string, AlleleCounter>::iterator f = alleleCounters.begin(); f != alleleCounters.end(); ++f) {
-        const AlleleCounter& allele = f->second;
+    for (vector<AlleleCounter>::iterator f = alleleCounters.begin(); f != alleleCounters.end(); ++f) {
+        const AlleleCounter& allele = *f;
         count += allele.frequency;
     }
     return count;
@@ -374,245 +418,254 @@ int GenotypeCombo::numberOfAlleles(void) {
 void GenotypeCombo::init(bool useObsExpectations) {
     for (GenotypeCombo::iterator s = begin(); s != end(); ++s) {
         const SampleDataLikelihood& sdl = **s;
-        const Sample& sample = *sdl.sample;
 
-        ++genotypeCounts[sdl.genotype];
+        ++genotypeCount(sdl.genotype);
 
         permutationsln += sdl.genotype->permutationsln;
 
         for (Genotype::iterator a = sdl.genotype->begin(); a != sdl.genotype->end(); ++a) {
-            const string& alleleBase = a->allele.currentBase;
-
             // allele frequencies in selected genotypes in combo
-            AlleleCounter& alleleCounter = alleleCounters[alleleBase];
+            AlleleCounter& alleleCounter = this->alleleCounter(a->alleleIndex);
             alleleCounter.frequency += a->count;
 
             if (useObsExpectations) {
                 // observational frequencies for binomial priors
-                Sample::const_iterator as = sample.find(alleleBase);
-                if (as != sample.end()) {
-                    vector<Allele*> alleles = as->second;
-                    alleleCounter.observations += alleles.size();
-                    for (vector<Allele*>::iterator o = alleles.begin(); o != alleles.end(); ++o) {
-                        const Allele& allele = **o;
-                        if (allele.basesLeft >= allele.basesRight) {
-                            ++alleleCounter.placedLeft;
-                            if (allele.strand == STRAND_FORWARD) {
-                                ++alleleCounter.placedStart;
-                            } else {
-                                ++alleleCounter.placedEnd;
-                            }
-                        } else {
-                            ++alleleCounter.placedRight;
-                            if (allele.strand == STRAND_FORWARD) {
-                                ++alleleCounter.placedEnd;
-                            } else {
-                                ++alleleCounter.placedStart;
-                            }
-                        }
-                        if (allele.strand == STRAND_FORWARD) {
-                            ++alleleCounter.forwardStrand;
-                        } else {
-                            ++alleleCounter.reverseStrand;
-                        }
-                    }
-                }
+                alleleCounter.addObservations(sdl.observationCounters->at(a->alleleIndex));
             }
         }
     }
+
+    resetPriorTerms();
 }
 
 void GenotypeCombo::addPriorAlleleCounts(map<string, int>& priorACs) {
     for (map<string, int>::iterator p = priorACs.begin(); p != priorACs.end(); ++p) {
         const string& alleleBase = p->first;
         int count = p->second;
-        AlleleCounter& alleleCounter = alleleCounters[alleleBase];
+        // alleles are only counted while they have a frequency, and can only
+        // be counted if one of the genotypes of the combo gives their index
+        int index = alleleIndex(alleleBase);
+        if (count == 0 || index < 0) {
+            continue;
+        }
+        AlleleCounter& alleleCounter = this->alleleCounter(index);
         //cerr <<"init "<< alleleCounter.frequency;
         alleleCounter.frequency += count;
     }
+    resetPriorTerms();
 }
 
 // frequency... should this just be "allele count"?
 int GenotypeCombo::alleleCount(Allele& allele) {
-    map<string, AlleleCounter>::iterator f = alleleCounters.find(allele.currentBase);
-    if (f == alleleCounters.end()) {
-        return 0;
-    } else {
-        return f->second.frequency;
-    }
+    return alleleCount(allele.currentBase);
 }
 
 int GenotypeCombo::alleleCount(const string& allele) {
-    map<string, AlleleCounter>::iterator f = alleleCounters.find(allele);
-    if (f == alleleCounters.end()) {
+    int index = alleleIndex(allele);
+    if (index < 0 || index >= alleleCounters.size()) {
         return 0;
     } else {
-        return f->second.frequency;
+        return alleleCounters[index].frequency;
     }
 }
 
-long double GenotypeCombo::alleleFrequency(Allele& allele) {
-    return alleleCount(allele) / (long double) numberOfAlleles();
+Real GenotypeCombo::alleleFrequency(Allele& allele) {
+    return alleleCount(allele) / (Real) numberOfAlleles();
 }
 
-long double GenotypeCombo::alleleFrequency(const string& allele) {
-    return alleleCount(allele) / (long double) numberOfAlleles();
+Real GenotypeCombo::alleleFrequency(const string& allele) {
+    return alleleCount(allele) / (Real) numberOfAlleles();
 }
 
-long double GenotypeCombo::genotypeFrequency(Genotype* genotype) {
-    map<Genotype*, int>::iterator g = genotypeCounts.find(genotype);
-    if (g == genotypeCounts.end()) {
+Real GenotypeCombo::genotypeFrequency(Genotype* genotype) {
+    if (genotype->index >= genotypeCounts.size()) {
         return 0;
     } else {
-        return g->second / size();
+        return genotypeCounts[genotype->index] / size();
+    }
+}
+
+int GenotypeCombo::alleleIndex(const string& base) {
+    for (GenotypeCombo::iterator s = begin(); s != end(); ++s) {
+        Genotype& genotype = *(*s)->genotype;
+        for (Genotype::iterator g = genotype.begin(); g != genotype.end(); ++g) {
+            if (g->allele.currentBase == base) {
+                return g->alleleIndex;
+            }
+        }
+    }
+    return -1;
+}
+
+vector<Genotype*> GenotypeCombo::genotypes(void) {
+    vector<Genotype*> distinct;
+    vector<bool> seen(genotypeCounts.size(), false);
+    for (GenotypeCombo::iterator s = begin(); s != end(); ++s) {
+        Genotype* genotype = (*s)->genotype;
+        if (!seen[genotype->index]) {
+            seen[genotype->index] = true;
+            distinct.push_back(genotype);
+        }
     }
+    return distinct;
 }
 
 void GenotypeCombo::updateCachedCounts(
-        Sample* sample,
+        const vector<AlleleCounter>& observationCounters,
         Genotype* oldGenotype,
         Genotype* newGenotype,
         bool useObsExpectations) {
 
     // update genotype counts
-    --genotypeCounts[oldGenotype];
-    ++genotypeCounts[newGenotype];
+    int& oldGenotypeCount = genotypeCounts[oldGenotype->index];
+    assert(oldGenotypeCount > 0);
+    adjustGenotypeTerms(oldGenotype, oldGenotypeCount, oldGenotypeCount - 1);
+    --oldGenotypeCount;
+    int& newGenotypeCount = genotypeCount(newGenotype);
+    adjustGenotypeTerms(newGenotype, newGenotypeCount, newGenotypeCount + 1);
+    ++newGenotypeCount;
 
     // update permutations
     permutationsln -= oldGenotype->permutationsln;
     permutationsln += newGenotype->permutationsln;
 
-    // remove allele frequencies which are now 0 or below
-    map<Genotype*, int>::iterator gc = genotypeCounts.begin();
-    while (gc != genotypeCounts.end()) {
-        assert(gc->second >= 0);
-        if (gc->second == 0) {
-            genotypeCounts.erase(gc++);
-        } else {
-            ++gc;
-        }
-    }
+    // only the alleles of the two genotypes change, and only their part of
+    // the prior terms is taken out and put back
 
-    // TODO can we improve efficiency by only adjusting for bases which are actually changed
-
-    // remove allele frequency information for old genotype
+    // move the frequency of alleles in the old genotype to the new one
     for (Genotype::iterator g = oldGenotype->begin(); g != oldGenotype->end(); ++g) {
         GenotypeElement& ge = *g;
-        const string& base = ge.allele.currentBase;
-        AlleleCounter& alleleCounter = alleleCounters[base];
-        alleleCounter.frequency -= ge.count;
-        if (useObsExpectations) {
-            Sample::iterator s = sample->find(base);
-            if (s != sample->end()) {
-                const vector<Allele*>& alleles = s->second;
-                alleleCounter.observations -= alleles.size();
-                int forward_strand = 0;
-                int reverse_strand = 0;
-                int placed_left = 0;
-                int placed_right = 0;
-                int placed_start = 0;
-                int placed_end = 0;
-                for (vector<Allele*>::const_iterator a = alleles.begin(); a != alleles.end(); ++a) {
-                    const Allele& allele = **a;
-                    if (allele.strand == STRAND_FORWARD) {
-                        ++forward_strand;
-                    } else {
-                        ++reverse_strand;
-                    }
-                    if (allele.basesLeft >= allele.basesRight) {
-                        ++placed_left;
-                        if (allele.strand == STRAND_FORWARD) {
-                            ++placed_start;
-                        } else {
-                            ++placed_end;
-                        }
-                    } else {
-                        ++placed_right;
-                        if (allele.strand == STRAND_FORWARD) {
-                            ++placed_end;
-                        } else {
-                            ++placed_start;
-                        }
-                    }
-                }
-                alleleCounter.forwardStrand -= forward_strand;
-                alleleCounter.reverseStrand -= reverse_strand;
-                alleleCounter.placedLeft -= placed_left;
-                alleleCounter.placedRight -= placed_right;
-                alleleCounter.placedStart -= placed_start;
-                alleleCounter.placedEnd -= placed_end;
-            }
+        int newCount = newGenotype->alleleCount(ge.alleleIndex);
+        AlleleCounter& alleleCounter = alleleCounters[ge.alleleIndex];
+        adjustAlleleTerms(alleleCounter, -1);
+        alleleCounter.frequency += newCount - ge.count;
+        // the sample's observations of an allele in both genotypes stay counted
+        if (useObsExpectations && newCount == 0) {
+            alleleCounter.addObservations(observationCounters[ge.alleleIndex], -1);
+        }
+        assert(alleleCounter.frequency >= 0);
+        if (alleleCounter.frequency > 0) {
+            adjustAlleleTerms(alleleCounter, 1);
+        } else {
+            assert(alleleCounter.observations == 0);
         }
     }
 
-    // add allele frequency information for new genotype
+    // add allele frequency information for alleles only in the new genotype
     for (Genotype::iterator g = newGenotype->begin(); g != newGenotype->end(); ++g) {
         GenotypeElement& ge = *g;
-        const string& base = ge.allele.currentBase;
-        AlleleCounter& alleleCounter = alleleCounters[base];
+        if (oldGenotype->alleleCount(ge.alleleIndex) > 0) {
+            continue;
+        }
+        AlleleCounter& alleleCounter = this->alleleCounter(ge.alleleIndex);
+        if (alleleCounter.frequency > 0) {
+            adjustAlleleTerms(alleleCounter, -1);
+        }
         alleleCounter.frequency += ge.count;
         if (useObsExpectations) {
-            Sample::iterator s = sample->find(base);
-            if (s != sample->end()) {
-                const vector<Allele*>& alleles = s->second;
-                alleleCounter.observations += alleles.size();
-                int forward_strand = 0;
-                int reverse_strand = 0;
-                int placed_left = 0;
-                int placed_right = 0;
-                int placed_start = 0;
-                int placed_end = 0;
-                for (vector<Allele*>::const_iterator a = alleles.begin(); a != alleles.end(); ++a) {
-                    const Allele& allele = **a;
-                    if (allele.strand == STRAND_FORWARD) {
-                        ++forward_strand;
-                    } else {
-                        ++reverse_strand;
-                    }
-                    if (allele.basesLeft >= allele.basesRight) {
-                        ++placed_left;
-                        if (allele.strand == STRAND_FORWARD) {
-                            ++placed_start;
-                        } else {
-                            ++placed_end;
-                        }
-                    } else {
-                        ++placed_right;
-                        if (allele.strand == STRAND_FORWARD) {
-                            ++placed_end;
-                        } else {
-                            ++placed_start;
-                        }
-                    }
-                }
-                alleleCounter.forwardStrand += forward_strand;
-                alleleCounter.reverseStrand += reverse_strand;
-                alleleCounter.placedLeft += placed_left;
-                alleleCounter.placedRight += placed_right;
-                alleleCounter.placedStart += placed_start;
-                alleleCounter.placedEnd += placed_end;
-            }
+            alleleCounter.addObservations(observationCounters[ge.alleleIndex]);
         }
+        adjustAlleleTerms(alleleCounter, 1);
     }
 
-    // remove allele frequencies which are now 0 or below
-    map<string, AlleleCounter>::iterator af = alleleCounters.begin();
-    while (af != alleleCounters.end()) {
-        assert(af->second.frequency >= 0);
-        if (af->second.frequency == 0) {
-            assert(af->second.observations == 0);
-            alleleCounters.erase(af++);
-        } else {
-            ++af;
+}
+
+void GenotypeCombo::adjustAlleleTerms(const AlleleCounter& alleleCounter, int sign) {
+
+    int frequency = alleleCounter.frequency;
+    int obs = alleleCounter.observations;
+    Real frequencyln = log((Real) frequency);
+
+    priorTerms.alleles += sign;
+    priorTerms.alleleCopies += sign * frequency;
+    priorTerms.alleleCountsln += sign * factorialln(frequency);
+    priorTerms.alleleFrequenciesln += sign * frequencyln;
+
+    // one more or one fewer allele at this frequency changes the factorial
+    // of their count by the log of the larger count
+    int& count = frequencyCount(frequency);
+    if (sign > 0) {
+        priorTerms.frequencyCountsln += log((Real) ++count);
+    } else {
+        assert(count > 0);
+        priorTerms.frequencyCountsln -= log((Real) count--);
+    }
+
+    priorTerms.observations += sign * obs;
+    priorTerms.observationCountsln += sign * factorialln(obs);
+    priorTerms.observationFrequenciesln += sign * powln(frequencyln, obs);
+
+    if (obs > 0) {
+        priorTerms.binomialObsln += sign *
+            ( binomialProbln(alleleCounter.forwardStrand, obs, 0.5)
+            + binomialProbln(alleleCounter.placedLeft, obs, 0.5)
+            + binomialProbln(alleleCounter.placedStart, obs, 0.5));
+    }
+
+}
+
+void GenotypeCombo::adjustGenotypeTerms(Genotype* genotype, int oldCount, int newCount) {
+
+    PloidyGenotypeCounter& counter = ploidyGenotypeCounter(genotype->ploidy);
+    counter.samples += newCount - oldCount;
+    counter.countsln += factorialln(newCount) - factorialln(oldCount);
+    if (oldCount == 0) {
+        ++counter.genotypes;
+        priorTerms.genotypePermutationsln += genotype->permutationsln;
+    } else if (newCount == 0) {
+        --counter.genotypes;
+        priorTerms.genotypePermutationsln -= genotype->permutationsln;
+    }
+
+}
+
+void GenotypeCombo::resetPriorTerms(void) {
+
+    priorTerms = ComboPriorTerms();
+    frequencyCounts.clear();
+    ploidyGenotypeCounters.clear();
+
+    for (vector<AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        if (a->frequency > 0) {
+            adjustAlleleTerms(*a, 1);
         }
     }
 
+    vector<Genotype*> distinct = genotypes();
+    for (vector<Genotype*>::iterator g = distinct.begin(); g != distinct.end(); ++g) {
+        adjustGenotypeTerms(*g, 0, genotypeCounts[(*g)->index]);
+    }
+
+}
+
+void GenotypeCombo::replaceSampleDataLikelihood(
+        size_t offset,
+        SampleDataLikelihood* sdl,
+        bool useObsExpectations) {
+
+    SampleDataLikelihood* oldsdl = at(offset);
+    // get the old and new genotypes, which we compare
+    // to change the cached counts and probability of
+    // the combo
+    updateCachedCounts(*oldsdl->observationCounters,
+            oldsdl->genotype, sdl->genotype,
+            useObsExpectations);
+    // replace genotype with new genotype
+    at(offset) = sdl;
+    // find data likelihood difference
+    Real diff = oldsdl->prob - sdl->prob;
+    // adjust combination total data likelihood
+    probObsGivenGenotypes -= diff;
+
 }
 
 map<int, int> GenotypeCombo::countFrequencies(void) {
     map<int, int> frequencyCounts;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
-        const AlleleCounter& allele = a->second;
+    for (vector<AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        const AlleleCounter& allele = *a;
+        if (allele.frequency == 0) {
+            continue;
+        }
         map<int, int>::iterator c = frequencyCounts.find(allele.frequency);
         if (c != frequencyCounts.end()) {
             c->second += 1;
@@ -626,8 +679,11 @@ map<int, int> GenotypeCombo::countFrequencies(void) {
 vector<int> GenotypeCombo::counts(void) {
     //map<string, int> alleleCounters = countAlleles();
     vector<int> counts;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
-        const AlleleCounter& allele = a->second;
+    for (vector<AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        const AlleleCounter& allele = *a;
+        if (allele.frequency == 0) {
+            continue;
+        }
         counts.push_back(allele.frequency);
     }
     return counts;
@@ -645,8 +701,11 @@ int GenotypeCombo::hetCount(void) {
 
 vector<int> GenotypeCombo::observationCounts(void) {
     vector<int> counts;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
-        const AlleleCounter& allele = a->second;
+    for (vector<AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        const AlleleCounter& allele = *a;
+        if (allele.frequency == 0) {
+            continue;
+        }
         counts.push_back(allele.observations);
     }
     return counts;
@@ -654,8 +713,11 @@ vector<int> GenotypeCombo::observationCounts(void) {
 
 int GenotypeCombo::observationTotal(void) {
     int total = 0;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
-        const AlleleCounter& allele = a->second;
+    for (vector<AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        const AlleleCounter& allele = *a;
+        if (allele.frequency == 0) {
+            continue;
+        }
         total += allele.observations;
     }
     return total;
@@ -664,34 +726,50 @@ int GenotypeCombo::observationTotal(void) {
 // how many copies of the locus are in the whole genotype combination?
 int GenotypeCombo::ploidy(void) {
     int copies = 0;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
-        const AlleleCounter& allele = a->second;
+    for (vector<AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        const AlleleCounter& allele = *a;
+        if (allele.frequency == 0) {
+            continue;
+        }
         copies += allele.frequency;
     }
     return copies;
 }
 
-vector<long double> GenotypeCombo::alleleProbs(void) {
-    vector<long double> probs;
-    long double copies = ploidy();
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
-        const AlleleCounter& allele = a->second;
+vector<Real> GenotypeCombo::alleleProbs(void) {
+    vector<Real> probs;
+    Real copies = ploidy();
+    for (vector<AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        const AlleleCounter& allele = *a;
+        if (allele.frequency == 0) {
+            continue;
+        }
         probs.push_back(allele.frequency / copies);
     }
     return probs;
 }
 
+// in order of their index
 vector<string> GenotypeCombo::alleles(void) {
+    vector<string> basesByIndex(alleleCounters.size());
+    for (GenotypeCombo::iterator s = begin(); s != end(); ++s) {
+        Genotype& genotype = *(*s)->genotype;
+        for (Genotype::iterator g = genotype.begin(); g != genotype.end(); ++g) {
+            basesByIndex[g->alleleIndex] = g->allele.currentBase;
+        }
+    }
     vector<string> bases;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
-        bases.push_back(a->first);
+    for (int i = 0; i < alleleCounters.size(); ++i) {
+        if (alleleCounters[i].frequency > 0) {
+            bases.push_back(basesByIndex[i]);
+        }
     }
     return bases;
 }
 
 // returns true if the combination is 100% homozygous
 bool GenotypeCombo::isHomozygous(void) {
-    return alleleCounters.size() == 1;
+    return priorTerms.alleles == 1;
 }
 
 void sortSampleDataLikelihoods(vector<SampleDataLikelihood>& likelihoods) {
@@ -777,14 +855,14 @@ void
 dataLikelihoodMaxGenotypeCombo(
     GenotypeCombo& combo,
     SampleDataLikelihoods& sampleDataLikelihoods,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar) {
+    Real diffusionPriorScalar) {
 
     for (SampleDataLikelihoods::iterator s = sampleDataLikelihoods.begin();
             s != sampleDataLikelihoods.end(); ++s) {
@@ -812,14 +890,14 @@ makeComboByDatalLikelihoodRank(
     SampleDataLikelihoods& variantSampleDataLikelihoods,
     SampleDataLikelihoods& invariantSampleDataLikelihoods,
     map<string, int>& priorACs,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar) {
+    Real diffusionPriorScalar) {
 
     // generate the best genotype combination according to data
     // likelihoods
@@ -855,23 +933,119 @@ makeComboByDatalLikelihoodRank(
 
 }
 
+void GenotypeComboResults::clear(void) {
+    combos.clear();
+    totalled = 0;
+    posteriorNormalizer = 0;
+    rawMarginals.clear();
+}
+
+bool GenotypeComboResults::keeps(Real posteriorProb) {
+    if (combos.size() < capacity) {
+        return true;
+    }
+    list<GenotypeCombo>::iterator worst = combos.begin();
+    advance(worst, capacity - 1);
+    // ties are broken by insert()
+    return posteriorProb >= worst->posteriorProb;
+}
+
+bool GenotypeComboResults::insert(GenotypeCombo& combo) {
+
+    // the searches only score a combo twice when it is the one they start
+    // from or homozygous, both of which we keep
+    for (list<GenotypeCombo>::iterator c = combos.begin(); c != combos.end(); ++c) {
+        if (*c == combo) {
+            return false;
+        }
+    }
+
+    bool homozygous = combo.isHomozygous();
+    if (!homozygous && !keeps(combo.posteriorProb)) {
+        return true;
+    }
+
+    GenotypeComboResultSorter gcrSorter;
+    list<GenotypeCombo>::iterator c = combos.begin();
+    size_t rank = 0;
+    while (c != combos.end() && !gcrSorter(combo, *c)) {
+        ++c; ++rank;
+    }
+    if (rank >= capacity && !homozygous) {
+        return true;
+    }
+    c = combos.insert(c, combo);
+
+    // drop the combo which this one has pushed out of the best, unless it
+    // is homozygous
+    for ( ; c != combos.end(); ++c, ++rank) {
+        if (rank >= capacity && !c->isHomozygous()) {
+            combos.erase(c);
+            break;
+        }
+    }
+
+    return true;
+
+}
+
+void GenotypeComboResults::total(GenotypeCombo& combo) {
+    totalPosterior(combo.posteriorProb);
+    size_t offset = 0;
+    for (GenotypeCombo::iterator s = combo.begin(); s != combo.end(); ++s, ++offset) {
+        totalMarginal(offset, (*s)->genotype, combo.posteriorProb);
+    }
+}
+
+void GenotypeComboResults::total(GenotypeCombo& combo, size_t offset, SampleDataLikelihood* sdl, Real posteriorProb) {
+    totalPosterior(posteriorProb);
+    size_t i = 0;
+    for (GenotypeCombo::iterator s = combo.begin(); s != combo.end(); ++s, ++i) {
+        totalMarginal(i, (i == offset) ? sdl->genotype : (*s)->genotype, posteriorProb);
+    }
+}
+
+void GenotypeComboResults::totalPosterior(Real posteriorProb) {
+    if (totalled++ == 0) {
+        posteriorNormalizer = posteriorProb;
+    } else {
+        // log-sum-exp of the pair
+        Real maxln = max(posteriorNormalizer, posteriorProb);
+        Real minln = min(posteriorNormalizer, posteriorProb);
+        posteriorNormalizer = maxln + log1p(exp(minln - maxln));
+    }
+}
+
+void GenotypeComboResults::totalMarginal(size_t offset, Genotype* genotype, Real posteriorProb) {
+    if (offset >= rawMarginals.size()) {
+        rawMarginals.resize(offset + 1);
+    }
+    map<Genotype*, Real>& rmgs = rawMarginals[offset];
+    map<Genotype*, Real>::iterator rmgsItr = rmgs.find(genotype);
+    if (rmgsItr == rmgs.end()) {
+        rmgs[genotype] = posteriorProb;
+    } else {
+        rmgsItr->second = log(safe_exp(rmgsItr->second) + safe_exp(posteriorProb));
+    }
+}
+
 // 'local' genotype combinations which step only in one sample away from the
 // data likelihood maxiumum.  deal with all genotypes.
 void
 allLocalGenotypeCombinations(
-    list<GenotypeCombo>& combos,
+    GenotypeComboResults& combos,
     GenotypeCombo& comboKing,
     SampleDataLikelihoods& sampleDataLikelihoods,
     Samples& samples,
     map<string, int>& priorACs,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar,
+    Real diffusionPriorScalar,
     bool keepCombos) {
 
     // make the data likelihood maximum if needed
@@ -896,9 +1070,21 @@ allLocalGenotypeCombinations(
 
     // ensure the comboKing is added
     if (combos.empty()) {
-        combos.push_back(comboKing);
+        if (keepCombos) {
+            combos.add(comboKing);
+        } else {
+            combos.combos.push_back(comboKing);
+        }
     }
 
+    // the neighbors are scored in place in the comboKing.  when we keep the
+    // combos, each is totalled, and copied out only if it will be kept.
+    // otherwise only the best, if it beats the best combo we have, is
+    // copied out.
+    Real bestPosteriorProb = combos.front().posteriorProb;
+    size_t bestOffset = 0;
+    SampleDataLikelihood* bestsdl = NULL;
+
     // for each sampledatalikelihood
     // add a combo for each genotype where the combo is one step from the comboKing
     size_t sampleOffset = 0;
@@ -913,65 +1099,79 @@ allLocalGenotypeCombinations(
             if (newsdl.genotype == oldsdl.genotype) {  // don't duplicate the comboKing
                 continue;
             }
-            combos.push_back(comboKing);
-            GenotypeCombo& combo = combos.back();
-            // get the old and new genotypes, which we compare
-            // to change the cached counts and probability of
-            // the combo
-            combo.updateCachedCounts(oldsdl.sample,
-                    oldsdl.genotype, newsdl.genotype,
-                    binomialObsPriors);
-            // replace genotype with new genotype
-            combo.at(sampleOffset) = &*dl;
-            // find data likelihood difference from ComboKing
-            long double diff = oldsdl.prob - newsdl.prob;
-            // adjust combination total data likelihood
-            combo.probObsGivenGenotypes -= diff;
-            combo.calculatePosteriorProbability(theta,
-                                            pooled,
-                                            ewensPriors,
-                                            permute,
-                                            hwePriors,
-                                            binomialObsPriors,
-                                            alleleBalancePriors,
-                                            diffusionPriorScalar);
-            // TODO
-            // memory-saving intervention, improve this
-            // difficult if we want to calculate marginals...
-            if (!keepCombos) {
-		// we should only have two combos in the list now...
-		if (combos.front().posteriorProb < combos.back().posteriorProb) {
-		    combos.pop_front();
-		} else {
-		    combos.pop_back();
-		}
+            Real posteriorProb = comboKing.neighborPosteriorProbability(
+                    sampleOffset, &newsdl,
+                    theta,
+                    pooled,
+                    ewensPriors,
+                    permute,
+                    hwePriors,
+                    binomialObsPriors,
+                    alleleBalancePriors,
+                    diffusionPriorScalar);
+            if (keepCombos) {
+                // neighbors differ from the king and each other, so they
+                // are never already kept
+                combos.total(comboKing, sampleOffset, &newsdl, posteriorProb);
+                if (combos.keeps(posteriorProb)
+                        || comboKing.isHomozygousNeighbor(sampleOffset, &newsdl)) {
+                    GenotypeCombo combo = comboKing;
+                    combo.replaceSampleDataLikelihood(sampleOffset, &newsdl, binomialObsPriors);
+                    combo.calculatePosteriorProbability(theta,
+                                                    pooled,
+                                                    ewensPriors,
+                                                    permute,
+                                                    hwePriors,
+                                                    binomialObsPriors,
+                                                    alleleBalancePriors,
+                                                    diffusionPriorScalar);
+                    combos.insert(combo);
+                }
+            } else {
+                if (bestPosteriorProb < posteriorProb) {
+                    bestPosteriorProb = posteriorProb;
+                    bestOffset = sampleOffset;
+                    bestsdl = &newsdl;
+                }
             }
         }
     }
 
-    GenotypeComboResultSorter gcrSorter;
-    combos.sort(gcrSorter);
-    combos.unique();
+    if (bestsdl) {
+        // the comboKing may be the combo we replace, so copy it first
+        combos.combos.push_back(comboKing);
+        GenotypeCombo& combo = combos.combos.back();
+        combo.replaceSampleDataLikelihood(bestOffset, bestsdl, binomialObsPriors);
+        combo.calculatePosteriorProbability(theta,
+                                        pooled,
+                                        ewensPriors,
+                                        permute,
+                                        hwePriors,
+                                        binomialObsPriors,
+                                        alleleBalancePriors,
+                                        diffusionPriorScalar);
+        combos.combos.pop_front();
+    }
 
 }
 
 bool
 bandedGenotypeCombinations(
-    list<GenotypeCombo>& combos,
+    GenotypeComboResults& combos,
     GenotypeCombo& comboKing,
     SampleDataLikelihoods& variantSampleDataLikelihoods,
     SampleDataLikelihoods& invariantSampleDataLikelihoods,
     Samples& samples,
     map<string, int>& priorACs,
     int bandwidth, int banddepth,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar,
+    Real diffusionPriorScalar,
     bool keepCombos) {
 
     // get the number of samples that vary
@@ -982,7 +1182,11 @@ bandedGenotypeCombinations(
 
     // no variant samples
     if (nsamples == 0) {
-        combos.push_back(comboKing);
+        if (keepCombos) {
+            combos.add(comboKing);
+        } else {
+            combos.combos.push_back(comboKing);
+        }
         return true;
     }
 
@@ -1044,8 +1248,7 @@ bandedGenotypeCombinations(
         }
         vector<vector<int> > indexPermutations = multipermute(indexes);
         for (vector<vector<int> >::const_iterator p = indexPermutations.begin(); p != indexPermutations.end(); ++p) {
-            combos.push_back(comboKing); // copy the king, and then we'll modify it according to the indicies
-            GenotypeCombo& combo = combos.back();
+            GenotypeCombo combo = comboKing; // copy the king, and then we'll modify it according to the indicies
             GenotypeCombo::iterator sampleGenotypeItr = combo.begin();
             vector<int>::const_iterator n = p->begin();
             for (SampleDataLikelihoods::iterator s = variantSampleDataLikelihoods.begin();
@@ -1061,13 +1264,13 @@ bandedGenotypeCombinations(
                     // get the old and new genotypes, which we compare
                     // to change the cached counts and probability of
                     // the combo
-                    combo.updateCachedCounts(oldsdl.sample,
+                    combo.updateCachedCounts(*oldsdl.observationCounters,
                             oldsdl.genotype, newsdl->genotype,
                             binomialObsPriors);
                     // replace genotype with new genotype
                     oldsdl_ptr = newsdl;
                     // find data likelihood difference from ComboKing
-                    long double diff = oldsdl.prob - newsdl->prob;
+                    Real diff = oldsdl.prob - newsdl->prob;
                     // adjust combination total data likelihood
                     combo.probObsGivenGenotypes -= diff;
                 }
@@ -1080,27 +1283,22 @@ bandedGenotypeCombinations(
                                             binomialObsPriors,
                                             alleleBalancePriors,
                                             diffusionPriorScalar);
-            if (!keepCombos && combos.size()  > 1) {
-                // we should only have two combos in the list now...
-                if (combos.front().posteriorProb < combos.back().posteriorProb) {
-                    combos.pop_front();
-                } else {
-                    combos.pop_back();
-                }
+            if (keepCombos) {
+                combos.add(combo);
+            } else if (combos.empty() || combos.front().posteriorProb < combo.posteriorProb) {
+                // we only need the best
+                combos.combos.clear();
+                combos.combos.push_back(combo);
             }
         }
     }
 
-    GenotypeComboResultSorter gcrSorter;
-    combos.sort(gcrSorter);
-    combos.unique();
-
     return true;
 }
 
 void
 convergentGenotypeComboSearch(
-    list<GenotypeCombo>& combos,
+    GenotypeComboResults& combos,
     GenotypeCombo& comboKing,
     SampleDataLikelihoods& sampleDataLikelihoods,
     SampleDataLikelihoods& variantSampleDataLikelihoods,
@@ -1109,14 +1307,14 @@ convergentGenotypeComboSearch(
     vector<Allele>& genotypeAlleles,
     map<string, int>& priorACs,
     int bandwidth, int banddepth,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar,
+    Real diffusionPriorScalar,
     int maxiterations,
     int& totaliterations,
     bool addHomozygousCombos) {
@@ -1195,51 +1393,62 @@ convergentGenotypeComboSearch(
         // row as our best
         if (combos.front().isHomozygous() || bestCombo == combos.front()) {
             // we've converged
-	    if (bandwidth == 0 && banddepth == 0) {
-		// XXX temporary hack
-		// get the rest of the combos in memory so we can do computation with them...
-		allLocalGenotypeCombinations(
-		    combos,
-		    combos.front(),
-		    sampleDataLikelihoods,
-		    samples,
-		    priorACs,
-		    theta,
-		    pooled,
-		    ewensPriors,
-		    permute,
-		    hwePriors,
-		    binomialObsPriors,
-		    alleleBalancePriors,
-		    diffusionPriorScalar,
-		    true); // keep combos
-	    } else {
-		bandedGenotypeCombinations(
-		    combos,
-		    bestCombo,
-		    variantSampleDataLikelihoods,
-		    invariantSampleDataLikelihoods,
-		    samples,
-		    priorACs,
-		    bandwidth,
-		    banddepth,
-		    theta,
-		    pooled,
-		    ewensPriors,
-		    permute,
-		    hwePriors,
-		    binomialObsPriors,
-		    alleleBalancePriors,
-		    diffusionPriorScalar,
-		    true); // keep combos
-	    }
-	    break;
+            // score the combos around the best again, this time totalling
+            // all of them and keeping the best
+            GenotypeCombo convergedCombo = combos.front();
+            combos.clear();
+            combos.add(convergedCombo);
+            if (bandwidth == 0 && banddepth == 0) {
+                allLocalGenotypeCombinations(
+                    combos,
+                    convergedCombo,
+                    sampleDataLikelihoods,
+                    samples,
+                    priorACs,
+                    theta,
+                    pooled,
+                    ewensPriors,
+                    permute,
+                    hwePriors,
+                    binomialObsPriors,
+                    alleleBalancePriors,
+                    diffusionPriorScalar,
+                    true); // keep combos
+            } else {
+                bandedGenotypeCombinations(
+                    combos,
+                    bestCombo,
+                    variantSampleDataLikelihoods,
+                    invariantSampleDataLikelihoods,
+                    samples,
+                    priorACs,
+                    bandwidth,
+                    banddepth,
+                    theta,
+                    pooled,
+                    ewensPriors,
+                    permute,
+                    hwePriors,
+                    binomialObsPriors,
+                    alleleBalancePriors,
+                    diffusionPriorScalar,
+                    true); // keep combos
+            }
+            break;
         } else {
             bestCombo = combos.front();
         }
 
     }
 
+    // if we didn't converge, we have only the best combo, which is yet to
+    // be totalled
+    if (i == maxiterations && !combos.empty()) {
+        GenotypeCombo lastCombo = combos.front();
+        combos.clear();
+        combos.add(lastCombo);
+    }
+
     //cout << i << " iterations" << "\t" << variantSampleDataLikelihoods.size() << " varying samples"
     //     << " and " << invariantSampleDataLikelihoods.size() << " invariant samples" << endl;
 
@@ -1268,26 +1477,26 @@ convergentGenotypeComboSearch(
 
 
 void addAllHomozygousCombos(
-    list<GenotypeCombo>& combos,
+    GenotypeComboResults& combos,
     SampleDataLikelihoods& sampleDataLikelihoods,
     SampleDataLikelihoods& variantSampleDataLikelihoods,
     SampleDataLikelihoods& invariantSampleDataLikelihoods,
     Samples& samples,
     vector<Allele>& genotypeAlleles,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar) {
+    Real diffusionPriorScalar) {
 
     // determine which homozygous combos we already have
 
     map<Allele, bool> allelesWithHomozygousCombos;
 
-    for (list<GenotypeCombo>::iterator c = combos.begin(); c != combos.end(); ++c) {
+    for (list<GenotypeCombo>::iterator c = combos.combos.begin(); c != combos.combos.end(); ++c) {
         bool allSameAndHomozygous = true;
         GenotypeCombo::iterator gc = c->begin();
         Genotype* genotype;
@@ -1358,16 +1567,11 @@ void addAllHomozygousCombos(
                                      alleleBalancePriors,
                                      diffusionPriorScalar);
 
-        combos.push_back(gc);
+        combos.add(gc);
     }
 
-
-    GenotypeComboResultSorter gcrSorter;
-    combos.sort(gcrSorter);
-    combos.unique();
-
     /*
-    for (list<GenotypeCombo>::iterator g = combos.begin(); g != combos.end(); ++g) {
+    for (list<GenotypeCombo>::iterator g = combos.combos.begin(); g != combos.combos.end(); ++g) {
         GenotypeCombo& gc = *g;
         cerr << gc << endl
              << "," << gc.probObsGivenGenotypes
@@ -1387,48 +1591,178 @@ void addAllHomozygousCombos(
 
 }
 
+Real GenotypeCombo::neighborPosteriorProbability(
+        size_t offset,
+        SampleDataLikelihood* sdl,
+        Real theta,
+        bool pooled,
+        bool ewensPriors,
+        bool permute,
+        bool hwePriors,
+        bool binomialObsPriors,
+        bool alleleBalancePriors,
+        Real diffusionPriorScalar) {
+
+    // save what the change and the recalculation overwrite, as undoing the
+    // change to the sums need not give back the same values
+    SampleDataLikelihood* oldsdl = at(offset);
+    Real oldProbObsGivenGenotypes = probObsGivenGenotypes;
+    Real oldPermutationsln = permutationsln;
+    Real oldPosteriorProb = posteriorProb;
+    Real oldPriorProb = priorProb;
+    Real oldPriorProbG_Af = priorProbG_Af;
+    Real oldPriorProbAf = priorProbAf;
+    Real oldPriorProbObservations = priorProbObservations;
+    Real oldPriorProbGenotypesGivenHWE = priorProbGenotypesGivenHWE;
+    ComboPriorTerms oldPriorTerms = priorTerms;
+    // a sample's genotypes all have the same ploidy
+    int ploidy = oldsdl->genotype->ploidy;
+    PloidyGenotypeCounter oldPloidyCounter = ploidyGenotypeCounter(ploidy);
+
+    replaceSampleDataLikelihood(offset, sdl, binomialObsPriors);
+    calculatePosteriorProbability(theta,
+                                  pooled,
+                                  ewensPriors,
+                                  permute,
+                                  hwePriors,
+                                  binomialObsPriors,
+                                  alleleBalancePriors,
+                                  diffusionPriorScalar);
+    Real neighborPosteriorProb = posteriorProb;
+
+    replaceSampleDataLikelihood(offset, oldsdl, binomialObsPriors);
+    probObsGivenGenotypes = oldProbObsGivenGenotypes;
+    permutationsln = oldPermutationsln;
+    posteriorProb = oldPosteriorProb;
+    priorProb = oldPriorProb;
+    priorProbG_Af = oldPriorProbG_Af;
+    priorProbAf = oldPriorProbAf;
+    priorProbObservations = oldPriorProbObservations;
+    priorProbGenotypesGivenHWE = oldPriorProbGenotypesGivenHWE;
+    priorTerms = oldPriorTerms;
+    ploidyGenotypeCounters[ploidy] = oldPloidyCounter;
+
+    return neighborPosteriorProb;
+
+}
+
+bool GenotypeCombo::isHomozygousNeighbor(size_t offset, SampleDataLikelihood* sdl) {
+    Genotype* oldGenotype = at(offset)->genotype;
+    Genotype* newGenotype = sdl->genotype;
+    if (!newGenotype->homozygous) {
+        return false;
+    }
+    // every copy of the other alleles must be in the genotype we replace
+    int alleleIndex = newGenotype->front().alleleIndex;
+    for (int i = 0; i < alleleCounters.size(); ++i) {
+        if (i != alleleIndex && alleleCounters[i].frequency != oldGenotype->alleleCount(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 // conditional probability of the genotype combination given the represented allele frequencies
-long double GenotypeCombo::probabilityGivenAlleleFrequencyln(bool permute) {
+Real GenotypeCombo::probabilityGivenAlleleFrequencyln(bool permute) {
 
     //return -multinomialCoefficientLn(numberOfAlleles(), counts());
 
-    int n = numberOfAlleles();
-    long double lnhetscalar = 0;
+    Real lnhetscalar = 0;
 
     if (permute) {
         // scale by the product of permutations of heterozygotes
         lnhetscalar = permutationsln; // cached permutations of this combo
     }
 
-    return lnhetscalar - multinomialCoefficientLn(n, counts());
+    // multinomialCoefficientLn(numberOfAlleles(), counts())
+    return lnhetscalar - (factorialln(priorTerms.alleleCopies) - priorTerms.alleleCountsln);
+
+}
+
+// hweComboProb(), from the prior terms.  for each genotype,
+// hweProbGenotypeFrequencyln adds the arrangements of its alleles in the
+// genotype, which are its permutations, and of the genotype counts of its
+// ploidy in the combo, and takes away the arrangements of the allele counts.
+// haploid genotypes are counted by allele, so that the last two cancel.
+Real GenotypeCombo::hwePriorln(void) {
+
+    Real alleleArrangementsln = factorialln(priorTerms.alleleCopies) - priorTerms.alleleCountsln;
+    Real hweProb = priorTerms.genotypePermutationsln;
+
+    for (int ploidy = 0; ploidy < ploidyGenotypeCounters.size(); ++ploidy) {
+        const PloidyGenotypeCounter& counter = ploidyGenotypeCounters[ploidy];
+        if (ploidy != 1 && counter.genotypes) {
+            Real genotypeArrangementsln = factorialln(counter.samples) - counter.countsln;
+            hweProb += counter.genotypes * (genotypeArrangementsln - alleleArrangementsln);
+        }
+    }
+
+    return hweProb;
+
+}
+
+// multinomialSamplingProbLn(alleleProbs(), observationCounts()), from the prior terms
+Real GenotypeCombo::alleleBalancePriorln(void) {
+
+    return factorialln(priorTerms.observations)
+        - priorTerms.observationCountsln
+        + priorTerms.observationFrequenciesln
+        - powln(log((Real) priorTerms.alleleCopies), priorTerms.observations);
+
+}
+
+// alleleFrequencyProbabilityln(countFrequencies(), theta), from the prior terms
+Real GenotypeCombo::ewensPriorln(Real theta) {
+
+    Real thetaln = log(theta);
+
+    // the normalizer changes only with the number of copies of the locus
+    if (priorTerms.ewensAlleleCopies != priorTerms.alleleCopies
+            || priorTerms.ewensTheta != theta) {
+        int M = priorTerms.alleleCopies;
+        Real thetaH = 0;
+        for (int h = 1; h < M; ++h)
+            thetaH += log(theta + h);
+        priorTerms.ewensAlleleCopies = M;
+        priorTerms.ewensTheta = theta;
+        priorTerms.ewensNormalizerln = factorialln(M) - (thetaln + thetaH);
+    }
+
+    return priorTerms.ewensNormalizerln
+        + powln(thetaln, priorTerms.alleles)
+        - (priorTerms.alleleFrequenciesln + priorTerms.frequencyCountsln);
 
 }
 
-long double GenotypeCombo::hweComboProb(void) {
-    long double comboHweProb = 0;
-    for (map<Genotype*, int>::iterator gc = genotypeCounts.begin(); gc != genotypeCounts.end(); ++gc) {
-        Genotype* genotype = gc->first;
+Real GenotypeCombo::hweComboProb(void) {
+    Real comboHweProb = 0;
+    vector<Genotype*> distinct = genotypes();
+    for (vector<Genotype*>::iterator g = distinct.begin(); g != distinct.end(); ++g) {
+        Genotype* genotype = *g;
         comboHweProb += hweProbGenotypeFrequencyln(genotype);
     }
     return comboHweProb;
 }
 
 // probability of the combo under HWE
-long double GenotypeCombo::hweExpectedFrequencyln(Genotype* genotype) {
+Real GenotypeCombo::hweExpectedFrequencyln(Genotype* genotype) {
 
     int ploidy = genotype->ploidy;
 
     vector<int> genotypeAlleleCounts;
-    vector<long double> alleleFrequencies;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
-        genotypeAlleleCounts.push_back(genotype->alleleCount(a->first));
-        alleleFrequencies.push_back((long double) a->second.frequency / (long double) numberOfAlleles());
+    vector<Real> alleleFrequencies;
+    for (int i = 0; i < alleleCounters.size(); ++i) {
+        if (alleleCounters[i].frequency == 0) {
+            continue;
+        }
+        genotypeAlleleCounts.push_back(genotype->alleleCount(i));
+        alleleFrequencies.push_back((Real) alleleCounters[i].frequency / (Real) numberOfAlleles());
     }
 
-    long double HWECoefficientln = multinomialCoefficientLn(ploidy, genotypeAlleleCounts);
+    Real HWECoefficientln = multinomialCoefficientLn(ploidy, genotypeAlleleCounts);
 
     vector<int>::iterator c = genotypeAlleleCounts.begin();
-    vector<long double>::iterator f = alleleFrequencies.begin();
+    vector<Real>::iterator f = alleleFrequencies.begin();
     for (; c != genotypeAlleleCounts.end(); ++c, ++f) {
          HWECoefficientln += powln(log(*f), *c);
     }
@@ -1439,7 +1773,7 @@ long double GenotypeCombo::hweExpectedFrequencyln(Genotype* genotype) {
 
 // probability that the genotype count in the combo is what it is given the
 // counts of the other alleles
-long double GenotypeCombo::hweProbGenotypeFrequencyln(Genotype* genotype) {
+Real GenotypeCombo::hweProbGenotypeFrequencyln(Genotype* genotype) {
 
     //cout << endl << *genotype << endl;
 
@@ -1447,34 +1781,41 @@ long double GenotypeCombo::hweProbGenotypeFrequencyln(Genotype* genotype) {
     //cout << "popTotalAlleles = " << popTotalAlleles << endl;
     vector<int> popAlleleCounts;
     vector<int> thisGenotypeAlleleCounts;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
-        //cout << a->first << "\t" << a->second.frequency << "\t" << genotype->alleleCount(a->first) << endl;
-        popAlleleCounts.push_back(a->second.frequency);
-        thisGenotypeAlleleCounts.push_back(genotype->alleleCount(a->first));
+    for (int i = 0; i < alleleCounters.size(); ++i) {
+        if (alleleCounters[i].frequency == 0) {
+            continue;
+        }
+        //cout << i << "\t" << alleleCounters[i].frequency << "\t" << genotype->alleleCount(i) << endl;
+        popAlleleCounts.push_back(alleleCounters[i].frequency);
+        thisGenotypeAlleleCounts.push_back(genotype->alleleCount(i));
     }
 
     int popTotalGenotypes = 0;
     vector<int> popGenotypeCounts;
     // for haploid, estimate as if we have all ploidy 1
     if (genotype->ploidy == 1) {
-        for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
-            popGenotypeCounts.push_back(a->second.frequency);
-            popTotalGenotypes += a->second.frequency;
+        for (vector<AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+            if (a->frequency > 0) {
+                popGenotypeCounts.push_back(a->frequency);
+                popTotalGenotypes += a->frequency;
+            }
         }
     } else {
-        for (map<Genotype*, int>::iterator g = genotypeCounts.begin(); g != genotypeCounts.end(); ++g) {
-            if (g->first->ploidy == genotype->ploidy) {
-                //cout << *g->first << "\t" << g->second << endl;
-                popGenotypeCounts.push_back(g->second);
-                popTotalGenotypes += g->second;
+        vector<Genotype*> distinct = genotypes();
+        for (vector<Genotype*>::iterator g = distinct.begin(); g != distinct.end(); ++g) {
+            if ((*g)->ploidy == genotype->ploidy) {
+                int count = genotypeCounts[(*g)->index];
+                //cout << **g << "\t" << count << endl;
+                popGenotypeCounts.push_back(count);
+                popTotalGenotypes += count;
             }
         }
     }
 
-    long double arrangementsOfAllelesInSample = multinomialCoefficientLn(popTotalAlleles, popAlleleCounts);
+    Real arrangementsOfAllelesInSample = multinomialCoefficientLn(popTotalAlleles, popAlleleCounts);
     //cout << "arrangementsOfAllelesInSample = " << exp(arrangementsOfAllelesInSample) << endl;
 
-    long double arrangementsWithExactlyCountGenotypesGivenAF =
+    Real arrangementsWithExactlyCountGenotypesGivenAF =
         multinomialCoefficientLn(genotype->ploidy, thisGenotypeAlleleCounts)
         + multinomialCoefficientLn(popTotalGenotypes, popGenotypeCounts);
     /*
@@ -1497,14 +1838,14 @@ long double GenotypeCombo::hweProbGenotypeFrequencyln(Genotype* genotype) {
 //
 void
 GenotypeCombo::calculatePosteriorProbability(
-        long double theta,
+        Real theta,
         bool pooled,
         bool ewensPriors,
         bool permute,
         bool hwePriors,
         bool binomialObsPriors,
         bool alleleBalancePriors,
-        long double diffusionPriorScalar) {
+        Real diffusionPriorScalar) {
 
     posteriorProb = 0;
     priorProb = 0;
@@ -1522,51 +1863,19 @@ GenotypeCombo::calculatePosteriorProbability(
 
     // XXX XXX hwe
     if (hwePriors) {
-        for (map<Genotype*, int>::iterator gc = genotypeCounts.begin(); gc != genotypeCounts.end(); ++gc) {
-            Genotype* genotype = gc->first;
-            priorProbGenotypesGivenHWE += hweProbGenotypeFrequencyln(genotype);
-        }
+        priorProbGenotypesGivenHWE = hwePriorln();
     }
 
     if (binomialObsPriors) {
         // for each alternate and the reference allele
         // calculate the binomial probability that we see the given strand balance and read placement prob
-        //cerr << *this << endl;
-        for (map<string, AlleleCounter>::iterator ac = alleleCounters.begin(); ac != alleleCounters.end(); ++ac) {
-            //const string& allele = ac->first;
-            const AlleleCounter& alleleCounter = ac->second;
-            int obs = alleleCounter.observations;
-
-            /*
-            cerr << endl
-                 << "--------------------------------------------" << endl;
-            cerr <<  " counts: " << alleleCounter.frequency
-                << " observations " << alleleCounter.observations
-                << " " << alleleCounter.forwardStrand
-                << "," << alleleCounter.reverseStrand
-                << " " << alleleCounter.placedLeft
-                << "," << alleleCounter.placedRight
-                << " " << alleleCounter.placedStart
-                << "," << alleleCounter.placedEnd
-                << endl;
-
-            cerr << "priorProbObservations = " << priorProbObservations << endl;
-            cerr << "binprobln strand = " << binomialProbln(alleleCounter.forwardStrand, obs, 0.5) << endl;
-            cerr << "binprobln position = " << binomialProbln(alleleCounter.placedLeft, obs, 0.5) << endl;
-            cerr << "binprobln start = " << binomialProbln(alleleCounter.placedStart, obs, 0.5) << endl;
-            */
-
-            priorProbObservations
-                += binomialProbln(alleleCounter.forwardStrand, obs, 0.5)
-                +  binomialProbln(alleleCounter.placedLeft, obs, 0.5)
-                +  binomialProbln(alleleCounter.placedStart, obs, 0.5);
-        }
+        priorProbObservations = priorTerms.binomialObsln;
     }
 
     // ok... now do the same move for the observation counts
     // --- this should capture "Allele Balance"
     if (alleleBalancePriors) {
-        priorProbObservations += multinomialSamplingProbLn(alleleProbs(), observationCounts());
+        priorProbObservations += alleleBalancePriorln();
     }
 
     // with larger population samples, the effect of
@@ -1579,9 +1888,13 @@ GenotypeCombo::calculatePosteriorProbability(
 
     // Ewens' Sampling Formula
     if (ewensPriors) {
-        priorProbAf = alleleFrequencyProbabilityln(countFrequencies(), theta);
+        priorProbAf = ewensPriorln(theta);
     }
 
+#ifdef CHECK_PRIORS
+    checkPriorTerms(theta, permute);
+#endif
+
     // posterior probability
 
     /*
@@ -1604,6 +1917,72 @@ GenotypeCombo::calculatePosteriorProbability(
 
 }
 
+// the binomial probability of the strand balance and read placement of the
+// observations of each allele in the combo
+Real GenotypeCombo::binomialObsComboProb(void) {
+
+    Real priorProbObservations = 0;
+
+    //cerr << *this << endl;
+    for (vector<AlleleCounter>::iterator ac = alleleCounters.begin(); ac != alleleCounters.end(); ++ac) {
+        const AlleleCounter& alleleCounter = *ac;
+        int obs = alleleCounter.observations;
+
+        /*
+        cerr << endl
+             << "--------------------------------------------" << endl;
+        cerr <<  " counts: " << alleleCounter.frequency
+            << " observations " << alleleCounter.observations
+            << " " << alleleCounter.forwardStrand
+            << "," << alleleCounter.reverseStrand
+            << " " << alleleCounter.placedLeft
+            << "," << alleleCounter.placedRight
+            << " " << alleleCounter.placedStart
+            << "," << alleleCounter.placedEnd
+            << endl;
+
+        cerr << "priorProbObservations = " << priorProbObservations << endl;
+        cerr << "binprobln strand = " << binomialProbln(alleleCounter.forwardStrand, obs, 0.5) << endl;
+        cerr << "binprobln position = " << binomialProbln(alleleCounter.placedLeft, obs, 0.5) << endl;
+        cerr << "binprobln start = " << binomialProbln(alleleCounter.placedStart, obs, 0.5) << endl;
+        */
+
+        priorProbObservations
+            += binomialProbln(alleleCounter.forwardStrand, obs, 0.5)
+            +  binomialProbln(alleleCounter.placedLeft, obs, 0.5)
+            +  binomialProbln(alleleCounter.placedStart, obs, 0.5);
+    }
+
+    return priorProbObservations;
+
+}
+
+// aborts if a prior computed from the prior terms has drifted from its full
+// recomputation
+static void checkPriorTerm(const string& name, Real prior, Real fullPrior, GenotypeCombo& combo) {
+    if (prior == fullPrior || abs(prior - fullPrior) <= 1e-6 * max((Real) 1, abs(fullPrior))) {
+        return;
+    }
+    cerr << "error: the " << name << " prior of " << combo << " is " << prior
+         << " from its prior terms, but " << fullPrior << " recomputed from its counts" << endl;
+    abort();
+}
+
+void GenotypeCombo::checkPriorTerms(Real theta, bool permute) {
+
+    checkPriorTerm("genotype combo given allele frequency",
+                   probabilityGivenAlleleFrequencyln(permute),
+                   (permute ? permutationsln : 0) - multinomialCoefficientLn(numberOfAlleles(), counts()),
+                   *this);
+    checkPriorTerm("HWE", hwePriorln(), hweComboProb(), *this);
+    checkPriorTerm("binomial observation", priorTerms.binomialObsln, binomialObsComboProb(), *this);
+    checkPriorTerm("allele balance", alleleBalancePriorln(),
+                   multinomialSamplingProbLn(alleleProbs(), observationCounts()), *this);
+    checkPriorTerm("Ewens", ewensPriorln(theta),
+                   alleleFrequencyProbabilityln(countFrequencies(), theta), *this);
+
+}
+
 
 pair<int, int> alternateAndReferenceCount(vector<Allele*>& observations, string& refbase, string altbase) {
     int altcount = 0;
@@ -1629,14 +2008,14 @@ void orderedGenotypeCombo(
     GenotypeCombo& combo,
     GenotypeCombo& orderedCombo,
     SampleDataLikelihoods& sampleDataLikelihoods,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar) {
+    Real diffusionPriorScalar) {
 
     GenotypeComboMap bestComboMap;
 
@@ -1742,6 +2121,23 @@ map<int, vector<Genotype> > getGenotypesByPloidy(vector<int>& ploidies, vector<A
         }
     }
 
+    // index the genotypes and their alleles, so that genotype combos can
+    // count them in vectors
+    map<string, int> alleleIndexes;
+    for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
+        alleleIndexes.insert(make_pair(a->currentBase, (int) (a - genotypeAlleles.begin())));
+    }
+    int index = 0;
+    for (map<int, vector<Genotype> >::iterator p = genotypesByPloidy.begin(); p != genotypesByPloidy.end(); ++p) {
+        vector<Genotype>& genotypes = p->second;
+        for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
+            g->index = index++;
+            for (Genotype::iterator e = g->begin(); e != g->end(); ++e) {
+                e->alleleIndex = alleleIndexes[e->allele.currentBase];
+            }
+        }
+    }
+
     return genotypesByPloidy;
 
 }
@@ -1774,24 +2170,18 @@ bool Genotype::hasNullAllele(void) {
 
 void GenotypeCombo::appendIndependentCombo(GenotypeCombo& other) {
 
-    for (map<string, AlleleCounter>::iterator c = other.alleleCounters.begin(); c != other.alleleCounters.end(); ++c) {
-        const string& allele = c->first;
-        AlleleCounter& otherCounter = c->second;
-        AlleleCounter& thisCounter = alleleCounters[allele];
+    for (int i = 0; i < other.alleleCounters.size(); ++i) {
+        AlleleCounter& otherCounter = other.alleleCounters[i];
+        AlleleCounter& thisCounter = alleleCounter(i);
         thisCounter.frequency += otherCounter.frequency;
-        thisCounter.observations += otherCounter.observations;
-        thisCounter.forwardStrand += otherCounter.forwardStrand;
-        thisCounter.reverseStrand += otherCounter.reverseStrand;
-        thisCounter.placedLeft += otherCounter.placedLeft;
-        thisCounter.placedRight += otherCounter.placedRight;
-        thisCounter.placedStart += otherCounter.placedStart;
-        thisCounter.placedEnd += otherCounter.placedEnd;
+        thisCounter.addObservations(otherCounter);
     }
 
-    for (GenotypeCombo::iterator s = begin(); s != end(); ++s) {
-        const SampleDataLikelihood& sdl = **s;
-        const Sample& sample = *sdl.sample;
-        ++genotypeCounts[sdl.genotype];
+    if (genotypeCounts.size() < other.genotypeCounts.size()) {
+        genotypeCounts.resize(other.genotypeCounts.size(), 0);
+    }
+    for (int i = 0; i < other.genotypeCounts.size(); ++i) {
+        genotypeCounts[i] += other.genotypeCounts[i];
     }
 
     // permutations
@@ -1816,11 +2206,20 @@ void GenotypeCombo::appendIndependentCombo(GenotypeCombo& other) {
     reserve(size() + distance(other.begin(), other.end()));
     insert(end(), other.begin(), other.end());
 
+    resetPriorTerms();
+
 }
 
 // all combos of each population are combined with the best combos of the other pops
 // combines all like homozygous combos
 void combinePopulationCombos(list<GenotypeCombo>& genotypeCombos, map<string, list<GenotypeCombo> >& genotypeCombosByPopulation) {
+    list<GenotypeCombo> homozygousCombos;
+    combinePopulationCombos(genotypeCombos, homozygousCombos, genotypeCombosByPopulation);
+}
+
+void combinePopulationCombos(list<GenotypeCombo>& genotypeCombos,
+                             list<GenotypeCombo>& homozygousCombos,
+                             map<string, list<GenotypeCombo> >& genotypeCombosByPopulation) {
 
     if (genotypeCombosByPopulation.size() == 1) {
         // one pop, default case is to just pass forward the current set of combos
@@ -1877,11 +2276,14 @@ void combinePopulationCombos(list<GenotypeCombo>& genotypeCombos, map<string, li
             }
         }
 
-        // and add them to the result set
+        // and add them to the result set, unless we have them already
         for (map<Allele, GenotypeCombo>::iterator h = otherPopulationsHomozygousCombos.begin(); h!= otherPopulationsHomozygousCombos.end(); ++h) {
             GenotypeCombo& combo = h->second;
             //assert(genotypeCombos.back().size() == combo.size());
-            genotypeCombos.push_back(combo);
+            if (find(genotypeCombos.begin(), genotypeCombos.end(), combo) == genotypeCombos.end()) {
+                genotypeCombos.push_back(combo);
+                homozygousCombos.push_back(combo);
+            }
         }
 
         // sort the combined combos
@@ -1892,3 +2294,66 @@ void combinePopulationCombos(list<GenotypeCombo>& genotypeCombos, map<string, li
     }
 
 }
+
+void combinePopulationCombos(GenotypeComboResults& genotypeCombos,
+                             map<string, GenotypeComboResults>& genotypeCombosByPopulation) {
+
+    if (genotypeCombosByPopulation.size() == 1) {
+        genotypeCombos = genotypeCombosByPopulation.begin()->second;
+        return;
+    }
+
+    genotypeCombos.clear();
+
+    // the best combos of the combination can only be made from the kept
+    // combos of each population
+    map<string, list<GenotypeCombo> > keptCombosByPopulation;
+    for (map<string, GenotypeComboResults>::iterator p = genotypeCombosByPopulation.begin(); p != genotypeCombosByPopulation.end(); ++p) {
+        keptCombosByPopulation[p->first] = p->second.combos;
+    }
+    list<GenotypeCombo> homozygousCombos;
+    combinePopulationCombos(genotypeCombos.combos, homozygousCombos, keptCombosByPopulation);
+
+    // each combo of a population is joined to the best combos of the others,
+    // adding their posteriors to its own.  relative to the joined best
+    // combos, the combos of each population then sum to
+    // exp(normalizer - best), and those in which a sample has a genotype to
+    // exp(marginal - best), plus the combos of all the other populations if
+    // it is the genotype the sample has in the best combo.
+    Real bestln = 0;
+    vector<Real> scaledNormalizers;
+    for (map<string, GenotypeComboResults>::iterator p = genotypeCombosByPopulation.begin(); p != genotypeCombosByPopulation.end(); ++p) {
+        GenotypeComboResults& results = p->second;
+        bestln += results.front().posteriorProb;
+        scaledNormalizers.push_back(exp(results.posteriorNormalizer - results.front().posteriorProb));
+        genotypeCombos.totalled += results.totalled;
+    }
+    Real scaledNormalizer = accumulate(scaledNormalizers.begin(), scaledNormalizers.end(), (Real) 0);
+    genotypeCombos.posteriorNormalizer = bestln + log(scaledNormalizer);
+
+    vector<Real>::iterator n = scaledNormalizers.begin();
+    for (map<string, GenotypeComboResults>::iterator p = genotypeCombosByPopulation.begin(); p != genotypeCombosByPopulation.end(); ++p, ++n) {
+        GenotypeComboResults& results = p->second;
+        GenotypeCombo& best = results.front();
+        Real otherPopulations = scaledNormalizer - *n;
+        for (size_t i = 0; i < results.rawMarginals.size(); ++i) {
+            Genotype* bestGenotype = best.at(i)->genotype;
+            map<Genotype*, Real>& rawmgs = results.rawMarginals.at(i);
+            genotypeCombos.rawMarginals.push_back(map<Genotype*, Real>());
+            map<Genotype*, Real>& combinedmgs = genotypeCombos.rawMarginals.back();
+            for (map<Genotype*, Real>::iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
+                if (m->first == bestGenotype) {
+                    combinedmgs[m->first] = bestln + log(exp(m->second - best.posteriorProb) + otherPopulations);
+                } else {
+                    combinedmgs[m->first] = bestln + m->second - best.posteriorProb;
+                }
+            }
+        }
+    }
+
+    // the joined homozygous combos are the only others
+    for (list<GenotypeCombo>::iterator h = homozygousCombos.begin(); h != homozygousCombos.end(); ++h) {
+        genotypeCombos.total(*h);
+    }
+
+}
@@ -34,7 +34,8 @@ class GenotypeElement {
 public:
     Allele allele;
     int count;
-    GenotypeElement(const Allele& a, int c) : allele(a), count(c) { }
+    int alleleIndex; // of the allele among the genotype alleles of the site, or -1
+    GenotypeElement(const Allele& a, int c) : allele(a), count(c), alleleIndex(-1) { }
 
 };
 
@@ -51,9 +52,10 @@ public:
     vector<Allele> alleles;
     map<string, int> alleleCounts;
     bool homozygous;
-    long double permutationsln;  // aka, multinomialCoefficientLn(ploidy, counts())
+    Real permutationsln;  // aka, multinomialCoefficientLn(ploidy, counts())
+    int index;  // among the genotypes of all ploidies at the site, or -1
 
-    Genotype(vector<Allele>& ungroupedAlleles) {
+    Genotype(vector<Allele>& ungroupedAlleles) : index(-1) {
         alleles = ungroupedAlleles;
         sort(alleles.begin(), alleles.end());
         vector<vector<Allele> > groups = groupAlleles_copy(alleles);
@@ -75,6 +77,7 @@ public:
     int getPloidy(void);
     int alleleCount(const string& base);
     int alleleCount(Allele& allele);
+    int alleleCount(int alleleIndex);  // by GenotypeElement::alleleIndex
     bool containsAllele(Allele& allele);
     bool containsAllele(const string& base);
     // returns true when the genotype is composed of a subset of the alleles
@@ -83,8 +86,8 @@ public:
     vector<string> alternateBases(string& refbase);
     vector<int> counts(void);
     // the probability of drawing each allele out of the genotype, ordered by allele
-    vector<long double> alleleProbabilities(void);
-    vector<long double> alleleProbabilities(Bias& observationBias);
+    vector<Real> alleleProbabilities(void);
+    vector<Real> alleleProbabilities(Bias& observationBias);
     double alleleSamplingProb(const string& base);
     double alleleSamplingProb(Allele& allele);
     string str(void) const;
@@ -112,16 +115,58 @@ string IUPAC2GenotypeStr(string iupac);
 
 vector<Genotype> allPossibleGenotypes(int ploidy, vector<Allele>& potentialAlleles);
 
+class AlleleCounter {
+public:
+    int frequency;
+    int observations;
+    int forwardStrand; // supporting reads on the forward strand
+    int reverseStrand; // supporting reads on the reverse strand
+    int placedLeft;    // supporting reads placed to the left of the allele
+    int placedRight;   // supporting reads placed to the right of the allele
+    int placedStart;   // supporting reads for which the allele occurs in the first half of the read (5'-3')
+    int placedEnd;     // supporting reads for which the allele occurs in the second half of the read (5'-3')
+    AlleleCounter(void)
+        : frequency(0)
+        , observations(0)
+        , forwardStrand(0)
+        , reverseStrand(0)
+        , placedLeft(0)
+        , placedRight(0)
+        , placedStart(0)
+        , placedEnd(0)
+    { }
+    // adds the observations of the sample for base, or removes them if
+    // sign is -1, to the observation counts
+    void addObservations(const Sample& sample, const string& base, int sign = 1);
+    // adds, or removes, the observation counts of other
+    void addObservations(const AlleleCounter& other, int sign = 1) {
+        observations += sign * other.observations;
+        forwardStrand += sign * other.forwardStrand;
+        reverseStrand += sign * other.reverseStrand;
+        placedLeft += sign * other.placedLeft;
+        placedRight += sign * other.placedRight;
+        placedStart += sign * other.placedStart;
+        placedEnd += sign * other.placedEnd;
+    }
+};
+
+// the observation counts of the sample for each of the genotype alleles of
+// the site, indexed as GenotypeElement::alleleIndex.  these don't change
+// as the genotype of the sample does, so they are counted once per site.
+vector<AlleleCounter> sampleObservationCounters(const Sample& sample, vector<Allele>& genotypeAlleles);
+
 class SampleDataLikelihood {
 public:
     string name;
     Genotype* genotype;
-    long double prob;
-    long double marginal;
+    Real prob;
+    Real marginal;
     Sample* sample;
     bool hasObservations;
     int rank; // the rank of this data likelihood relative to others for the sample, 0 is best
-    SampleDataLikelihood(string n, Sample* s, Genotype* g, long double p, int r)
+    // sampleObservationCounters of the sample, shared by its data likelihoods
+    const vector<AlleleCounter>* observationCounters;
+    SampleDataLikelihood(string n, Sample* s, Genotype* g, Real p, int r)
         : name(n)
         , sample(s)
         , genotype(g)
@@ -129,6 +174,7 @@ public:
         , rank(r)
         , marginal(0)
         , hasObservations(true)
+        , observationCounters(NULL)
     { }
 
     bool hasSupportingObservations(void) const {
@@ -141,25 +187,52 @@ public:
 
 };
 
-class AlleleCounter {
+// the genotypes of one ploidy in a combo, as counted for the HWE prior
+class PloidyGenotypeCounter {
 public:
-    int frequency;
-    int observations;
-    int forwardStrand; // supporting reads on the forward strand
-    int reverseStrand; // supporting reads on the reverse strand
-    int placedLeft;    // supporting reads placed to the left of the allele
-    int placedRight;   // supporting reads placed to the right of the allele
-    int placedStart;   // supporting reads for which the allele occurs in the first half of the read (5'-3')
-    int placedEnd;     // supporting reads for which the allele occurs in the second half of the read (5'-3')
-    AlleleCounter(void)
-        : frequency(0)
+    int genotypes;     // distinct genotypes of this ploidy in the combo
+    int samples;       // samples which have one of them
+    Real countsln;     // sum of ln(count!) over the genotypes
+    PloidyGenotypeCounter(void)
+        : genotypes(0)
+        , samples(0)
+        , countsln(0)
+    { }
+};
+
+// running sums over the allele and genotype counts of a combo, from which
+// each of its priors can be had without walking all of the counts
+class ComboPriorTerms {
+public:
+    int alleles;                  // alleles with a count in the combo
+    int alleleCopies;             // sum of allele frequencies
+    Real alleleCountsln;          // sum of ln(frequency!)
+    Real alleleFrequenciesln;     // sum of ln(frequency)
+    Real frequencyCountsln;       // sum of ln(count!) over the counts of each frequency
+    int observations;             // sum of allele observations
+    Real observationCountsln;     // sum of ln(observations!)
+    Real observationFrequenciesln; // sum of observations * ln(frequency)
+    Real binomialObsln;           // sum of the strand and placement binomial probs
+    Real genotypePermutationsln;  // sum of permutationsln over distinct genotypes
+    // the part of Ewens' formula which depends only on the number of
+    // copies of the locus, cached for the theta it was computed with
+    int ewensAlleleCopies;
+    Real ewensTheta;
+    Real ewensNormalizerln;
+    ComboPriorTerms(void)
+        : alleles(0)
+        , alleleCopies(0)
+        , alleleCountsln(0)
+        , alleleFrequenciesln(0)
+        , frequencyCountsln(0)
         , observations(0)
-        , forwardStrand(0)
-        , reverseStrand(0)
-        , placedLeft(0)
-        , placedRight(0)
-        , placedStart(0)
-        , placedEnd(0)
+        , observationCountsln(0)
+        , observationFrequenciesln(0)
+        , binomialObsln(0)
+        , genotypePermutationsln(0)
+        , ewensAlleleCopies(-1)
+        , ewensTheta(0)
+        , ewensNormalizerln(0)
     { }
 };
 
@@ -169,9 +242,9 @@ public:
     // GenotypeCombo::prob is equal to the sum of probs in the combo.  We
     // factor it out so that we can construct the probabilities efficiently as
     // we generate the genotype combinations
-    long double probObsGivenGenotypes;  // aka data likelihood
+    Real probObsGivenGenotypes;  // aka data likelihood
 
-    long double permutationsln;  // the number of perutations of unphased genotypes in the combo
+    Real permutationsln;  // the number of perutations of unphased genotypes in the combo
 
     // these *must* be generated at construction time
     // for efficiency they can be updated as each genotype combo is generated
@@ -179,8 +252,53 @@ public:
     //map<string, pair<int, int> > alleleStrandCounts; // map from allele spec to (forword, reverse) counts
     //map<string, pair<int, int> > alleleReadPlacementCounts; // map from allele spec to (left, right) counts
     //map<string, pair<int, int> > alleleReadPositionCounts; // map from allele spec to (left, right) counts
-    map<string, AlleleCounter> alleleCounters;
-    map<Genotype*, int> genotypeCounts;
+
+    // the counters of the alleles and genotypes of the site, indexed by
+    // GenotypeElement::alleleIndex and Genotype::index.  those not in the
+    // combo have a count of 0.  they are only as long as the highest index
+    // in use, as the number of alleles at a site is not bounded.
+    vector<AlleleCounter> alleleCounters;
+    vector<int> genotypeCounts;
+
+    AlleleCounter& alleleCounter(int alleleIndex) {
+        if (alleleIndex >= alleleCounters.size()) {
+            alleleCounters.resize(alleleIndex + 1);
+        }
+        return alleleCounters[alleleIndex];
+    }
+
+    int& genotypeCount(Genotype* genotype) {
+        if (genotype->index >= genotypeCounts.size()) {
+            genotypeCounts.resize(genotype->index + 1, 0);
+        }
+        return genotypeCounts[genotype->index];
+    }
+
+    // kept up to date with the counts above, so that changing the genotype
+    // of one sample only costs as much as the alleles and genotypes it
+    // touches.  building with CHECK_PRIORS defined (make checkpriors, or
+    // bin/freebayes-checkpriors, which the tests run) checks each prior
+    // against its full recomputation.
+    ComboPriorTerms priorTerms;
+    // the number of alleles at each frequency, and the genotypes of each
+    // ploidy, indexed by frequency and ploidy and grown like the counters
+    // above
+    vector<int> frequencyCounts;
+    vector<PloidyGenotypeCounter> ploidyGenotypeCounters;
+
+    int& frequencyCount(int frequency) {
+        if (frequency >= frequencyCounts.size()) {
+            frequencyCounts.resize(frequency + 1, 0);
+        }
+        return frequencyCounts[frequency];
+    }
+
+    PloidyGenotypeCounter& ploidyGenotypeCounter(int ploidy) {
+        if (ploidy >= ploidyGenotypeCounters.size()) {
+            ploidyGenotypeCounters.resize(ploidy + 1);
+        }
+        return ploidyGenotypeCounters[ploidy];
+    }
 
     GenotypeCombo(void)
         : probObsGivenGenotypes(0)
@@ -201,16 +319,23 @@ public:
     void appendIndependentCombo(GenotypeCombo& other);
 
     int numberOfAlleles(void);
-    vector<long double> alleleProbs(void);  // scales counts() by the total number of alleles
+    vector<Real> alleleProbs(void);  // scales counts() by the total number of alleles
     int ploidy(void); // the number of copies of the locus in this combination
     int alleleCount(Allele& allele);
     int alleleCount(const string& allele);
-    long double alleleFrequency(Allele& allele);
-    long double alleleFrequency(const string& allele);
-    long double genotypeFrequency(Genotype* genotype);
-    void updateCachedCounts(Sample* sample, Genotype* oldGenotype, Genotype* newGenotype, bool useObsExpectations);
+    Real alleleFrequency(Allele& allele);
+    Real alleleFrequency(const string& allele);
+    Real genotypeFrequency(Genotype* genotype);
+    // observationCounters are those of the sample whose genotype changes
+    void updateCachedCounts(const vector<AlleleCounter>& observationCounters,
+                            Genotype* oldGenotype, Genotype* newGenotype, bool useObsExpectations);
+    // replaces the data likelihood of the sample at offset with sdl, and
+    // updates the cached counts and the data likelihood of the combo to match
+    void replaceSampleDataLikelihood(size_t offset, SampleDataLikelihood* sdl, bool useObsExpectations);
     map<string, int> countAlleles(void);
     map<int, int> countFrequencies(void);
+    int alleleIndex(const string& base); // among the alleles of the combo's genotypes, or -1
+    vector<Genotype*> genotypes(void); // the distinct genotypes in the combo
     int hetCount(void);
     vector<int> counts(void); // the counts of frequencies of the alleles in the genotype combo
     vector<int> observationCounts(void); // the counts of observations of the alleles (in sorted order)
@@ -221,32 +346,63 @@ public:
 
     // posterior
 
-    long double posteriorProb; // p(genotype combo) * p(observations | genotype combo)
+    Real posteriorProb; // p(genotype combo) * p(observations | genotype combo)
 
     // priors
 
-    long double priorProb; // p(genotype combo) = p(genotype combo | allele frequency) * p(allele frequency) * p(observations)
-    long double priorProbG_Af; // p(genotype combo | allele frequency)
-    long double priorProbAf; // p(allele frequency)
-    long double priorProbObservations; // p(observations)
-    long double priorProbGenotypesGivenHWE;
+    Real priorProb; // p(genotype combo) = p(genotype combo | allele frequency) * p(allele frequency) * p(observations)
+    Real priorProbG_Af; // p(genotype combo | allele frequency)
+    Real priorProbAf; // p(allele frequency)
+    Real priorProbObservations; // p(observations)
+    Real priorProbGenotypesGivenHWE;
 
     //GenotypeCombo* combo,
     void calculatePosteriorProbability(
-        long double theta,
+        Real theta,
         bool pooled,
         bool ewensPriors,
         bool permute,
         bool hwePriors,
         bool obsBinomialPriors,
         bool alleleBalancePriors,
-        long double diffusionPriorScalarln);
-
-    long double probabilityGivenAlleleFrequencyln(bool permute);
-
-    long double hweExpectedFrequencyln(Genotype* genotype);
-    long double hweProbGenotypeFrequencyln(Genotype* genotype);
-    long double hweComboProb(void);
+        Real diffusionPriorScalarln);
+
+    // the posterior probability of the combo which differs from this one
+    // only in that the sample at offset has the data likelihood sdl.  it is
+    // scored by changing this combo in place and changing it back, so that
+    // neighbors can be compared without copying the combo for each one.
+    Real neighborPosteriorProbability(
+        size_t offset,
+        SampleDataLikelihood* sdl,
+        Real theta,
+        bool pooled,
+        bool ewensPriors,
+        bool permute,
+        bool hwePriors,
+        bool binomialObsPriors,
+        bool alleleBalancePriors,
+        Real diffusionPriorScalarln);
+    // if that neighbor would be homozygous, from the counts of this combo
+    bool isHomozygousNeighbor(size_t offset, SampleDataLikelihood* sdl);
+
+    // add (sign = 1) or remove (sign = -1) the allele's part of the prior terms
+    void adjustAlleleTerms(const AlleleCounter& alleleCounter, int sign);
+    // change the number of samples in the combo with the genotype
+    void adjustGenotypeTerms(Genotype* genotype, int oldCount, int newCount);
+    // recomputes the prior terms from the counts
+    void resetPriorTerms(void);
+
+    Real probabilityGivenAlleleFrequencyln(bool permute);
+    Real hwePriorln(void);
+    Real alleleBalancePriorln(void);
+    Real ewensPriorln(Real theta);
+
+    // full recomputations of the priors above, from the counts
+    Real hweExpectedFrequencyln(Genotype* genotype);
+    Real hweProbGenotypeFrequencyln(Genotype* genotype);
+    Real hweComboProb(void);
+    Real binomialObsComboProb(void);
+    void checkPriorTerms(Real theta, bool permute);
 
 };
 
@@ -267,6 +423,53 @@ struct GenotypeComboResultEqual {
     }
 };
 
+// the results of a genotype combo search.  only the best few combos are
+// kept, in the order of GenotypeComboResultSorter, along with every
+// homozygous combo, as the search and the combination of populations need
+// those.  the posterior normalizer and the marginals are totalled over every
+// combo as it is added, so that the rest of the combos can be dropped and
+// the cost of a site doesn't grow with the number of combos scored.
+class GenotypeComboResults {
+public:
+    list<GenotypeCombo> combos; // the kept combos, best first
+    size_t capacity; // how many of the best combos are kept
+    int totalled; // the number of combos added to the totals
+    Real posteriorNormalizer; // ln of the sum of the posteriors of the combos
+    // for each sample, in the order of the combos, ln of the sum of the
+    // posteriors of the combos in which it has each genotype
+    vector<map<Genotype*, Real> > rawMarginals;
+
+    // the best two are all we report, as the best combo and its odds ratio
+    GenotypeComboResults(size_t c = 2)
+        : capacity(c)
+        , totalled(0)
+        , posteriorNormalizer(0)
+    { }
+
+    bool empty(void) { return combos.empty(); }
+    GenotypeCombo& front(void) { return combos.front(); }
+    void clear(void);
+    // if a combo with this posterior would be among the best kept
+    bool keeps(Real posteriorProb);
+    // keeps the combo if it is among the best or homozygous.  returns false
+    // if it is already kept, in which case it shouldn't be totalled again.
+    bool insert(GenotypeCombo& combo);
+    // add the combo to the totals
+    void total(GenotypeCombo& combo);
+    // add the neighbor of the combo in which the sample at offset has the
+    // data likelihood sdl to the totals, without making it
+    void total(GenotypeCombo& combo, size_t offset, SampleDataLikelihood* sdl, Real posteriorProb);
+    void add(GenotypeCombo& combo) {
+        if (insert(combo)) {
+            total(combo);
+        }
+    }
+
+private:
+    void totalPosterior(Real posteriorProb);
+    void totalMarginal(size_t offset, Genotype* genotype, Real posteriorProb);
+};
+
 // for sorting data likelihoods
 struct SampleDataLikelihoodCompare {
     bool operator()(const SampleDataLikelihood& a,
@@ -324,14 +527,14 @@ orderedGenotypeCombo(
     GenotypeCombo& combo,
     GenotypeCombo& orderedCombo,
     SampleDataLikelihoods& sampleDataLikelihoods,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar);
+    Real diffusionPriorScalar);
 
 void
 makeComboByDatalLikelihoodRank(
@@ -340,66 +543,67 @@ makeComboByDatalLikelihoodRank(
     SampleDataLikelihoods& variantSampleDataLikelihoods,
     SampleDataLikelihoods& invariantSampleDataLikelihoods,
     map<string, int>& priorACs,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar);
+    Real diffusionPriorScalar);
 
 void
 dataLikelihoodMaxGenotypeCombo(
     GenotypeCombo& combo,
     SampleDataLikelihoods& sampleDataLikelihoods,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar);
+    Real diffusionPriorScalar);
 
 bool
 bandedGenotypeCombinations(
-    list<GenotypeCombo>& combos,
+    GenotypeComboResults& combos,
     GenotypeCombo& comboKing,
     SampleDataLikelihoods& variantDataLikelihoods,
     SampleDataLikelihoods& invariantDataLikelihoods,
     Samples& samples,
     map<string, int>& priorACs,
     int bandwidth, int banddepth,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar);
+    Real diffusionPriorScalar,
+    bool keepCombos);
 
 void
 allLocalGenotypeCombinations(
-    list<GenotypeCombo>& combos,
+    GenotypeComboResults& combos,
     GenotypeCombo& comboKing,
     SampleDataLikelihoods& sampleDataLikelihoods,
     Samples& samples,
     map<string, int>& priorACs,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar,
+    Real diffusionPriorScalar,
     bool keepCombos);
 
 void
 convergentGenotypeComboSearch(
-    list<GenotypeCombo>& combos,
+    GenotypeComboResults& combos,
     GenotypeCombo& comboKing,
     SampleDataLikelihoods& sampleDataLikelihoods,
     SampleDataLikelihoods& variantDataLikelihoods,
@@ -408,34 +612,34 @@ convergentGenotypeComboSearch(
     vector<Allele>& genotypeAlleles,
     map<string, int>& priorACs,
     int bandwidth, int banddepth,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar,
+    Real diffusionPriorScalar,
     int maxiterations,
     int& totaliterations,
     bool addHomozygousCombos);
 
 void
 addAllHomozygousCombos(
-    list<GenotypeCombo>& combos,
+    GenotypeComboResults& combos,
     SampleDataLikelihoods& sampleDataLikelihoods,
     SampleDataLikelihoods& variantSampleDataLikelihoods,
     SampleDataLikelihoods& invariantSampleDataLikelihoods,
     Samples& samples,
     vector<Allele>& genotypeAlleles,
-    long double theta,
+    Real theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar);
+    Real diffusionPriorScalar);
 
 
 vector<pair<Allele, int> > alternateAlleles(GenotypeCombo& combo, string referenceBase);
@@ -449,5 +653,14 @@ map<int, vector<Genotype> > getGenotypesByPloidy(vector<int>& ploidies, vector<A
 
 void combinePopulationCombos(list<GenotypeCombo>& genotypeCombos,
                              map<string, list<GenotypeCombo> >& genotypeCombosByPopulation);
+// as above, and fills homozygousCombos with the combined homozygous combos
+// which were not already among the combos
+void combinePopulationCombos(list<GenotypeCombo>& genotypeCombos,
+                             list<GenotypeCombo>& homozygousCombos,
+                             map<string, list<GenotypeCombo> >& genotypeCombosByPopulation);
+// combines the kept combos as above, and the totals of the populations into
+// the totals over the combined combos
+void combinePopulationCombos(GenotypeComboResults& genotypeCombos,
+                             map<string, GenotypeComboResults>& genotypeCombosByPopulation);
 
 #endif
@@ -6,7 +6,7 @@
 void marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, Results& results) {
 
 
-    map<string, map<Genotype*, vector<long double> > > rawMarginals;
+    map<string, map<Genotype*, vector<Real> > > rawMarginals;
 
     // push the marginal likelihoods into the rawMarginals vectors in the results
     for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
@@ -19,14 +19,14 @@ void marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, Results& r
     // safely add the raw marginal vectors using logsumexp
     for (Results::iterator r = results.begin(); r != results.end(); ++r) {
         ResultData& sample = r->second;
-        map<Genotype*, vector<long double> >& rawmgs = rawMarginals[r->first];
-        vector<long double> probs;
-        for (map<Genotype*, vector<long double> >::iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
+        map<Genotype*, vector<Real> >& rawmgs = rawMarginals[r->first];
+        vector<Real> probs;
+        for (map<Genotype*, vector<Real> >::iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
             probs.push_back(logsumexp_probs(m->second));
         }
-        long double normalizer = logsumexp_probs(probs);
-        vector<long double>::iterator p = probs.begin();
-        for (map<Genotype*, vector<long double> >::iterator m = rawmgs.begin(); m != rawmgs.end(); ++m, ++p) {
+        Real normalizer = logsumexp_probs(probs);
+        vector<Real>::iterator p = probs.begin();
+        for (map<Genotype*, vector<Real> >::iterator m = rawmgs.begin(); m != rawmgs.end(); ++m, ++p) {
             sample.marginals[m->first] = *p - normalizer;
         }
     }
@@ -38,25 +38,23 @@ void marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, Results& r
 // assumes that the genotype combos are in the same order as the likelihoods
 // assumes that the genotype combos are the same size as the number of samples in the likelihoods
 // returns the delta from the previous marginals, informative in the case of EM
-long double marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods) {
+Real marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods) {
 
-    long double delta = 0;
-
-    vector< map<Genotype*, long double> > rawMarginals;
+    vector< map<Genotype*, Real> > rawMarginals;
     rawMarginals.resize(likelihoods.size());
-    vector< map<Genotype*, long double> >::iterator rawMarginalsItr;
+    vector< map<Genotype*, Real> >::iterator rawMarginalsItr;
 
     // push the marginal likelihoods into the rawMarginals maps
     for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
         rawMarginalsItr = rawMarginals.begin();
         for (GenotypeCombo::const_iterator i = gc->begin(); i != gc->end(); ++i) {
             const SampleDataLikelihood& sdl = **i;
-            map<Genotype*, long double>& rmgs = *rawMarginalsItr++;
-            map<Genotype*, long double>::iterator rmgsItr = rmgs.find(sdl.genotype);
+            map<Genotype*, Real>& rmgs = *rawMarginalsItr++;
+            map<Genotype*, Real>::iterator rmgsItr = rmgs.find(sdl.genotype);
             if (rmgsItr == rmgs.end()) {
                 rmgs[sdl.genotype] = gc->posteriorProb;
             } else {
-                //vector<long double> x;
+                //vector<Real> x;
                 //x.push_back(rmgsItr->second); x.push_back(gc->posteriorProb);
                 //rmgs[sdl.genotype] = logsumexp_probs(x);
                 rmgs[sdl.genotype] = log(safe_exp(rmgsItr->second) + safe_exp(gc->posteriorProb));
@@ -64,23 +62,41 @@ long double marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, Sam
         }
     }
 
+    return marginalGenotypeLikelihoods(rawMarginals, likelihoods);
+
+}
+
+// as above, from the marginals totalled by the combo search
+Real marginalGenotypeLikelihoods(GenotypeComboResults& genotypeCombos, SampleDataLikelihoods& likelihoods) {
+
+    if (genotypeCombos.rawMarginals.size() < likelihoods.size()) {
+        genotypeCombos.rawMarginals.resize(likelihoods.size());
+    }
+    return marginalGenotypeLikelihoods(genotypeCombos.rawMarginals, likelihoods);
+
+}
+
+Real marginalGenotypeLikelihoods(vector< map<Genotype*, Real> >& rawMarginals, SampleDataLikelihoods& likelihoods) {
+
+    Real delta = 0;
+
     // safely add the raw marginal vectors using logsumexp
     // and use to update the sample data likelihoods
-    rawMarginalsItr = rawMarginals.begin();
-    long double minAllowedMarginal = -1e-16;
+    vector< map<Genotype*, Real> >::iterator rawMarginalsItr = rawMarginals.begin();
+    Real minAllowedMarginal = -1e-16;
     for (SampleDataLikelihoods::iterator s = likelihoods.begin(); s != likelihoods.end(); ++s) {
         vector<SampleDataLikelihood>& sdls = *s;
-        const map<Genotype*, long double>& rawmgs = *rawMarginalsItr++;
-        map<Genotype*, long double> marginals;
-        vector<long double> rawprobs;
-        for (map<Genotype*, long double>::const_iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
-            long double p = m->second;
+        const map<Genotype*, Real>& rawmgs = *rawMarginalsItr++;
+        map<Genotype*, Real> marginals;
+        vector<Real> rawprobs;
+        for (map<Genotype*, Real>::const_iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
+            Real p = m->second;
             marginals[m->first] = p;
             rawprobs.push_back(p);
         }
-        long double normalizer = logsumexp_probs(rawprobs);
+        Real normalizer = logsumexp_probs(rawprobs);
         for (vector<SampleDataLikelihood>::iterator sdl = sdls.begin(); sdl != sdls.end(); ++sdl) {
-            long double newmarginal = marginals[sdl->genotype] - normalizer;
+            Real newmarginal = marginals[sdl->genotype] - normalizer;
             delta += newmarginal - sdl->marginal;
             // ensure the marginal is non-0 to guard against underflow
             sdl->marginal = min(minAllowedMarginal, newmarginal);
@@ -95,20 +111,20 @@ long double marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, Sam
 void bestMarginalGenotypeCombo(GenotypeCombo& combo,
         Results& results,
         SampleDataLikelihoods& samples,
-        long double theta,
+        Real theta,
         bool pooled,
         bool permute,
         bool hwePriors,
         bool binomialObsPriors,
         bool alleleBalancePriors,
-        long double diffusionPriorScalar) {
+        Real diffusionPriorScalar) {
 
     for (SampleDataLikelihoods::iterator s = samples.begin(); s != samples.end(); ++s) {
         vector<SampleDataLikelihood>& sdls = *s;
         const string& name = sdls.front().name;
-        const map<Genotype*, long double>& marginals = results[name].marginals;;
-        map<Genotype*, long double>::const_iterator m = marginals.begin();
-        long double bestMarginalProb = m->second;
+        const map<Genotype*, Real>& marginals = results[name].marginals;;
+        map<Genotype*, Real>::const_iterator m = marginals.begin();
+        Real bestMarginalProb = m->second;
         Genotype* bestMarginalGenotype = m->first;
         ++m;
         for (; m != marginals.end(); ++m) {
@@ -132,14 +148,14 @@ void bestMarginalGenotypeCombo(GenotypeCombo& combo,
 }
 */
 
-long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods) {
+Real balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods) {
 
-    long double delta = 0;
+    Real delta = 0;
 
-    //map<string, map<Genotype*, vector<long double> > > rawMarginals;
-    vector< map<Genotype*, vector<long double> > > rawMarginals;
+    //map<string, map<Genotype*, vector<Real> > > rawMarginals;
+    vector< map<Genotype*, vector<Real> > > rawMarginals;
     rawMarginals.resize(likelihoods.size());
-    vector< map<Genotype*, vector<long double> > >::iterator rawMarginalsItr;
+    vector< map<Genotype*, vector<Real> > >::iterator rawMarginalsItr;
 
     // push the marginal likelihoods into the rawMarginals maps
     for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
@@ -147,7 +163,7 @@ long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCom
             rawMarginalsItr = rawMarginals.begin();
             for (GenotypeCombo::const_iterator i = gc->begin(); i != gc->end(); ++i) {
                 const SampleDataLikelihood& sdl = **i;
-                map<Genotype*, vector<long double> >& rmgs = *rawMarginalsItr++;
+                map<Genotype*, vector<Real> >& rmgs = *rawMarginalsItr++;
                 rmgs[sdl.genotype].push_back(gc->posteriorProb);
             }
         } else {
@@ -157,7 +173,7 @@ long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCom
                 const SampleDataLikelihood& sdl = **i;
                 if (sdl.rank != 0) {
                     isComboKing = false;
-                    map<Genotype*, vector<long double> >& rmgs = *rawMarginalsItr;
+                    map<Genotype*, vector<Real> >& rmgs = *rawMarginalsItr;
                     rmgs[sdl.genotype].push_back(gc->posteriorProb);
                 }
                 ++rawMarginalsItr;
@@ -166,7 +182,7 @@ long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCom
                 rawMarginalsItr = rawMarginals.begin();
                 for (GenotypeCombo::const_iterator i = gc->begin(); i != gc->end(); ++i) {
                     const SampleDataLikelihood& sdl = **i;
-                    map<Genotype*, vector<long double> >& rmgs = *rawMarginalsItr++;
+                    map<Genotype*, vector<Real> >& rmgs = *rawMarginalsItr++;
                     rmgs[sdl.genotype].push_back(gc->posteriorProb);
                 }
             }
@@ -177,17 +193,17 @@ long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCom
     rawMarginalsItr = rawMarginals.begin();
     for (SampleDataLikelihoods::iterator s = likelihoods.begin(); s != likelihoods.end(); ++s) {
         vector<SampleDataLikelihood>& sdls = *s;
-        const map<Genotype*, vector<long double> >& rawmgs = *rawMarginalsItr++;
-        map<Genotype*, long double> marginals;
-        vector<long double> rawprobs;
-        for (map<Genotype*, vector<long double> >::const_iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
-            long double p = logsumexp_probs(m->second);
+        const map<Genotype*, vector<Real> >& rawmgs = *rawMarginalsItr++;
+        map<Genotype*, Real> marginals;
+        vector<Real> rawprobs;
+        for (map<Genotype*, vector<Real> >::const_iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
+            Real p = logsumexp_probs(m->second);
             marginals[m->first] = p;
             rawprobs.push_back(p);
         }
-        long double normalizer = logsumexp_probs(rawprobs);
+        Real normalizer = logsumexp_probs(rawprobs);
         for (vector<SampleDataLikelihood>::iterator sdl = sdls.begin(); sdl != sdls.end(); ++sdl) {
-            long double newmarginal = marginals[sdl->genotype] - normalizer;
+            Real newmarginal = marginals[sdl->genotype] - normalizer;
             delta += newmarginal - sdl->marginal;
             sdl->marginal = newmarginal;
         }
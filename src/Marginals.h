@@ -9,18 +9,21 @@
 using namespace std;
 
 //void marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, Results& results);
-long double marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods);
+Real marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods);
+Real marginalGenotypeLikelihoods(GenotypeComboResults& genotypeCombos, SampleDataLikelihoods& likelihoods);
+// updates the marginals of the likelihoods from the raw marginals, in the same order
+Real marginalGenotypeLikelihoods(vector< map<Genotype*, Real> >& rawMarginals, SampleDataLikelihoods& likelihoods);
 void bestMarginalGenotypeCombo(GenotypeCombo& combo,
         Results& results,
         SampleDataLikelihoods& samples,
-        long double theta,
+        Real theta,
         bool pooled,
         bool permute,
         bool hwePriors,
         bool binomialObsPriors,
         bool alleleBalancePriors,
-        long double diffusionPriorScalar);
+        Real diffusionPriorScalar);
 
-long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods);
+Real balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods);
 
 #endif
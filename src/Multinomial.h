@@ -4,10 +4,10 @@
 #include "Utility.h"
 #include <vector>
 
-long double multinomialSamplingProb(const vector<long double>& probs, const vector<int>& obs);
-long double multinomialSamplingProbLn(const vector<long double>& probs, const vector<int>& obs);
-long double multinomialCoefficientLn(int n, const vector<int>& counts);
+Real multinomialSamplingProb(const vector<Real>& probs, const vector<int>& obs);
+Real multinomialSamplingProbLn(const vector<Real>& probs, const vector<int>& obs);
+Real multinomialCoefficientLn(int n, const vector<int>& counts);
 
-long double samplingProbLn(const vector<long double>& probs, const vector<int>& obs);
+Real samplingProbLn(const vector<Real>& probs, const vector<int>& obs);
 
 #endif
@@ -0,0 +1,559 @@
+#include "ObservationBuffer.h"
+#include <map>
+#include <set>
+#include <cmath>
+#include <stdlib.h>
+#include "Utility.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OBSERVATION_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+
+// log(1 - (1 - e_base) * (1 - e_map) / weight), the log error probability of
+// an observation with the given phred base and mapping qualities which is
+// counted weight times, for every pair of qualities, so the likelihoods need
+// no exp or log per observation
+class ObservationErrorTable {
+public:
+    vector<double> table;
+    ObservationErrorTable(void) {
+        table.resize(ERROR_TABLE_WEIGHTS * ERROR_TABLE_MAPPING_QUALITIES * ERROR_TABLE_BASE_QUALITIES);
+        for (int w = 1; w <= ERROR_TABLE_WEIGHTS; ++w) {
+            double scale = (double)1/(double)w;
+            for (int mq = 0; mq < ERROR_TABLE_MAPPING_QUALITIES; ++mq) {
+                Real pmq = 1.0 - exp(phred2ln(mq));
+                for (int bq = 0; bq < ERROR_TABLE_BASE_QUALITIES; ++bq) {
+                    Real qual = (1.0 - exp(phred2ln(bq))) * pmq * scale;
+                    table.at(((w - 1) * ERROR_TABLE_MAPPING_QUALITIES + mq) * ERROR_TABLE_BASE_QUALITIES + bq)
+                        = log(1 - qual);
+                }
+            }
+        }
+    }
+};
+
+ObservationErrorTable observationErrors;
+
+double lnObservationError(int quality, int mapQuality, Real lnquality, Real lnmapQuality, int weight) {
+    if (quality >= 0 && quality < ERROR_TABLE_BASE_QUALITIES
+        && mapQuality >= 0 && mapQuality < ERROR_TABLE_MAPPING_QUALITIES
+        && weight >= 1 && weight <= ERROR_TABLE_WEIGHTS) {
+        return observationErrors.table[((weight - 1) * ERROR_TABLE_MAPPING_QUALITIES + mapQuality)
+                                       * ERROR_TABLE_BASE_QUALITIES + quality];
+    } else {
+        // note that this will underflow if we have mapping quality = 0
+        // we guard against this externally, by ignoring such alignments (quality has to be > MQL0)
+        double scale = (double)1/(double)weight;
+        Real qual = (1.0 - exp(lnquality)) * (1.0 - exp(lnmapQuality)) * scale;
+        return log(1 - qual);
+    }
+}
+
+int ObservationBuffer::indexOf(const string& base) {
+    map<string, int>::iterator i = indexes.find(base);
+    return (i == indexes.end()) ? alleleCount : i->second;
+}
+
+int ObservationBuffer::contextOf(int readGroupIndex, const string& readGroupID, bool isReference, Contamination& estimates) {
+    if (readGroupIndex >= 0 && readGroupIndex < readGroupContaminations.size()
+        && readGroupContaminations.at(readGroupIndex) >= 0) {
+        return 2 * readGroupContaminations.at(readGroupIndex) + (isReference ? 1 : 0);
+    }
+    ContaminationEstimate* estimate
+        = readGroupIndex >= 0 ? &estimates.of(readGroupIndex) : &estimates.of(readGroupID);
+    int c = 0;
+    while (c < contaminations.size() && contaminations.at(c) != estimate) {
+        ++c;
+    }
+    if (c == contaminations.size()) {
+        contaminations.push_back(estimate);
+    }
+    if (readGroupIndex >= 0) {
+        if (readGroupIndex >= readGroupContaminations.size()) {
+            readGroupContaminations.resize(readGroupIndex + 1, -1);
+        }
+        readGroupContaminations.at(readGroupIndex) = c;
+    }
+    return 2 * c + (isReference ? 1 : 0);
+}
+
+// buckets holds the bucket of each allele index and context, or -1
+void ObservationBuffer::addObservations(int a, int c, int n, double error, vector<vector<int> >& buckets) {
+    vector<int>& contexts = buckets.at(a);
+    if (c >= contexts.size()) {
+        contexts.resize(c + 1, -1);
+    }
+    int& b = contexts.at(c);
+    if (b < 0) {
+        b = allele.size();
+        allele.push_back(a);
+        context.push_back(c);
+        count.push_back(0);
+        lnError.push_back(0);
+    }
+    count.at(b) += n;
+    lnError.at(b) += n * error;
+    alleleTotals.at(a) += n;
+}
+
+void ObservationBuffer::build(Sample& sample,
+                              vector<Allele>& genotypeAlleles,
+                              Contamination& estimates,
+                              bool useMapQ,
+                              bool standardGLs) {
+
+    standard = standardGLs;
+    allele.clear();
+    context.clear();
+    count.clear();
+    lnError.clear();
+    partialContext.clear();
+    partialObservations.clear();
+    partialLnError.clear();
+    partialLnScale.clear();
+    partialWeight.clear();
+    partialCount.clear();
+    supportStart.assign(1, 0);
+    supports.clear();
+    contaminations.clear();
+    readGroupContaminations.assign(readGroupContaminations.size(), -1);
+    indexes.clear();
+    alleleCount = genotypeAlleles.size();
+    alleleTotals.assign(alleleCount + 1, 0);
+    tablePloidy = -1;
+
+    for (int i = 0; i < alleleCount; ++i) {
+        indexes.insert(make_pair(genotypeAlleles.at(i).currentBase, i));
+    }
+
+    vector<vector<int> > buckets(alleleCount + 1);
+
+    if (standardGLs) {
+        for (map<string, vector<ObservationBin> >::iterator g = sample.bins.begin(); g != sample.bins.end(); ++g) {
+            int index = indexOf(g->first);
+            vector<ObservationBin>& bins = g->second;
+            for (vector<ObservationBin>::iterator b = bins.begin(); b != bins.end(); ++b) {
+                // take the lesser of mapping quality and base quality (in log space)
+                addObservations(index, 0, b->count,
+                                useMapQ ? max(b->lnquality, b->lnmapQuality) : b->lnquality,
+                                buckets);
+            }
+        }
+        findSingleAllele();
+        return;
+    }
+
+    for (set<string>::iterator c = sample.supportedAlleles.begin();
+         c != sample.supportedAlleles.end(); ++c) {
+        map<string, vector<ObservationBin> >::iterator g = sample.bins.find(*c);
+        if (g == sample.bins.end()) {
+            continue;
+        }
+        int index = indexOf(*c);
+        vector<ObservationBin>& bins = g->second;
+        for (vector<ObservationBin>::iterator b = bins.begin(); b != bins.end(); ++b) {
+            addObservations(index, contextOf(b->readGroupIndex, b->readGroupID, b->isReference, estimates), b->count,
+                            lnObservationError(b->phredQuality, b->mapQuality, b->lnquality, b->lnmapQuality, 1),
+                            buckets);
+        }
+    }
+
+    // a partial observation is counted once for each of the alleles it
+    // supports, with its quality scaled by the number it supports, so we
+    // take it once with that weight
+    vector<int> genotypeIndexes;  // of the sample's partially supported alleles
+    for (vector<string>::iterator a = sample.partiallySupportedAlleles.begin();
+         a != sample.partiallySupportedAlleles.end(); ++a) {
+        genotypeIndexes.push_back(indexOf(*a));
+    }
+    map<pair<vector<int>, pair<int, int> >, int> partialBuckets;
+    vector<int> supportedIndexes;
+    for (int i = 0; i < sample.partialObservations.size(); ++i) {
+        Allele& obs = *sample.partialObservations.at(i);
+        int weight = sample.partialSupportCount(i);
+        double scale = (double)1/(double)weight;
+
+        supportedIndexes.clear();
+        if (indexOf(obs.currentBase) < alleleCount) {
+            supportedIndexes.push_back(indexOf(obs.currentBase));
+        }
+        for (int s = sample.partialSupportStart.at(i); s < sample.partialSupportStart.at(i + 1); ++s) {
+            int index = genotypeIndexes.at(sample.partialSupports.at(s));
+            if (index < alleleCount) {
+                supportedIndexes.push_back(index);
+            }
+        }
+        sort(supportedIndexes.begin(), supportedIndexes.end());
+        supportedIndexes.erase(unique(supportedIndexes.begin(), supportedIndexes.end()), supportedIndexes.end());
+
+        int context = contextOf(obs.readGroupIndex, obs.readGroupID, obs.isReference(), estimates);
+        map<pair<vector<int>, pair<int, int> >, int>::iterator b
+            = partialBuckets.find(make_pair(supportedIndexes, make_pair(context, weight)));
+        int p;
+        if (b == partialBuckets.end()) {
+            p = partialContext.size();
+            partialBuckets[make_pair(supportedIndexes, make_pair(context, weight))] = p;
+            partialContext.push_back(context);
+            partialObservations.push_back(0);
+            partialLnError.push_back(0);
+            partialLnScale.push_back(log(scale));
+            partialWeight.push_back(weight);
+            partialCount.push_back(0);
+            supports.insert(supports.end(), supportedIndexes.begin(), supportedIndexes.end());
+            supportStart.push_back(supports.size());
+        } else {
+            p = b->second;
+        }
+        ++partialObservations.at(p);
+        partialLnError.at(p) += weight * lnObservationError(obs.phredQuality(), obs.mapQuality,
+                                                            obs.lnquality, obs.lnmapQuality, weight);
+        // countOut is an integer, to which each listing adds scale
+        partialCount.at(p) += (weight == 1) ? 1 : 0;
+    }
+
+    findSingleAllele();
+
+}
+
+void ObservationBuffer::findSingleAllele(void) {
+    singleAllele = -1;
+    if (allele.empty() || !partialContext.empty()) {
+        return;
+    }
+    for (int b = 1; b < allele.size(); ++b) {
+        if (allele.at(b) != allele.front()) {
+            return;
+        }
+    }
+    singleAllele = allele.front();
+    singleBase.clear();
+    for (map<string, int>::iterator i = indexes.begin(); i != indexes.end(); ++i) {
+        if (i->second == singleAllele) {
+            singleBase = i->first;
+        }
+    }
+    singleOutOfGenotype = 0;
+    singleCountOut = 0;
+    for (int b = 0; b < allele.size(); ++b) {
+        singleOutOfGenotype += lnError.at(b);
+        singleCountOut += count.at(b);
+    }
+}
+
+void ObservationBuffer::makeTable(int ploidy) {
+
+    int stride = ploidy + 1;
+    int contexts = standard ? 1 : max(1, (int) contaminations.size() * 2);
+    lnSampling.assign(contexts * stride, 0);
+    singleInGenotype.assign(stride, 0);
+    tablePloidy = ploidy;
+    if (standard) {
+        return;
+    }
+
+    for (int c = 0; c < contaminations.size(); ++c) {
+        ContaminationEstimate& contamination = *contaminations.at(c);
+        for (int isReference = 0; isReference < 2; ++isReference) {
+            // the scales are logged once per estimate, when it is read
+            double lnScale = isReference ? contamination.lnRefGivenHetScale : contamination.lnAltGivenHetScale;
+            for (int d = 1; d < ploidy; ++d) {
+                // to deal with polyploids
+                // note that the scale is 0 for diploid heterozygotes without reference bias
+                // this term captures reference bias
+                lnSampling.at((2 * c + isReference) * stride + d) = log((double) d / (double) ploidy) + lnScale;
+            }
+            // scale by frequency of (other) possibly contaminating alleles
+            lnSampling.at((2 * c + isReference) * stride + ploidy) = contamination.lnHomScale;
+        }
+    }
+
+    if (singleAllele >= 0) {
+        for (int d = 1; d <= ploidy; ++d) {
+            for (int b = 0; b < allele.size(); ++b) {
+                singleInGenotype.at(d) += count.at(b) * lnSampling.at(context.at(b) * stride + d);
+            }
+        }
+    }
+
+}
+
+ObservationSums ObservationBuffer::sum(Genotype& genotype) {
+
+    int ploidy = genotype.ploidy;
+    int stride = ploidy + 1;
+    if (ploidy != tablePloidy) {
+        makeTable(ploidy);
+    }
+
+    if (singleAllele >= 0) {
+        int d = 0;
+        if (singleAllele < alleleCount) {
+            for (Genotype::iterator e = genotype.begin(); e != genotype.end(); ++e) {
+                if (e->allele.currentBase == singleBase) {
+                    d = e->count;
+                }
+            }
+        }
+        ObservationSums sums;
+        if (d == 0) {
+            sums.outOfGenotype = singleOutOfGenotype;
+            sums.countOut = singleCountOut;
+        } else {
+            sums.inGenotype = singleInGenotype.at(d);
+        }
+        return sums;
+    }
+
+    // the extra allele stands for the alleles which are not genotype alleles
+    dosage.assign(alleleCount + 1, 0);
+    for (Genotype::iterator e = genotype.begin(); e != genotype.end(); ++e) {
+        int i = indexOf(e->allele.currentBase);
+        if (i < alleleCount) {
+            dosage.at(i) = e->count;
+        }
+    }
+
+    ObservationSums sums;
+    if (!allele.empty()) {
+        double outOfGenotype = 0;
+        double inGenotype = 0;
+        sumObservations(allele.size(), &allele.front(), &context.front(), &count.front(), &lnError.front(),
+                        &dosage.front(), &lnSampling.front(), stride,
+                        outOfGenotype, inGenotype, sums.countOut);
+        sums.outOfGenotype = outOfGenotype;
+        sums.inGenotype = inGenotype;
+    }
+
+    // a partial observation is in the genotype if any allele it supports is,
+    // and is sampled as the most frequent of them
+    for (int p = 0; p < partialContext.size(); ++p) {
+        int d = 0;
+        for (int s = supportStart.at(p); s < supportStart.at(p + 1); ++s) {
+            d = max(d, dosage.at(supports.at(s)));
+        }
+        if (d == 0) {
+            sums.outOfGenotype += partialLnError.at(p);
+            sums.countOut += partialCount.at(p);
+        } else {
+            sums.inGenotype += partialObservations.at(p) * partialWeight.at(p)
+                * (partialLnScale.at(p) + lnSampling.at(partialContext.at(p) * stride + d));
+        }
+    }
+
+    return sums;
+
+}
+
+vector<int> ObservationBuffer::alleleObservationCounts(Genotype& genotype) {
+    vector<int> counts;
+    for (Genotype::iterator e = genotype.begin(); e != genotype.end(); ++e) {
+        int i = indexOf(e->allele.currentBase);
+        counts.push_back(i < alleleCount ? alleleTotals.at(i) : 0);
+    }
+    return counts;
+}
+
+template <class T>
+void appendBytes(string& key, const vector<T>& v) {
+    int n = v.size();
+    key.append((const char*) &n, sizeof(int));
+    if (n) {
+        key.append((const char*) &v.front(), n * sizeof(T));
+    }
+}
+
+void ObservationBuffer::signature(string& key) {
+    // contexts are numbered in the order their read groups are first seen,
+    // so samples with the same observations number them alike
+    vector<double> estimates;
+    for (vector<ContaminationEstimate*>::iterator c = contaminations.begin(); c != contaminations.end(); ++c) {
+        estimates.push_back((*c)->probRefGivenHet);
+        estimates.push_back((*c)->probRefGivenHomAlt);
+    }
+    appendBytes(key, estimates);
+    appendBytes(key, allele);
+    appendBytes(key, context);
+    appendBytes(key, count);
+    appendBytes(key, lnError);
+    appendBytes(key, partialContext);
+    appendBytes(key, partialObservations);
+    appendBytes(key, partialLnError);
+    appendBytes(key, partialWeight);
+    appendBytes(key, supportStart);
+    appendBytes(key, supports);
+}
+
+typedef void (*ObservationKernel)(int n,
+                                  const int* allele,
+                                  const int* context,
+                                  const int* count,
+                                  const double* lnError,
+                                  const int* dosage,
+                                  const double* lnSampling,
+                                  int stride,
+                                  double& outOfGenotype,
+                                  double& inGenotype,
+                                  int& countOut);
+
+void sumObservationsScalar(int n,
+                           const int* allele,
+                           const int* context,
+                           const int* count,
+                           const double* lnError,
+                           const int* dosage,
+                           const double* lnSampling,
+                           int stride,
+                           double& outOfGenotype,
+                           double& inGenotype,
+                           int& countOut) {
+    for (int i = 0; i < n; ++i) {
+        int d = dosage[allele[i]];
+        if (d == 0) {
+            outOfGenotype += lnError[i];
+            countOut += count[i];
+        } else {
+            inGenotype += count[i] * lnSampling[context[i] * stride + d];
+        }
+    }
+}
+
+#ifdef OBSERVATION_KERNELS_X86
+
+__attribute__((target("avx2")))
+void sumObservationsAVX2(int n,
+                         const int* allele,
+                         const int* context,
+                         const int* count,
+                         const double* lnError,
+                         const int* dosage,
+                         const double* lnSampling,
+                         int stride,
+                         double& outOfGenotype,
+                         double& inGenotype,
+                         int& countOut) {
+
+    __m256d out = _mm256_setzero_pd();
+    __m256d in = _mm256_setzero_pd();
+    __m128i counts = _mm_setzero_si128();
+    __m128i zero = _mm_setzero_si128();
+    __m128i strides = _mm_set1_epi32(stride);
+
+    int i = 0;
+    for ( ; i + 4 <= n; i += 4) {
+        __m128i d = _mm_i32gather_epi32(dosage, _mm_loadu_si128((const __m128i*) (allele + i)), 4);
+        __m128i c = _mm_loadu_si128((const __m128i*) (context + i));
+        __m128i k = _mm_loadu_si128((const __m128i*) (count + i));
+        __m256d terms = _mm256_mul_pd(_mm256_cvtepi32_pd(k),
+                                      _mm256_i32gather_pd(lnSampling, _mm_add_epi32(_mm_mullo_epi32(c, strides), d), 8));
+        __m128i isOut = _mm_cmpeq_epi32(d, zero);
+        __m256d outMask = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(isOut));
+        // masking with and, rather than multiplying, keeps infinities out of the other sum
+        out = _mm256_add_pd(out, _mm256_and_pd(outMask, _mm256_loadu_pd(lnError + i)));
+        in = _mm256_add_pd(in, _mm256_andnot_pd(outMask, terms));
+        counts = _mm_add_epi32(counts, _mm_and_si128(isOut, k));
+    }
+
+    double outs[4], ins[4];
+    int countOuts[4];
+    _mm256_storeu_pd(outs, out);
+    _mm256_storeu_pd(ins, in);
+    _mm_storeu_si128((__m128i*) countOuts, counts);
+    for (int j = 0; j < 4; ++j) {
+        outOfGenotype += outs[j];
+        inGenotype += ins[j];
+        countOut += countOuts[j];
+    }
+
+    sumObservationsScalar(n - i, allele + i, context + i, count + i, lnError + i, dosage, lnSampling, stride,
+                          outOfGenotype, inGenotype, countOut);
+
+}
+
+#if __GNUC__ >= 5
+
+__attribute__((target("avx512f")))
+void sumObservationsAVX512(int n,
+                           const int* allele,
+                           const int* context,
+                           const int* count,
+                           const double* lnError,
+                           const int* dosage,
+                           const double* lnSampling,
+                           int stride,
+                           double& outOfGenotype,
+                           double& inGenotype,
+                           int& countOut) {
+
+    __m512d out = _mm512_setzero_pd();
+    __m512d in = _mm512_setzero_pd();
+    __m512i counts = _mm512_setzero_si512();
+    __m512i zero = _mm512_setzero_si512();
+    __m256i strides = _mm256_set1_epi32(stride);
+
+    int i = 0;
+    for ( ; i + 8 <= n; i += 8) {
+        __m256i d = _mm256_i32gather_epi32(dosage, _mm256_loadu_si256((const __m256i*) (allele + i)), 4);
+        __m256i c = _mm256_loadu_si256((const __m256i*) (context + i));
+        __m256i k = _mm256_loadu_si256((const __m256i*) (count + i));
+        __m512d terms = _mm512_mul_pd(_mm512_cvtepi32_pd(k),
+                                      _mm512_i32gather_pd(_mm256_add_epi32(_mm256_mullo_epi32(c, strides), d), lnSampling, 8));
+        __mmask8 isOut = _mm512_cmpeq_epi64_mask(_mm512_cvtepi32_epi64(d), zero);
+        out = _mm512_mask_add_pd(out, isOut, out, _mm512_loadu_pd(lnError + i));
+        in = _mm512_mask_add_pd(in, (__mmask8) ~isOut, in, terms);
+        counts = _mm512_mask_add_epi64(counts, isOut, counts, _mm512_cvtepi32_epi64(k));
+    }
+
+    outOfGenotype += _mm512_reduce_add_pd(out);
+    inGenotype += _mm512_reduce_add_pd(in);
+    countOut += _mm512_reduce_add_epi64(counts);
+
+    sumObservationsScalar(n - i, allele + i, context + i, count + i, lnError + i, dosage, lnSampling, stride,
+                          outOfGenotype, inGenotype, countOut);
+
+}
+
+#endif
+
+#endif
+
+// the vector kernels add the terms in a different order than the scalar one,
+// so the likelihoods they give can differ in their last bits.  setting
+// FREEBAYES_OBSERVATION_KERNEL=scalar in the environment uses the scalar
+// kernel everywhere, for output which is the same on every machine.
+ObservationKernel chooseObservationKernel(void) {
+    const char* forced = getenv("FREEBAYES_OBSERVATION_KERNEL");
+    if (forced && string(forced) == "scalar") {
+        return sumObservationsScalar;
+    }
+#ifdef OBSERVATION_KERNELS_X86
+    __builtin_cpu_init();
+#if __GNUC__ >= 5
+    if (__builtin_cpu_supports("avx512f")) {
+        return sumObservationsAVX512;
+    }
+#endif
+    if (__builtin_cpu_supports("avx2")) {
+        return sumObservationsAVX2;
+    }
+#endif
+    return sumObservationsScalar;
+}
+
+ObservationKernel observationKernel = chooseObservationKernel();
+
+void sumObservations(int n,
+                     const int* allele,
+                     const int* context,
+                     const int* count,
+                     const double* lnError,
+                     const int* dosage,
+                     const double* lnSampling,
+                     int stride,
+                     double& outOfGenotype,
+                     double& inGenotype,
+                     int& countOut) {
+    observationKernel(n, allele, context, count, lnError, dosage, lnSampling, stride,
+                      outOfGenotype, inGenotype, countOut);
+}
@@ -0,0 +1,141 @@
+#ifndef OBSERVATIONBUFFER_H
+#define OBSERVATIONBUFFER_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include "Allele.h"
+#include "Sample.h"
+#include "Genotype.h"
+#include "Contamination.h"
+
+using namespace std;
+
+// the ranges of phred base and mapping quality, and of the number of alleles
+// a partial observation supports, for which the log error probabilities of
+// observations are tabulated.  others are computed as they are needed.
+#define ERROR_TABLE_BASE_QUALITIES 94
+#define ERROR_TABLE_MAPPING_QUALITIES 256
+#define ERROR_TABLE_WEIGHTS 4
+
+// the sums over the observations of a sample which make up the likelihood
+// of one genotype
+class ObservationSums {
+public:
+    Real outOfGenotype;  // of the log error probabilities of observations not in the genotype
+    Real inGenotype;     // of the log sampling probabilities of the others
+    int countOut;
+    ObservationSums(void) : outOfGenotype(0), inGenotype(0), countOut(0) { }
+};
+
+// the observations of a sample at a site, reduced in one pass over its
+// observation bins to the statistics the likelihood of any genotype of the
+// genotype alleles needs, and held in contiguous arrays (one per field) so
+// they can be combined with a genotype by a vectorized scan
+//
+// the likelihood of a genotype depends on an observation only through the
+// index of its allele among the genotype alleles, its log error probability,
+// and its context, which selects the contamination estimate of its read
+// group and whether it is of the reference.  so the observations are
+// bucketed by allele and context, and each bucket keeps its count and the
+// sum of its log error probabilities.  a genotype is then scored from the
+// number of copies of each allele it has (its dosage) and a small table of
+// log sampling probabilities by context and dosage, at a cost which depends
+// on the number of alleles and not on depth or the number of genotypes.
+class ObservationBuffer {
+
+public:
+
+    // buckets the observations of sample which bear on genotypes of
+    // genotypeAlleles, as the standard or the default data likelihoods use them
+    void build(Sample& sample,
+               vector<Allele>& genotypeAlleles,
+               Contamination& contaminations,
+               bool useMapQ,
+               bool standardGLs);
+
+    // the sums for genotype, which must be of the genotype alleles
+    ObservationSums sum(Genotype& genotype);
+
+    // the number of full observations of each allele of genotype, in order
+    vector<int> alleleObservationCounts(Genotype& genotype);
+
+    // appends to key a canonical encoding of the buckets and the
+    // contamination estimates of their contexts, which is the same for two
+    // samples exactly when their likelihoods are the same for every genotype
+    void signature(string& key);
+
+private:
+
+    // buckets of fully-observed alleles
+    vector<int> allele;       // index in the genotype alleles, or alleleCount if it is not one
+    vector<int> context;      // 2 * contamination index + 1 if of the reference
+    vector<int> count;
+    vector<double> lnError;   // summed over the bucket
+
+    // buckets of partial observations, which may support several alleles,
+    // by supported alleles, context and weight
+    vector<int> partialContext;
+    vector<int> partialObservations;
+    vector<double> partialLnError;  // summed over the bucket, and weighted
+    vector<double> partialLnScale;
+    vector<double> partialWeight;   // the number of times each observation is counted
+    vector<int> partialCount;       // their contribution to countOut
+    vector<int> supportStart;       // into supports, with one extra entry at the end
+    vector<int> supports;           // genotype allele indexes
+
+    vector<ContaminationEstimate*> contaminations;
+    vector<int> readGroupContaminations;  // index in contaminations by read group id, or -1
+    map<string, int> indexes;       // of the genotype alleles, by base
+    int alleleCount;
+    vector<int> alleleTotals;       // full observations by allele index
+    bool standard;
+
+    // log sampling probabilities for genotypes of tablePloidy
+    vector<double> lnSampling;
+    int tablePloidy;
+
+    // when every observation is of one allele, as at most sites for most
+    // samples, the sums for a genotype depend only on its dosage of that
+    // allele, and are tabulated by dosage with the sampling probabilities
+    int singleAllele;         // its index, or -1 if the observations are not all of one allele
+    string singleBase;
+    double singleOutOfGenotype;
+    int singleCountOut;
+    vector<double> singleInGenotype;  // by dosage
+
+    // scratch space for sum
+    vector<int> dosage;
+
+    int indexOf(const string& base);
+    int contextOf(int readGroupIndex, const string& readGroupID, bool isReference, Contamination& estimates);
+    void addObservations(int a, int c, int n, double error, vector<vector<int> >& buckets);
+    void makeTable(int ploidy);
+    void findSingleAllele(void);
+
+};
+
+// the log probability that an observation of the given qualities, counted
+// weight times, is in error, looked up in a table built at startup when the
+// qualities are in its range.  quality is the phred base quality, or -1 if
+// lnquality is not of one.
+double lnObservationError(int quality, int mapQuality, Real lnquality, Real lnmapQuality, int weight);
+
+// sums the contributions of n buckets of fully-observed alleles to the
+// likelihood of a genotype which has dosage[a] copies of allele a, where
+// lnSampling[c * stride + d] is the log sampling probability of an
+// observation in context c of an allele with d copies.  the fastest
+// implementation the processor supports is chosen at startup.
+void sumObservations(int n,
+                     const int* allele,
+                     const int* context,
+                     const int* count,
+                     const double* lnError,
+                     const int* dosage,
+                     const double* lnSampling,
+                     int stride,
+                     double& outOfGenotype,
+                     double& inGenotype,
+                     int& countOut);
+
+#endif
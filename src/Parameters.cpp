@@ -153,6 +153,68 @@ void Parameters::usage(char** argv) {
         << "                   considered alleles, even those which are not in called genotypes." << endl
         << "                   Loci which do not have any potential alternates have '.' for ALT." << endl
         << endl
+        << "parallel operation:" << endl
+        << endl
+        << "   --threads N     Call variants using N threads.  The targets (or every" << endl
+        << "                   sequence in the reference, if no targets are given) are" << endl
+        << "                   split into shards which are processed independently, and" << endl
+        << "                   results are merged in shard order into a single VCF.  When" << endl
+        << "                   a thread runs out of shards, it takes over half of what" << endl
+        << "                   remains of the slowest one still being processed.  This" << endl
+        << "                   replaces the need for scripts/freebayes-parallel.  Not" << endl
+        << "                   compatible with --stdin or --trace.  default: 1" << endl
+        << "   --pipeline      Decode alignments, build pileups, genotype, and write" << endl
+        << "                   output on separate threads, passing work between them" << endl
+        << "                   through bounded queues.  Speeds up calling in a single" << endl
+        << "                   region without splitting it.  Output is identical to" << endl
+        << "                   serial operation.  Not compatible with --trace." << endl
+        << "   --genotyping-threads N" << endl
+        << "                   Calculate the genotype likelihoods of different samples," << endl
+        << "                   and search the genotypings of different --populations," << endl
+        << "                   at each site using N threads.  Useful for large cohorts." << endl
+        << "                   Combined with --threads, each calling thread uses N" << endl
+        << "                   genotyping threads.  default: 1" << endl
+        << "   --region-margin N" << endl
+        << "                   Treat the ends of targets and regions as soft: read" << endl
+        << "                   alignments up to N bp beyond them, and report only the" << endl
+        << "                   sites which start within them.  Calling a series of" << endl
+        << "                   adjacent regions this way gives the same output as" << endl
+        << "                   calling them in one run, so the results of" << endl
+        << "                   scripts/freebayes-parallel need no deduplication.  The" << endl
+        << "                   shards made by --threads always have soft ends, with a" << endl
+        << "                   margin of 1000 unless this is given.  default: 0" << endl
+        << "   --shard-length N" << endl
+        << "                   The length of the shards made by --threads.  default:" << endl
+        << "                   1000000" << endl
+        << "   --min-split-length N" << endl
+        << "                   Don't split a shard for an idle thread if less than N bp" << endl
+        << "                   of it remain to be processed.  default: 10000" << endl
+        << "   --checkpoint FILE" << endl
+        << "                   Record progress in FILE every minute.  If the run is" << endl
+        << "                   interrupted, running the same command again discards" << endl
+        << "                   any output written after the last checkpoint and" << endl
+        << "                   continues from there, giving the same output as an" << endl
+        << "                   uninterrupted run.  FILE is removed when the run is" << endl
+        << "                   complete.  Requires --vcf." << endl
+        << "   --output-bgzf" << endl
+        << "                   Write the output compressed with BGZF, as by bgzip.  If" << endl
+        << "                   --vcf is given, a tabix index (FILE.tbi) is written" << endl
+        << "                   alongside it.  Compression happens on a writer thread," << endl
+        << "                   using as many threads as --threads, so that it does not" << endl
+        << "                   slow calling.  Not compatible with --checkpoint." << endl
+        << "   --plan-regions N" << endl
+        << "                   Instead of calling variants, print N regions of the" << endl
+        << "                   targets (or of every sequence) which contain similar" << endl
+        << "                   amounts of alignment data, one per line, in the form" << endl
+        << "                   used by --region and scripts/freebayes-parallel.  The" << endl
+        << "                   amounts are estimated from the BAM indexes, which is" << endl
+        << "                   much faster than a coverage pass.  A region which" << endl
+        << "                   spans sequences is printed as one line per sequence." << endl
+        << "   --plan-region-slack F" << endl
+        << "                   Let region boundaries move by up to F times the data in" << endl
+        << "                   a region, to where the coverage is lowest, so that loci" << endl
+        << "                   are not split between regions.  default: 0.1" << endl
+        << endl
         << "reporting:" << endl
         << endl
         << "   -P --pvar N     Report sites if the probability that there is a polymorphism" << endl
@@ -381,6 +443,18 @@ Parameters::Parameters(int argc, char** argv) {
     failedFile = "";
     alleleObservationBiasFile = "";
 
+    // parallel operation
+    threads = 1;                 // --threads
+    pipeline = false;            // --pipeline
+    genotypingThreads = 1;       // --genotyping-threads
+    regionMargin = 0;            // --region-margin
+    shardLength = 1000000;       // --shard-length
+    minSplitLength = 10000;      // --min-split-length
+    checkpointFile = "";         // --checkpoint
+    outputBgzf = false;          // --output-bgzf
+    planRegions = 0;             // --plan-regions
+    planRegionSlack = 0.1;       // --plan-region-slack
+
     // operation parameters
     outputAlleles = false;          //
     trace = false;                  // -L --trace
@@ -540,6 +614,16 @@ Parameters::Parameters(int argc, char** argv) {
             {"prob-contamination", required_argument, 0, '_'},
             {"contamination-estimates", required_argument, 0, ','},
             {"report-monomorphic", no_argument, 0, '6'},
+            {"threads", required_argument, 0, '{'},
+            {"pipeline", no_argument, 0, '}'},
+            {"genotyping-threads", required_argument, 0, ']'},
+            {"region-margin", required_argument, 0, '*'},
+            {"shard-length", required_argument, 0, '|'},
+            {"min-split-length", required_argument, 0, '`'},
+            {"checkpoint", required_argument, 0, '<'},
+            {"output-bgzf", no_argument, 0, '>'},
+            {"plan-regions", required_argument, 0, '+'},
+            {"plan-region-slack", required_argument, 0, '~'},
             {"debug", no_argument, 0, 'd'},
             {0, 0, 0, 0}
 
@@ -1010,6 +1094,77 @@ Parameters::Parameters(int argc, char** argv) {
             }
             break;
 
+            // --threads
+        case '{':
+            if (!convert(optarg, threads) || threads < 1) {
+                cerr << "could not parse threads" << endl;
+                exit(1);
+            }
+            break;
+
+            // --pipeline
+        case '}':
+            pipeline = true;
+            break;
+
+            // --genotyping-threads
+        case ']':
+            if (!convert(optarg, genotypingThreads) || genotypingThreads < 1) {
+                cerr << "could not parse genotyping-threads" << endl;
+                exit(1);
+            }
+            break;
+
+            // --region-margin
+        case '*':
+            if (!convert(optarg, regionMargin) || regionMargin < 0) {
+                cerr << "could not parse region-margin" << endl;
+                exit(1);
+            }
+            break;
+
+            // --shard-length
+        case '|':
+            if (!convert(optarg, shardLength) || shardLength < 1) {
+                cerr << "could not parse shard-length" << endl;
+                exit(1);
+            }
+            break;
+
+            // --min-split-length
+        case '`':
+            if (!convert(optarg, minSplitLength) || minSplitLength < 1) {
+                cerr << "could not parse min-split-length" << endl;
+                exit(1);
+            }
+            break;
+
+            // --checkpoint
+        case '<':
+            checkpointFile = optarg;
+            break;
+
+            // --output-bgzf
+        case '>':
+            outputBgzf = true;
+            break;
+
+            // --plan-regions
+        case '+':
+            if (!convert(optarg, planRegions) || planRegions < 1) {
+                cerr << "could not parse plan-regions" << endl;
+                exit(1);
+            }
+            break;
+
+            // --plan-region-slack
+        case '~':
+            if (!convert(optarg, planRegionSlack) || planRegionSlack < 0) {
+                cerr << "could not parse plan-region-slack" << endl;
+                exit(1);
+            }
+            break;
+
             // -d --debug
         case 'd':
             ++debuglevel;
@@ -1081,4 +1236,34 @@ Parameters::Parameters(int argc, char** argv) {
         exit(1);
     }
 
+    if (threads > 1 && useStdin) {
+        cerr << "--threads requires indexed BAM input, and cannot be used with --stdin." << endl;
+        exit(1);
+    }
+
+    if (threads > 1 && trace) {
+        cerr << "--trace cannot be used with --threads." << endl;
+        exit(1);
+    }
+
+    if (!checkpointFile.empty() && (outputFile.empty() || useStdin)) {
+        cerr << "--checkpoint requires output to a file (--vcf) and indexed BAM input." << endl;
+        exit(1);
+    }
+
+    if (outputBgzf && !checkpointFile.empty()) {
+        cerr << "--output-bgzf cannot be used with --checkpoint." << endl;
+        exit(1);
+    }
+
+    if (planRegions && useStdin) {
+        cerr << "--plan-regions requires indexed BAM input, and cannot be used with --stdin." << endl;
+        exit(1);
+    }
+
+    if (pipeline && trace) {
+        cerr << "--trace cannot be used with --pipeline." << endl;
+        exit(1);
+    }
+
 }
@@ -49,6 +49,18 @@ public:
     double probContamination;
     string contaminationEstimateFile;
 
+    // parallel operation
+    int threads;                 // --threads
+    bool pipeline;               // --pipeline
+    int genotypingThreads;       // --genotyping-threads
+    long int regionMargin;       // --region-margin
+    long int shardLength;        // --shard-length
+    long int minSplitLength;     // --min-split-length
+    string checkpointFile;       // --checkpoint
+    bool outputBgzf;             // --output-bgzf
+    int planRegions;             // --plan-regions
+    double planRegionSlack;      // --plan-region-slack
+
     // operation parameters
     bool outputAlleles;          //  unused...
     bool trace;                  // -L --trace
@@ -102,14 +114,14 @@ public:
     int readSnpLimit;            // -$ --read-snp-limit
     int readIndelLimit;          // -e --read-indel-limit
     int IDW;                     // -I --indel-exclusion-window
-    long double TH;              // -T --theta
-    long double PVL;             // -P --pvar
+    Real TH;              // -T --theta
+    Real PVL;             // -P --pvar
                                  // -K --posterior-integration-depth
     int posteriorIntegrationDepth;
     bool calculateMarginals;
     string algorithm;
     double RDF;             // -D --read-dependence-factor
-    long double diffusionPriorScalar; // -V --diffusion-prior-scalar
+    Real diffusionPriorScalar; // -V --diffusion-prior-scalar
     int WB;                      // -W --posterior-integration-bandwidth
     // XXX adjusting this to anything other than 1 may have bad consequences
     // for large numbers of samples
@@ -117,7 +129,7 @@ public:
     bool includeMonoB;
     int TR;
     int I;
-    long double minAltFraction;  // -F --min-alternate-fraction
+    Real minAltFraction;  // -F --min-alternate-fraction
     int minAltCount;             // -C --min-alternate-count
     int minAltTotal;             // -G --min-alternate-total
     int minCoverage;             // -! --min-coverage
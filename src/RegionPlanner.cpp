@@ -0,0 +1,217 @@
+#include "RegionPlanner.h"
+#include <algorithm>
+
+// the pseudo-bin in which samtools records the extent of each sequence's data
+#define BAM_METADATA_BIN 37450
+
+// BAM indexes are little-endian, as are the hosts we build on
+template <class T>
+bool readValue(istream& in, T& value) {
+    return !in.read(reinterpret_cast<char*>(&value), sizeof(T)).fail();
+}
+
+RegionPlanner::RegionPlanner(vector<string>& sequenceNames)
+    : sequences(sequenceNames)
+    , volumes(sequenceNames.size())
+{
+    for (int i = 0; i < sequences.size(); ++i) {
+        sequenceIDs[sequences.at(i)] = i;
+    }
+}
+
+bool RegionPlanner::addBam(const string& bamFile) {
+    if (readIndex(bamFile + ".bai")) {
+        return true;
+    }
+    // also try foo.bai for foo.bam
+    if (bamFile.size() > 4 && bamFile.substr(bamFile.size() - 4) == ".bam") {
+        return readIndex(bamFile.substr(0, bamFile.size() - 4) + ".bai");
+    }
+    return false;
+}
+
+bool RegionPlanner::readIndex(const string& indexFile) {
+
+    ifstream in(indexFile.c_str(), ios::in | ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+
+    char magic[4];
+    if (!in.read(magic, 4) || string(magic, 4) != string("BAI\1", 4)) {
+        cerr << indexFile << " is not a BAM index" << endl;
+        return false;
+    }
+
+    int32_t referenceCount;
+    if (!readValue(in, referenceCount) || referenceCount != sequences.size()) {
+        cerr << indexFile << " does not match the sequences of the BAM header" << endl;
+        return false;
+    }
+
+    for (int r = 0; r < referenceCount; ++r) {
+
+        // the end of the last chunk is where the sequence's data ends
+        uint64_t dataEnd = 0;
+        int32_t binCount;
+        if (!readValue(in, binCount)) return false;
+        for (int b = 0; b < binCount; ++b) {
+            uint32_t bin;
+            int32_t chunkCount;
+            if (!readValue(in, bin) || !readValue(in, chunkCount)) return false;
+            for (int c = 0; c < chunkCount; ++c) {
+                uint64_t chunkStart, chunkEnd;
+                if (!readValue(in, chunkStart) || !readValue(in, chunkEnd)) return false;
+                if (bin != BAM_METADATA_BIN) {
+                    dataEnd = max(dataEnd, chunkEnd);
+                }
+            }
+        }
+
+        int32_t windowCount;
+        if (!readValue(in, windowCount)) return false;
+        vector<uint64_t> offsets(windowCount);
+        for (int w = 0; w < windowCount; ++w) {
+            if (!readValue(in, offsets.at(w))) return false;
+        }
+
+        // the data in each window runs from its offset up to the offset of
+        // the next window with data.  windows without data have no offset.
+        // we use only the compressed part of the virtual file offsets, so our
+        // resolution is one BGZF block, which is plenty for our purposes.
+        vector<double>& volume = volumes.at(r);
+        if (volume.size() < windowCount) {
+            volume.resize(windowCount, 0);
+        }
+        uint64_t next = dataEnd;
+        for (int w = windowCount - 1; w >= 0; --w) {
+            uint64_t offset = offsets.at(w);
+            if (offset == 0) {
+                continue;
+            }
+            if (next > offset) {
+                volume.at(w) += (next >> 16) - (offset >> 16);
+            }
+            next = offset;
+        }
+
+    }
+
+    return true;
+
+}
+
+// a piece of a target in a single index window
+class PlanUnit {
+public:
+    BedTarget range;
+    double volume;
+    PlanUnit(BedTarget& r, double v) : range(r), volume(v) { }
+};
+
+// the data on either side of a cut before unit i, or none if the cut falls
+// between targets anyway
+double cutCost(vector<PlanUnit>& units, int i) {
+    BedTarget& before = units.at(i - 1).range;
+    BedTarget& after = units.at(i).range;
+    if (before.seq != after.seq || before.right + 1 != after.left) {
+        return 0;
+    }
+    return units.at(i - 1).volume + units.at(i).volume;
+}
+
+vector<vector<BedTarget> > RegionPlanner::plan(vector<BedTarget>& targets, int n, double slack) {
+
+    vector<PlanUnit> units;
+    for (vector<BedTarget>::iterator t = targets.begin(); t != targets.end(); ++t) {
+        map<string, int>::iterator id = sequenceIDs.find(t->seq);
+        for (long int w = t->left / BAM_INDEX_WINDOW; w <= t->right / BAM_INDEX_WINDOW; ++w) {
+            BedTarget range(t->seq,
+                            max((long int) t->left, w * BAM_INDEX_WINDOW),
+                            min((long int) t->right, (w + 1) * BAM_INDEX_WINDOW - 1));
+            double volume = 0;
+            if (id != sequenceIDs.end() && w < volumes.at(id->second).size()) {
+                volume = volumes.at(id->second).at(w)
+                    * (range.right - range.left + 1) / BAM_INDEX_WINDOW;
+            }
+            units.push_back(PlanUnit(range, volume));
+        }
+    }
+
+    // without any data, balance by length
+    double total = 0;
+    for (vector<PlanUnit>::iterator u = units.begin(); u != units.end(); ++u) {
+        total += u->volume;
+    }
+    if (total == 0) {
+        for (vector<PlanUnit>::iterator u = units.begin(); u != units.end(); ++u) {
+            u->volume = u->range.right - u->range.left + 1;
+            total += u->volume;
+        }
+    }
+
+    // preceding[i] is the volume of the units before unit i
+    vector<double> preceding(units.size() + 1, 0);
+    for (int i = 0; i < units.size(); ++i) {
+        preceding.at(i + 1) = preceding.at(i) + units.at(i).volume;
+    }
+
+    // cuts[k] is the first unit of region k
+    double share = total / n;
+    vector<int> cuts;
+    cuts.push_back(0);
+    for (int k = 1; k < n; ++k) {
+        double ideal = k * share;
+        int first = cuts.back() + 1;
+        // the closest cut to the ideal
+        int best = lower_bound(preceding.begin() + first, preceding.end() - 1, ideal) - preceding.begin();
+        if (best >= units.size()) {
+            break; // fewer units than regions
+        }
+        if (best > first && ideal - preceding.at(best - 1) < preceding.at(best) - ideal) {
+            --best;
+        }
+        // look around it for the cut with the least data on either side
+        int closest = best;
+        double bestCost = cutCost(units, best);
+        for (int i = closest - 1; i >= first && ideal - preceding.at(i) <= slack * share; --i) {
+            double cost = cutCost(units, i);
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = i;
+            }
+        }
+        for (int i = closest + 1; i < units.size() && preceding.at(i) - ideal <= slack * share; ++i) {
+            double cost = cutCost(units, i);
+            if (cost < bestCost
+                || (cost == bestCost && preceding.at(i) - ideal < ideal - preceding.at(best))) {
+                bestCost = cost;
+                best = i;
+            }
+        }
+        cuts.push_back(best);
+    }
+    cuts.push_back(units.size());
+
+    // join the units of each region into contiguous ranges
+    vector<vector<BedTarget> > regions;
+    for (int k = 0; k + 1 < cuts.size(); ++k) {
+        vector<BedTarget> region;
+        for (int i = cuts.at(k); i < cuts.at(k + 1); ++i) {
+            BedTarget& range = units.at(i).range;
+            if (!region.empty()
+                && region.back().seq == range.seq
+                && region.back().right + 1 == range.left) {
+                region.back().right = range.right;
+            } else {
+                region.push_back(range);
+            }
+        }
+        if (!region.empty()) {
+            regions.push_back(region);
+        }
+    }
+
+    return regions;
+
+}
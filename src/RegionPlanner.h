@@ -0,0 +1,55 @@
+#ifndef REGIONPLANNER_H
+#define REGIONPLANNER_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include "BedReader.h"
+
+using namespace std;
+
+// the size of the windows of the BAM linear index
+#define BAM_INDEX_WINDOW 16384
+
+// splits targets into regions which contain similar amounts of alignment
+// data, as estimated from the BAM indexes rather than by reading alignments
+//
+// the linear index of a BAM file records the file offset of the first
+// alignment overlapping each 16kb window, so the number of compressed bytes
+// between the offsets of consecutive windows approximates the amount of data
+// in the window.  we sum these estimates across the input files.
+class RegionPlanner {
+
+public:
+
+    // sequenceNames are the reference sequences of the BAM files, in the
+    // order of their headers (which is the order of the index)
+    RegionPlanner(vector<string>& sequenceNames);
+
+    // adds the data volume estimates from the index of the BAM file
+    // returns false if no index could be read
+    bool addBam(const string& bamFile);
+
+    // splits the targets into n regions of similar volume
+    // each boundary may be moved, by up to slack times the volume of a
+    // region, to the point where the least data is on either side of it, so
+    // that boundaries tend to fall in gaps in coverage rather than in the
+    // middle of loci
+    // regions are returned in target order, as lists of 0-based inclusive
+    // ranges (a region which crosses the end of a sequence has several)
+    vector<vector<BedTarget> > plan(vector<BedTarget>& targets, int n, double slack);
+
+private:
+
+    bool readIndex(const string& indexFile);
+
+    vector<string> sequences;
+    map<string, int> sequenceIDs;
+    vector<vector<double> > volumes; // compressed bytes, by sequence then window
+
+};
+
+#endif
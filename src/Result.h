@@ -15,10 +15,12 @@ public:
 
     string name;
     Sample* observations;
+    // sampleObservationCounters, to which the data likelihoods point
+    vector<AlleleCounter> observationCounters;
 
     void sortDataLikelihoods(void);
 
-    //pair<Genotype*, long double> bestMarginalGenotype(void);
+    //pair<Genotype*, Real> bestMarginalGenotype(void);
 
 };
 
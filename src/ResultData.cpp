@@ -8,8 +8,8 @@ using namespace std;
 vcf::Variant& Results::vcf(
     vcf::Variant& var, // variant to update
     BigFloat pHom,
-    long double bestComboOddsRatio,
-    //long double alleleSamplingProb,
+    Real bestComboOddsRatio,
+    //Real alleleSamplingProb,
     Samples& samples,
     string refbase,
     vector<Allele>& altAllelesIncludingNulls,
@@ -23,16 +23,14 @@ vcf::Variant& Results::vcf(
     map<Allele*, set<Allele*> >& partialObservationSupport,
     map<int, vector<Genotype> >& genotypesByPloidy,
     vector<string>& sequencingTechnologies,
-    AlleleParser* parser) {
-
-    Parameters& parameters = parser->parameters;
+    string& sequenceName,
+    long int referencePosition,
+    map<string, int>& homopolymerRuns,
+    Parameters& parameters) {
 
     GenotypeComboMap comboMap;
     genotypeCombo2Map(genotypeCombo, comboMap);
 
-    // set up the reported reference allele
-    long int referencePosition = (long int) parser->currentPosition; // 0-based
-
     // remove NULL alt alleles
     vector<Allele> altAlleles;
     for (vector<Allele>::iterator aa = altAllelesIncludingNulls.begin(); aa != altAllelesIncludingNulls.end(); ++aa) {
@@ -57,13 +55,13 @@ vcf::Variant& Results::vcf(
 
     // set up VCF record-wide variables
 
-    var.sequenceName = parser->currentSequenceName;
+    var.sequenceName = sequenceName;
     var.position = referencePosition + 1;
     var.id = ".";
     var.filter = ".";
 
     // note that we set QUAL to 0 at loci with no data
-    var.quality = max((long double) 0, nan2zero(big2phred(pHom)));
+    var.quality = max((Real) 0, nan2zero(big2phred(pHom)));
     if (coverage == 0) {
         var.quality = 0;
     }
@@ -90,10 +88,10 @@ vcf::Variant& Results::vcf(
     unsigned int refEndRight = 0;
     unsigned int refmqsum = 0;
     unsigned int refProperPairs = 0;
-    long double refReadMismatchSum = 0;
-    long double refReadSNPSum = 0;
-    long double refReadIndelSum = 0;
-    long double refReadSoftClipSum = 0;
+    Real refReadMismatchSum = 0;
+    Real refReadSNPSum = 0;
+    Real refReadIndelSum = 0;
+    Real refReadSoftClipSum = 0;
     unsigned int refObsCount = 0;
     map<string, int> refObsBySequencingTechnology;
 
@@ -133,9 +131,9 @@ vcf::Variant& Results::vcf(
         }
     }
 
-    long double refReadMismatchRate = (refObsCount == 0 ? 0 : refReadMismatchSum / (long double) refObsCount);
-    long double refReadSNPRate = (refObsCount == 0 ? 0 : refReadSNPSum / (long double) refObsCount);
-    long double refReadIndelRate = (refObsCount == 0 ? 0 : refReadIndelSum / (long double) refObsCount);
+    Real refReadMismatchRate = (refObsCount == 0 ? 0 : refReadMismatchSum / (Real) refObsCount);
+    Real refReadSNPRate = (refObsCount == 0 ? 0 : refReadSNPSum / (Real) refObsCount);
+    Real refReadIndelRate = (refObsCount == 0 ? 0 : refReadIndelSum / (Real) refObsCount);
 
     //var.info["XRM"].push_back(convert(refReadMismatchRate));
     //var.info["XRS"].push_back(convert(refReadSNPRate));
@@ -248,9 +246,9 @@ vcf::Variant& Results::vcf(
         unsigned int altEndRight = 0;
         unsigned int altmqsum = 0;
         unsigned int altproperPairs = 0;
-        long double altReadMismatchSum = 0;
-        long double altReadSNPSum = 0;
-        long double altReadIndelSum = 0;
+        Real altReadMismatchSum = 0;
+        Real altReadSNPSum = 0;
+        Real altReadIndelSum = 0;
         unsigned int altObsCount = 0;
         map<string, int> altObsBySequencingTechnology;
 
@@ -293,9 +291,9 @@ vcf::Variant& Results::vcf(
             }
         }
 
-        long double altReadMismatchRate = (altObsCount == 0 ? 0 : altReadMismatchSum / altObsCount);
-        long double altReadSNPRate = (altObsCount == 0 ? 0 : altReadSNPSum / altObsCount);
-        long double altReadIndelRate = (altObsCount == 0 ? 0 : altReadIndelSum / altObsCount);
+        Real altReadMismatchRate = (altObsCount == 0 ? 0 : altReadMismatchSum / altObsCount);
+        Real altReadSNPRate = (altObsCount == 0 ? 0 : altReadSNPSum / altObsCount);
+        Real altReadIndelRate = (altObsCount == 0 ? 0 : altReadIndelSum / altObsCount);
         
         //var.info["XAM"].push_back(convert(altReadMismatchRate));
         //var.info["XAS"].push_back(convert(altReadSNPRate));
@@ -339,7 +337,7 @@ vcf::Variant& Results::vcf(
         var.info["SAP"].push_back(convert((altObsCount == 0) ? 0 : nan2zero(ln2phred(hoeffdingln(baseCountsTotal.forwardAlt, altObsCount, 0.5)))));
         var.info["AB"].push_back(convert((hetAllObsCount == 0) ? 0 : nan2zero((double) hetAlternateObsCount / (double) hetAllObsCount )));
         var.info["ABP"].push_back(convert((hetAllObsCount == 0) ? 0 : nan2zero(ln2phred(hoeffdingln(hetAlternateObsCount, hetAllObsCount, 0.5)))));
-        var.info["RUN"].push_back(convert(parser->homopolymerRunLeft(altbase) + 1 + parser->homopolymerRunRight(altbase)));
+        var.info["RUN"].push_back(convert(homopolymerRuns[altbase]));
         var.info["MQM"].push_back(convert((altObsCount == 0) ? 0 : nan2zero((double) altmqsum / (double) altObsCount)));
         var.info["RPP"].push_back(convert((altObsCount == 0) ? 0 : nan2zero(ln2phred(hoeffdingln(altReadsLeft, altReadsRight + altReadsLeft, 0.5)))));
         var.info["RPR"].push_back(convert(altReadsRight));
@@ -595,11 +593,11 @@ vcf::Variant& Results::vcf(
                     }
 
                     // normalize GLs to 0 max using division by max
-                    long double minGL = 0;
+                    Real minGL = 0;
                     for (map<int, double>::iterator g = genotypeLikelihoods.begin(); g != genotypeLikelihoods.end(); ++g) {
                         if (g->second < minGL) minGL = g->second;
                     }
-                    long double maxGL = minGL;
+                    Real maxGL = minGL;
                     for (map<int, double>::iterator g = genotypeLikelihoods.begin(); g != genotypeLikelihoods.end(); ++g) {
                         if (g->second > maxGL) maxGL = g->second;
                     }
@@ -610,7 +608,7 @@ vcf::Variant& Results::vcf(
                         }
                     } else {
                         for (map<int, double>::iterator g = genotypeLikelihoods.begin(); g != genotypeLikelihoods.end(); ++g) {
-                            genotypeLikelihoodsOutput[g->first] = convert( max((long double) + parameters.limitGL, (g->second-maxGL)) );
+                            genotypeLikelihoodsOutput[g->first] = convert( max((Real) + parameters.limitGL, (g->second-maxGL)) );
                         }
                     }
 
@@ -17,8 +17,8 @@ using namespace std;
 // for sorting data likelihoods
 class DataLikelihoodCompare {
 public:
-    bool operator()(const pair<Genotype*, long double>& a,
-            const pair<Genotype*, long double>& b) {
+    bool operator()(const pair<Genotype*, Real>& a,
+            const pair<Genotype*, Real>& b) {
         return a.second > b.second;
     }
 };
@@ -43,8 +43,8 @@ public:
     vcf::Variant& vcf(
         vcf::Variant& var, // variant to update
         BigFloat pHom,
-        long double bestComboOddsRatio,
-        //long double alleleSamplingProb,
+        Real bestComboOddsRatio,
+        //Real alleleSamplingProb,
         Samples& samples,
         string refbase,
         vector<Allele>& altAlleles,
@@ -58,7 +58,10 @@ public:
         map<Allele*, set<Allele*> >& partialSupport,
         map<int, vector<Genotype> >& genotypesByPloidy,
         vector<string>& sequencingTechnologies,
-        AlleleParser* parser);
+        string& sequenceName,
+        long int referencePosition, // 0-based
+        map<string, int>& homopolymerRuns, // by alternate allele base
+        Parameters& parameters);
 };
 
 
@@ -29,16 +29,16 @@ int Sample::observationCount(const string& base) {
 }
 
 int Sample::partialObservationCount(void) {
-    return reversePartials.size();
+    return partialObservations.size();
 }
 
 double Sample::partialObservationCount(const string& base) {
     double scaledPartialCount = 0;
-    map<string, vector<Allele*> >::iterator g = partialSupport.find(base);
+    map<string, vector<int> >::iterator g = partialSupport.find(base);
     if (g != partialSupport.end()) {
-        vector<Allele*>& supportingObs = g->second;
-        for (vector<Allele*>::iterator a = supportingObs.begin(); a != supportingObs.end(); ++a) {
-            scaledPartialCount += (double) 1 / (double) reversePartials[*a].size();
+        vector<int>& supportingObs = g->second;
+        for (vector<int>::iterator p = supportingObs.begin(); p != supportingObs.end(); ++p) {
+            scaledPartialCount += (double) 1 / (double) partialSupportCount(*p);
         }
     }
     return scaledPartialCount;
@@ -62,12 +62,13 @@ int Sample::qualSum(Allele& allele) {
 }
 
 int Sample::qualSum(const string& base) {
-    Sample::iterator g = find(base);
+    map<string, vector<ObservationBin> >::iterator g = bins.find(base);
     int qsum = 0;
-    if (g != end()) {
-        vector<Allele*>& alleles = g->second;
-        for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
-            qsum += (*a)->quality;
+    if (g != bins.end()) {
+        vector<ObservationBin>& group = g->second;
+        for (vector<ObservationBin>::iterator b = group.begin(); b != group.end(); ++b) {
+            // the sum is an integer, so each quality is truncated as it is added
+            qsum += b->count * (int) b->quality;
         }
     }
     return qsum;
@@ -78,12 +79,12 @@ double Sample::partialQualSum(Allele& allele) {
 }
 
 double Sample::partialQualSum(const string& base) {
-    Sample::iterator g = partialSupport.find(base);
+    map<string, vector<int> >::iterator g = partialSupport.find(base);
     double qsum = 0;
     if (g != partialSupport.end()) {
-        vector<Allele*>& alleles = g->second;
-        for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
-            qsum += (double) (*a)->quality / (double) reversePartials[*a].size();
+        vector<int>& supportingObs = g->second;
+        for (vector<int>::iterator p = supportingObs.begin(); p != supportingObs.end(); ++p) {
+            qsum += (double) partialObservations.at(*p)->quality / (double) partialSupportCount(*p);
         }
     }
     return qsum;
@@ -166,7 +167,7 @@ double Samples::partialQualSum(const string& base) {
 }
 
 map<string, double> Samples::estimatedAlleleFrequencies(void) {
-    map<string, long double> qualsums;
+    map<string, Real> qualsums;
     for (Samples::iterator s = begin(); s != end(); ++s) {
         Sample& sample = s->second;
         for (Sample::iterator o = sample.begin(); o != sample.end(); ++o) {
@@ -174,12 +175,12 @@ map<string, double> Samples::estimatedAlleleFrequencies(void) {
             qualsums[base] += sample.qualSum(base);
         }
     }
-    long double total = 0;
-    for (map<string, long double>::iterator q = qualsums.begin(); q != qualsums.end(); ++q) {
+    Real total = 0;
+    for (map<string, Real>::iterator q = qualsums.begin(); q != qualsums.end(); ++q) {
         total += q->second;
     }
     map<string, double> freqs;
-    for (map<string, long double>::iterator q = qualsums.begin(); q != qualsums.end(); ++q) {
+    for (map<string, Real>::iterator q = qualsums.begin(); q != qualsums.end(); ++q) {
         freqs[q->first] = q->second / total;
         //cerr << "estimated frequency " << q->first << " " << freqs[q->first] << endl;
     }
@@ -213,28 +214,13 @@ void Sample::sortReferenceAlleles(void) {
 StrandBaseCounts
 Sample::strandBaseCount(string refbase, string altbase) {
 
-    int forwardRef = 0;
-    int reverseRef = 0;
+    int forwardRef = baseCount(refbase, STRAND_FORWARD);
+    int reverseRef = baseCount(refbase, STRAND_REVERSE);
     int forwardAlt = 0;
     int reverseAlt = 0;
-
-    for (Sample::iterator s = begin(); s != end(); ++s) {
-        vector<Allele*>& alleles = s->second;
-        for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
-            string base = (*a)->currentBase;
-            AlleleStrand strand = (*a)->strand;
-            if (base == refbase) {
-                if (strand == STRAND_FORWARD)
-                    ++forwardRef;
-                else if (strand == STRAND_REVERSE)
-                    ++reverseRef;
-            } else if (base == altbase) {
-                if (strand == STRAND_FORWARD)
-                    ++forwardAlt;
-                else if (strand == STRAND_REVERSE)
-                    ++reverseAlt;
-            }
-        }
+    if (altbase != refbase) {
+        forwardAlt = baseCount(altbase, STRAND_FORWARD);
+        reverseAlt = baseCount(altbase, STRAND_REVERSE);
     }
 
     return StrandBaseCounts(forwardRef, forwardAlt, reverseRef, reverseAlt);
@@ -244,15 +230,54 @@ Sample::strandBaseCount(string refbase, string altbase) {
 int Sample::baseCount(string base, AlleleStrand strand) {
 
     int count = 0;
+    map<string, vector<ObservationBin> >::iterator g = bins.find(base);
+    if (g != bins.end()) {
+        vector<ObservationBin>& group = g->second;
+        for (vector<ObservationBin>::iterator b = group.begin(); b != group.end(); ++b) {
+            if (b->strand == strand)
+                count += b->count;
+        }
+    }
+    return count;
+
+}
+
+bool ObservationBin::operator<(const ObservationBin& other) const {
+    if (quality != other.quality) return quality < other.quality;
+    if (mapQuality != other.mapQuality) return mapQuality < other.mapQuality;
+    if (strand != other.strand) return strand < other.strand;
+    if (placedLeft != other.placedLeft) return placedLeft < other.placedLeft;
+    if (readGroupIndex != other.readGroupIndex) return readGroupIndex < other.readGroupIndex;
+    if (readGroupID != other.readGroupID) return readGroupID < other.readGroupID;
+    if (lnquality != other.lnquality) return lnquality < other.lnquality;
+    if (lnmapQuality != other.lnmapQuality) return lnmapQuality < other.lnmapQuality;
+    return isReference < other.isReference;
+}
+
+void Sample::binObservations(void) {
+    bins.clear();
     for (Sample::iterator g = begin(); g != end(); ++g) {
+        vector<ObservationBin>& group = bins[g->first];
+        map<ObservationBin, int> index;
         vector<Allele*>& alleles = g->second;
         for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
-            if ((*a)->currentBase == base && (*a)->strand == strand)
-                ++count;
+            ObservationBin bin(**a);
+            map<ObservationBin, int>::iterator i = index.find(bin);
+            if (i == index.end()) {
+                index[bin] = group.size();
+                group.push_back(bin);
+                ++group.back().count;
+            } else {
+                ++group.at(i->second).count;
+            }
         }
     }
-    return count;
+}
 
+void Samples::binObservations(void) {
+    for (Samples::iterator s = begin(); s != end(); ++s) {
+        s->second.binObservations();
+    }
 }
 
 
@@ -411,39 +436,32 @@ void Samples::assignPartialSupport(vector<Allele>& alleles,
         }
         Sample& sample = siter->second;
         map<Allele*, set<Allele*> >::iterator sup = partialObservationSupport.find(*p);
-        if (sup != partialObservationSupport.end()) {
-            set<Allele*>& supported = sup->second;
-            for (set<Allele*>::iterator s = supported.begin(); s != supported.end(); ++s) {
-                sample.partialSupport[(*s)->currentBase].push_back(*p);
-                sample.supportedAlleles.insert((*s)->currentBase);
-            }
-            if (!supported.empty()) {
-                sample.reversePartials[*p] = supported;
-            }
+        if (sup == partialObservationSupport.end() || sup->second.empty()) {
+            continue;
         }
-        //sample.partialObservations.push_back(*p);
-    }
-
-}
-
-bool Sample::observationSupports(Allele* obs, Allele* allele) {
-    if (obs->currentBase == allele->currentBase) {
-        return true;
-    } else {
-        map<Allele*, set<Allele*> >::iterator p = reversePartials.find(obs);
-        if (p != reversePartials.end()) {
-            set<Allele*>& supports = p->second;
-            if (supports.find(allele) != supports.end()) {
-                return true;
+        set<Allele*>& supported = sup->second;
+        int i = sample.partialObservations.size();
+        sample.partialObservations.push_back(*p);
+        for (set<Allele*>::iterator s = supported.begin(); s != supported.end(); ++s) {
+            const string& base = (*s)->currentBase;
+            vector<string>& bases = sample.partiallySupportedAlleles;
+            int b = std::find(bases.begin(), bases.end(), base) - bases.begin();
+            if (b == bases.size()) {
+                bases.push_back(base);
             }
+            sample.partialSupports.push_back(b);
+            sample.partialSupport[base].push_back(i);
+            sample.supportedAlleles.insert(base);
         }
-        return false;
+        sample.partialSupportStart.push_back(sample.partialSupports.size());
     }
+
 }
 
 void Samples::clearFullObservations(void) {
     for (Samples::iterator s = begin(); s != end(); ++s) {
         s->second.clear();
+        s->second.bins.clear();
     }
 }
 
@@ -457,8 +475,11 @@ void Sample::clearPartialObservations(void) {
     supportedAlleles.clear();
     for (Sample::iterator a = begin(); a != end(); ++a)
         supportedAlleles.insert(a->first);
+    partialObservations.clear();
+    partialSupportStart.assign(1, 0);
+    partialSupports.clear();
+    partiallySupportedAlleles.clear();
     partialSupport.clear();
-    reversePartials.clear();
 }
 
 void Sample::setSupportedAlleles(void) {
@@ -33,6 +33,49 @@ StrandBaseCounts(int fr,
 
 };
 
+// a group of observations of one allele in a sample which agree in every
+// property used by the data likelihoods and the strand, placement and
+// quality summaries, so that those can be computed per group, not per read
+class ObservationBin {
+
+public:
+    int count;
+    Real quality;
+    Real lnquality;
+    int phredQuality;    // or -1, as Allele::phredQuality
+    short mapQuality;
+    Real lnmapQuality;
+    AlleleStrand strand;
+    bool placedLeft;     // basesLeft >= basesRight
+    bool isReference;
+    int readGroupIndex;  // as Allele::readGroupIndex
+    string readGroupID;  // only kept if it has no id
+
+    ObservationBin(Allele& allele)
+        : count(0)
+        , quality(allele.quality)
+        , lnquality(allele.lnquality)
+        , phredQuality(allele.phredQuality())
+        , mapQuality(allele.mapQuality)
+        , lnmapQuality(allele.lnmapQuality)
+        , strand(allele.strand)
+        , placedLeft(allele.basesLeft >= allele.basesRight)
+        , isReference(allele.isReference())
+        , readGroupIndex(allele.readGroupIndex)
+        , readGroupID(allele.readGroupIndex < 0 ? allele.readGroupID : string())
+    { }
+
+    // the order of bins, ignoring their counts
+    bool operator<(const ObservationBin& other) const;
+
+    // whether the read is placed at its start, that is, to the left of the
+    // observation on the forward strand or to the right on the reverse
+    bool placedStart(void) const {
+        return placedLeft == (strand == STRAND_FORWARD);
+    }
+
+};
+
 // sample tracking and allele sorting
 class Sample : public map<string, vector<Allele*> > {
 
@@ -40,24 +83,36 @@ class Sample : public map<string, vector<Allele*> > {
 
 public:
 
+    Sample(void) : partialSupportStart(1, 0) { }
+
     // includes both fully and partially-supported observations after adding partial obs
     set<string> supportedAlleles;
     void setSupportedAlleles(void);
 
-    // partial support for alleles, such as for observations that partially overlap the calling window
-    map<string, vector<Allele*> > partialSupport;
+    // partial observations, such as those of reads which only partially
+    // overlap the calling window, each of which may support several alleles
+    vector<Allele*> partialObservations;
 
-    // for fast scaling of qualities for partial supports
-    map<Allele*, set<Allele*> > reversePartials;
+    // the alleles partial observation i supports are partiallySupportedAlleles
+    // at the indexes partialSupports[partialSupportStart[i] .. partialSupportStart[i + 1])
+    vector<int> partialSupportStart;
+    vector<int> partialSupports;
+    vector<string> partiallySupportedAlleles;  // by base
+
+    // partial support for alleles, as indexes into partialObservations
+    map<string, vector<int> > partialSupport;
+
+    // the number of alleles partial observation i supports
+    int partialSupportCount(int i) {
+        return partialSupportStart.at(i + 1) - partialSupportStart.at(i);
+    }
 
     // clear the above
     void clearPartialObservations(void);
 
-    // set of partial observations (keys of the above map) cached for faster GL calculation
-    //vector<Allele*> partialObservations;
-
-    // if the observation (partial or otherwise) supports the allele
-    bool observationSupports(Allele* obs, Allele* allele);
+    // the full observations of each allele, binned
+    map<string, vector<ObservationBin> > bins;
+    void binObservations(void);
 
     // the number of observations for this allele
     int observationCount(Allele& allele);
@@ -122,6 +177,7 @@ public:
     void clearFullObservations(void);
     void clearPartialObservations(void);
     void setSupportedAlleles(void);
+    void binObservations(void);
 };
 
 
@@ -0,0 +1,166 @@
+#include "Sharding.h"
+
+vector<BedTarget> shardTargets(vector<BedTarget>& targets, long int shardLength) {
+    vector<BedTarget> shards;
+    for (vector<BedTarget>::iterator t = targets.begin(); t != targets.end(); ++t) {
+        // 0-based, inclusive end
+        for (long int left = t->left; left <= t->right; left += shardLength) {
+            long int right = min(left + shardLength - 1, (long int) t->right);
+            shards.push_back(BedTarget(t->seq, left, right, t->desc));
+        }
+    }
+    return shards;
+}
+
+ShardQueue::ShardQueue(vector<BedTarget>& targets, vector<BedTarget>& bounds,
+                       long int shardLength, long int minSplitLength)
+    : minSplitLength(minSplitLength)
+    , finishedTime(0)
+    , finishedCount(0)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&changed, NULL);
+    for (int t = 0; t < targets.size(); ++t) {
+        vector<BedTarget> target(1, targets.at(t));
+        vector<BedTarget> targetShards = shardTargets(target, shardLength);
+        for (vector<BedTarget>::iterator s = targetShards.begin(); s != targetShards.end(); ++s) {
+            pieces.push_back(Shard(shards.size(), *s, bounds.at(t)));
+            pending.push_back(&pieces.back());
+            shards.push_back(*s);
+            targetIndexes.push_back(t);
+        }
+    }
+    unfinished.resize(shards.size(), 1);
+}
+
+ShardQueue::~ShardQueue(void) {
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&mutex);
+}
+
+double ShardQueue::now(void) {
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec / 1e6;
+}
+
+bool ShardQueue::next(Shard*& shard) {
+    bool ok = false;
+    pthread_mutex_lock(&mutex);
+    while (true) {
+        if (!pending.empty()) {
+            shard = pending.front();
+            pending.pop_front();
+            shard->started = now();
+            running.insert(shard);
+            ok = true;
+            break;
+        } else if (running.empty()) {
+            break;
+        }
+        // everything has been handed out, so try to get some of a slow piece
+        requestSplit();
+        struct timespec timeout;
+        timeout.tv_sec = time(NULL) + 1;
+        timeout.tv_nsec = 0;
+        pthread_cond_timedwait(&changed, &mutex, &timeout);
+    }
+    pthread_mutex_unlock(&mutex);
+    return ok;
+}
+
+// with the mutex held
+void ShardQueue::requestSplit(void) {
+    // pieces which run longer than they usually take are probably in
+    // regions which are slow to process, so are worth splitting.  pieces
+    // already asked to split are passed over, so that one which is slow to
+    // notice does not keep the other idle threads waiting.
+    double threshold = finishedCount ? finishedTime / finishedCount : 0;
+    double t = now();
+    Shard* slowest = NULL;
+    for (set<Shard*>::iterator s = running.begin(); s != running.end(); ++s) {
+        Shard* shard = *s;
+        if (!shard->splitRequested
+            && !shard->unsplittable
+            && t - shard->started > threshold
+            && (!slowest || shard->started < slowest->started)) {
+            slowest = shard;
+        }
+    }
+    if (slowest) {
+        slowest->splitRequested = true;
+    }
+}
+
+bool ShardQueue::split(Shard& shard, long int position) {
+    bool didSplit = false;
+    pthread_mutex_lock(&mutex);
+    long int remaining = shard.target.right - position;
+    if (remaining < minSplitLength) {
+        shard.unsplittable = true;
+    } else {
+        long int middle = position + remaining / 2;
+        BedTarget right(shard.target.seq, middle + 1, shard.target.right, shard.target.desc);
+        shard.target.right = middle;
+        pieces.push_back(Shard(shard.index, right, shard.bounds));
+        pending.push_front(&pieces.back());
+        ++unfinished.at(shard.index);
+        didSplit = true;
+    }
+    shard.splitRequested = false;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+    return didSplit;
+}
+
+bool ShardQueue::finish(Shard& shard) {
+    pthread_mutex_lock(&mutex);
+    running.erase(&shard);
+    finishedTime += now() - shard.started;
+    ++finishedCount;
+    bool last = --unfinished.at(shard.index) == 0;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+    return last;
+}
+
+OrderedOutput::OrderedOutput(ostream& o)
+    : out(o)
+    , nextShard(0)
+{
+    pthread_mutex_init(&mutex, NULL);
+}
+
+OrderedOutput::~OrderedOutput(void) {
+    pthread_mutex_destroy(&mutex);
+}
+
+void OrderedOutput::write(Shard& shard, const string& records) {
+    pthread_mutex_lock(&mutex);
+    pending[shard.index][shard.target.left] = records;
+    pthread_mutex_unlock(&mutex);
+}
+
+void OrderedOutput::complete(int index) {
+    pthread_mutex_lock(&mutex);
+    completed.insert(index);
+    // flush this and any shards which were waiting on it
+    while (completed.count(nextShard)) {
+        map<long int, string>& pieces = pending[nextShard];
+        for (map<long int, string>::iterator p = pieces.begin(); p != pieces.end(); ++p) {
+            out << p->second;
+        }
+        pending.erase(nextShard);
+        completed.erase(nextShard);
+        ++nextShard;
+    }
+    out.flush();
+    pthread_mutex_unlock(&mutex);
+}
+
+int OrderedOutput::flushed(void) {
+    pthread_mutex_lock(&mutex);
+    int n = nextShard;
+    pthread_mutex_unlock(&mutex);
+    return n;
+}
@@ -0,0 +1,129 @@
+#ifndef SHARDING_H
+#define SHARDING_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <pthread.h>
+#include <sys/time.h>
+#include "BedReader.h"
+
+using namespace std;
+
+// the default distance beyond the ends of each shard from which we read
+// alignments, so that sites near the ends are called as in a serial run
+#define SHARD_MARGIN 1000
+
+// splits the targets into consecutive shards of at most shardLength bp,
+// preserving the order of the targets
+vector<BedTarget> shardTargets(vector<BedTarget>& targets, long int shardLength);
+
+// a contiguous piece of a shard, which is processed by one thread
+// pieces are split further while being processed if other threads run out
+// of work
+class Shard {
+
+public:
+
+    int index;          // of the shard this is a piece of, in shard order
+    BedTarget target;   // the range of this piece, whose sites it reports
+    BedTarget bounds;   // the target it is a piece of, which limits its margins
+    double started;     // when processing began, in seconds
+    bool unsplittable;  // too little remained when we last tried to split it
+    volatile bool splitRequested; // set when an idle thread wants half of what remains
+
+    Shard(int i, BedTarget& t, BedTarget& b)
+        : index(i)
+        , target(t)
+        , bounds(b)
+        , started(0)
+        , unsplittable(false)
+        , splitRequested(false)
+    { }
+
+};
+
+// hands out the pieces of the shards to the threads which request them
+//
+// once every shard has been handed out, a thread asking for work waits, and
+// asks the piece which has been running longest (if it has run longer than
+// pieces usually take) to give up the second half of what remains
+class ShardQueue {
+
+public:
+
+    // shards the targets, each of which lies within the corresponding
+    // bounds, into shards of at most shardLength bp.  a piece is not split
+    // if less than minSplitLength bp of it remain to be processed.
+    ShardQueue(vector<BedTarget>& targets, vector<BedTarget>& bounds,
+               long int shardLength, long int minSplitLength);
+    ~ShardQueue(void);
+
+    // gets the next piece to process, returning false when all are done
+    bool next(Shard*& shard);
+
+    // called by the thread processing the piece when it sees splitRequested
+    // position is the last position it has processed, and the piece is
+    // shortened to end after it
+    // returns true if the piece was split
+    bool split(Shard& shard, long int position);
+
+    // records that the piece is done, returning true if it was the last
+    // unfinished piece of its shard
+    bool finish(Shard& shard);
+
+    vector<BedTarget> shards;
+    vector<int> targetIndexes; // of the target each shard is from
+
+private:
+
+    void requestSplit(void);
+    double now(void);
+
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    deque<Shard> pieces;     // every piece we have made, in order of creation
+    deque<Shard*> pending;   // pieces waiting for a thread
+    set<Shard*> running;
+    vector<int> unfinished;  // pieces of each shard which aren't done
+    long int minSplitLength;
+    double finishedTime;     // total time spent on finished pieces
+    int finishedCount;
+
+};
+
+// collects output which is generated for shards in any order, and writes it
+// to the output stream in shard order as soon as it is contiguous
+// pieces report only the sites which start in them, so their output is
+// simply concatenated
+class OrderedOutput {
+
+public:
+
+    OrderedOutput(ostream& o);
+    ~OrderedOutput(void);
+
+    // records the output of a piece of a shard
+    void write(Shard& shard, const string& records);
+
+    // marks the shard as complete, flushing what we can
+    void complete(int index);
+
+    // the number of shards which have been written out
+    int flushed(void);
+
+private:
+
+    pthread_mutex_t mutex;
+    ostream& out;
+    int nextShard;
+    map<int, map<long int, string> > pending; // by shard, then by piece start
+    set<int> completed;
+
+};
+
+#endif
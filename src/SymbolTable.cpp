@@ -0,0 +1,21 @@
+#include "SymbolTable.h"
+
+SymbolTable sampleSymbols;
+SymbolTable readGroupSymbols;
+SymbolTable technologySymbols;
+
+int SymbolTable::id(const string& name) {
+    map<string, int>::iterator i = ids.find(name);
+    if (i != ids.end()) {
+        return i->second;
+    }
+    int n = names.size();
+    ids.insert(make_pair(name, n));
+    names.push_back(name);
+    return n;
+}
+
+int SymbolTable::find(const string& name) const {
+    map<string, int>::const_iterator i = ids.find(name);
+    return (i == ids.end()) ? -1 : i->second;
+}
@@ -0,0 +1,40 @@
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// assigns dense integer ids to names, in the order they are first seen, so
+// that what we know about each name can be kept in a vector indexed by id
+// rather than in a map keyed by the name
+class SymbolTable {
+
+public:
+
+    // the id of name, which is assigned if name is new
+    int id(const string& name);
+
+    // the id of name, or -1 if it has none
+    int find(const string& name) const;
+
+    const string& name(int id) const { return names.at(id); }
+    int size(void) const { return names.size(); }
+
+private:
+
+    map<string, int> ids;
+    vector<string> names;
+
+};
+
+// the samples, read groups and sequencing technologies of the input, which
+// are given ids as the alignment headers are read at startup.  they are
+// only read once calling begins, so they may be shared between threads.
+extern SymbolTable sampleSymbols;
+extern SymbolTable readGroupSymbols;
+extern SymbolTable technologySymbols;
+
+#endif
@@ -0,0 +1,114 @@
+#include "ThreadPool.h"
+#include <iostream>
+#include <stdlib.h>
+
+using namespace std;
+
+// the worker threads need to know which thread they are
+class ThreadPoolWorker {
+public:
+    ThreadPool* pool;
+    int thread;
+};
+
+ThreadPool::ThreadPool(int n)
+    : task(NULL)
+    , data(NULL)
+    , count(0)
+    , next(0)
+    , generation(0)
+    , working(0)
+    , stopping(false)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&started, NULL);
+    pthread_cond_init(&finished, NULL);
+    threads.resize(n > 1 ? n - 1 : 0);
+    for (int i = 0; i < threads.size(); ++i) {
+        ThreadPoolWorker* worker = new ThreadPoolWorker;
+        worker->pool = this;
+        worker->thread = i + 1;
+        if (pthread_create(&threads.at(i), NULL, work, worker)) {
+            cerr << "could not create thread" << endl;
+            exit(1);
+        }
+    }
+}
+
+ThreadPool::~ThreadPool(void) {
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&started);
+    pthread_mutex_unlock(&mutex);
+    for (vector<pthread_t>::iterator t = threads.begin(); t != threads.end(); ++t) {
+        pthread_join(*t, NULL);
+    }
+    pthread_cond_destroy(&finished);
+    pthread_cond_destroy(&started);
+    pthread_mutex_destroy(&mutex);
+}
+
+int ThreadPool::size(void) {
+    return threads.size() + 1;
+}
+
+void* ThreadPool::work(void* arg) {
+    ThreadPoolWorker* worker = (ThreadPoolWorker*) arg;
+    ThreadPool* pool = worker->pool;
+    int thread = worker->thread;
+    delete worker;
+    int seen = 0;
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (!pool->stopping && pool->generation == seen) {
+            pthread_cond_wait(&pool->started, &pool->mutex);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
+        pool->runTasks(thread);
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->working == 0) {
+            pthread_cond_signal(&pool->finished);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+void ThreadPool::runTasks(int thread) {
+    int i;
+    while ((i = __sync_fetch_and_add(&next, 1)) < count) {
+        task(i, thread, data);
+    }
+}
+
+void ThreadPool::run(int n, void (*t)(int i, int thread, void* data), void* d) {
+    // not worth waking anyone
+    if (threads.empty() || n < 2) {
+        for (int i = 0; i < n; ++i) {
+            t(i, 0, d);
+        }
+        return;
+    }
+    pthread_mutex_lock(&mutex);
+    task = t;
+    data = d;
+    count = n;
+    next = 0;
+    working = threads.size();
+    ++generation;
+    pthread_cond_broadcast(&started);
+    pthread_mutex_unlock(&mutex);
+
+    runTasks(0);
+
+    // wait for the workers to finish their last iterations
+    pthread_mutex_lock(&mutex);
+    while (working > 0) {
+        pthread_cond_wait(&finished, &mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,49 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <pthread.h>
+
+using namespace std;
+
+// a fixed set of threads which run the iterations of a loop concurrently
+//
+// iterations are handed out one at a time to whichever thread is free, so
+// uneven iterations balance themselves.  the calling thread takes part as
+// thread 0, and a pool of size 1 simply runs the loop on the caller.
+class ThreadPool {
+
+public:
+
+    ThreadPool(int threads);
+    ~ThreadPool(void);
+
+    // calls task(i, thread, data) for each i in [0, n), returning once all
+    // have completed.  thread is in [0, size()), and no two concurrent calls
+    // receive the same thread, so it may index per-thread scratch space.
+    void run(int n, void (*task)(int i, int thread, void* data), void* data);
+
+    int size(void);
+
+private:
+
+    static void* work(void* arg);
+    void runTasks(int thread);
+
+    vector<pthread_t> threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t started;
+    pthread_cond_t finished;
+
+    // the current loop
+    void (*task)(int i, int thread, void* data);
+    void* data;
+    int count;
+    volatile int next;
+    int generation; // incremented for each loop, to wake the workers
+    int working;    // workers which have not yet finished the current loop
+    bool stopping;
+
+};
+
+#endif
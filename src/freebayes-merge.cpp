@@ -0,0 +1,338 @@
+#include <iostream>
+#include <fstream>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <queue>
+#include <zlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "Fasta.h"
+
+using namespace std;
+
+// the size of the buffers we use for reading each input; zlib allocates
+// three times this for a compressed input
+#define MERGE_BUFFER_SIZE 65536
+
+// the number of file descriptors we leave for everything but the inputs
+#define MERGE_RESERVED_FILES 16
+
+void printUsage(char** argv) {
+    cerr << "usage: " << argv[0] << " -f [REFERENCE] [options] <vcf file> [vcf file] ..." << endl
+         << endl
+         << "Merges VCF files produced by running freebayes over shards of the reference into" << endl
+         << "one VCF stream, with the header of the first file.  Each file must be sorted, and" << endl
+         << "may be plain or compressed with bgzip.  Records are ordered by the sequences in" << endl
+         << "the reference index and then by position.  Identical records at the edges of" << endl
+         << "shards are written once.  Memory use does not depend on the size of the files," << endl
+         << "but is about 200KB for each input open at once.  If there are more inputs than" << endl
+         << "may be open at once, groups of them are first merged into temporary files in" << endl
+         << "TMPDIR (or /tmp), which needs as much space as the inputs uncompressed." << endl
+         << endl
+         << "arguments:" << endl
+         << "   -f --fasta-reference FILE   the reference used to produce the VCF files (required)" << endl
+         << "   -v --vcf FILE               write output to FILE instead of stdout" << endl
+         << "   -m --max-open N             open at most N inputs at once" << endl
+         << "                               default: the limit on open files, less " << MERGE_RESERVED_FILES << endl
+         << "   -h --help                   print this help" << endl;
+}
+
+// reads the lines of a plain or (b)gzipped file
+class LineReader {
+
+public:
+
+    string filename;
+
+    LineReader(const string& f)
+        : filename(f)
+    {
+        file = gzopen(filename.c_str(), "rb");
+        if (!file) {
+            cerr << "could not open " << filename << endl;
+            exit(1);
+        }
+        gzbuffer(file, MERGE_BUFFER_SIZE);
+    }
+
+    ~LineReader(void) {
+        gzclose(file);
+    }
+
+    // gets the next line, without its newline
+    bool getLine(string& line) {
+        line.clear();
+        while (gzgets(file, buffer, sizeof(buffer))) {
+            size_t length = strlen(buffer);
+            if (length && buffer[length - 1] == '\n') {
+                line.append(buffer, length - 1);
+                return true;
+            }
+            line.append(buffer, length);
+        }
+        return !line.empty();
+    }
+
+private:
+
+    gzFile file;
+    char buffer[4096];
+
+};
+
+// the next record of an input, in the order we write records
+class MergeRecord {
+public:
+    int sequence;  // the rank of the sequence in the reference index
+    long int position;
+    int input;
+    MergeRecord(int s, long int p, int i) : sequence(s), position(p), input(i) { }
+    bool operator>(const MergeRecord& other) const {
+        if (sequence != other.sequence) return sequence > other.sequence;
+        if (position != other.position) return position > other.position;
+        return input > other.input;
+    }
+};
+
+class VCFMerger {
+
+public:
+
+    VCFMerger(vector<string>& sequenceNames, vector<string>& filenames, ostream& o)
+        : out(o)
+    {
+        for (int i = 0; i < sequenceNames.size(); ++i) {
+            sequenceRanks[sequenceNames.at(i)] = i;
+        }
+        for (vector<string>::iterator f = filenames.begin(); f != filenames.end(); ++f) {
+            inputs.push_back(new LineReader(*f));
+        }
+        lines.resize(inputs.size());
+        last.resize(inputs.size(), MergeRecord(-1, -1, -1));
+    }
+
+    ~VCFMerger(void) {
+        for (vector<LineReader*>::iterator i = inputs.begin(); i != inputs.end(); ++i) {
+            delete *i;
+        }
+    }
+
+    void merge(void) {
+        // write the header of the first input, and skip the others
+        for (int i = 0; i < inputs.size(); ++i) {
+            string& line = lines.at(i);
+            bool ok;
+            while ((ok = inputs.at(i)->getLine(line)) && !line.empty() && line[0] == '#') {
+                if (i == 0) {
+                    out << line << "\n";
+                }
+            }
+            if (ok) {
+                push(i);
+            }
+        }
+
+        // identical records can only be at the same position
+        MergeRecord current(-1, -1, -1);
+        set<string> written;
+
+        while (!records.empty()) {
+            MergeRecord record = records.top();
+            records.pop();
+            string& line = lines.at(record.input);
+            if (record.sequence != current.sequence || record.position != current.position) {
+                current = record;
+                written.clear();
+            }
+            if (written.insert(line).second) {
+                out << line << "\n";
+            }
+            if (inputs.at(record.input)->getLine(line)) {
+                push(record.input);
+            }
+        }
+        out.flush();
+    }
+
+private:
+
+    // adds the line read from the input to the heap
+    void push(int input) {
+        string& line = lines.at(input);
+        size_t tab = line.find('\t');
+        if (tab == string::npos) {
+            cerr << "malformed record in " << inputs.at(input)->filename << ": " << line << endl;
+            exit(1);
+        }
+        map<string, int>::iterator s = sequenceRanks.find(line.substr(0, tab));
+        if (s == sequenceRanks.end()) {
+            cerr << "sequence " << line.substr(0, tab) << " in " << inputs.at(input)->filename
+                 << " is not in the reference" << endl;
+            exit(1);
+        }
+        MergeRecord record(s->second, atol(line.c_str() + tab + 1), input);
+        // we can't reorder records within an input without buffering it
+        MergeRecord& previous = last.at(input);
+        if (record.sequence < previous.sequence
+            || (record.sequence == previous.sequence && record.position < previous.position)) {
+            cerr << inputs.at(input)->filename << " is not sorted, at record: " << line << endl;
+            exit(1);
+        }
+        previous = record;
+        records.push(record);
+    }
+
+    ostream& out;
+    map<string, int> sequenceRanks;
+    vector<LineReader*> inputs;
+    vector<string> lines;           // the current line of each input
+    vector<MergeRecord> last;       // the last record read from each input
+    priority_queue<MergeRecord, vector<MergeRecord>, greater<MergeRecord> > records;
+
+};
+
+// merges groups of at most maxOpen files into temporary files, until there
+// are few enough to merge at once.  the groups are consecutive, so records
+// at the same position stay in the order of their inputs, and the header of
+// the first file stays first.  returns the temporary files to merge.
+vector<string> mergeGroups(vector<string>& sequenceNames, vector<string>& filenames, int maxOpen) {
+
+    const char* tmpdir = getenv("TMPDIR");
+    string pattern = string(tmpdir ? tmpdir : "/tmp") + "/freebayes-merge.XXXXXX";
+
+    vector<string> inputs = filenames;
+    vector<string> temporaries;
+    while (inputs.size() > maxOpen) {
+        vector<string> merged;
+        for (int i = 0; i < inputs.size(); i += maxOpen) {
+            vector<string> group(inputs.begin() + i, inputs.begin() + min((int) inputs.size(), i + maxOpen));
+            vector<char> name(pattern.begin(), pattern.end());
+            name.push_back('\0');
+            int fd = mkstemp(&name.front());
+            if (fd < 0) {
+                cerr << "could not create a temporary file " << pattern << endl;
+                exit(1);
+            }
+            close(fd);
+            merged.push_back(&name.front());
+            ofstream out(merged.back().c_str());
+            VCFMerger merger(sequenceNames, group, out);
+            merger.merge();
+            if (!out) {
+                cerr << "could not write the temporary file " << merged.back() << endl;
+                exit(1);
+            }
+        }
+        // the temporary files of the previous pass have been merged
+        for (vector<string>::iterator t = temporaries.begin(); t != temporaries.end(); ++t) {
+            unlink(t->c_str());
+        }
+        inputs = temporaries = merged;
+    }
+    return inputs;
+
+}
+
+int main(int argc, char** argv) {
+
+    string fastaFile;
+    string outputFile;
+    int maxOpen = 0;
+
+    while (true) {
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"fasta-reference", required_argument, 0, 'f'},
+            {"vcf", required_argument, 0, 'v'},
+            {"max-open", required_argument, 0, 'm'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "hf:v:m:", long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+            case 'f':
+                fastaFile = optarg;
+                break;
+            case 'v':
+                outputFile = optarg;
+                break;
+            case 'm':
+                maxOpen = atoi(optarg);
+                if (maxOpen < 2) {
+                    cerr << "--max-open must be at least 2" << endl;
+                    exit(1);
+                }
+                break;
+            case 'h':
+                printUsage(argv);
+                exit(0);
+            default:
+                printUsage(argv);
+                exit(1);
+        }
+    }
+
+    if (fastaFile.empty()) {
+        cerr << "Please specify a fasta reference file." << endl;
+        exit(1);
+    }
+
+    vector<string> filenames;
+    for (int i = optind; i < argc; ++i) {
+        filenames.push_back(argv[i]);
+    }
+    if (filenames.empty()) {
+        printUsage(argv);
+        exit(1);
+    }
+
+    if (!maxOpen) {
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+            maxOpen = max((long int) limit.rlim_cur - MERGE_RESERVED_FILES, 2L);
+        } else {
+            maxOpen = filenames.size();
+        }
+    }
+
+    FastaReference reference;
+    reference.open(fastaFile);
+
+    ios_base::sync_with_stdio(false);
+    ofstream outputFileStream;
+    if (!outputFile.empty()) {
+        outputFileStream.open(outputFile.c_str());
+        if (!outputFileStream.is_open()) {
+            cerr << "could not open " << outputFile << " for writing" << endl;
+            exit(1);
+        }
+    }
+    ostream& out = outputFile.empty() ? cout : outputFileStream;
+
+    vector<string> inputs = filenames;
+    if (inputs.size() > maxOpen) {
+        inputs = mergeGroups(reference.index->sequenceNames, filenames, maxOpen);
+    }
+    {
+        VCFMerger merger(reference.index->sequenceNames, inputs, out);
+        merger.merge();
+    }
+    if (inputs != filenames) {
+        for (vector<string>::iterator t = inputs.begin(); t != inputs.end(); ++t) {
+            unlink(t->c_str());
+        }
+    }
+
+    return 0;
+
+}
@@ -14,8 +14,10 @@
 #include <iterator>
 #include <algorithm>
 #include <cmath>
+#include <sstream>
 #include <time.h>
 #include <float.h>
+#include <pthread.h>
 
 // private libraries
 #include "api/BamReader.h"
@@ -38,6 +40,11 @@
 
 #include "Bias.h"
 #include "Contamination.h"
+#include "Sharding.h"
+#include "RegionPlanner.h"
+#include "BoundedQueue.h"
+#include "ThreadPool.h"
+#include "Checkpoint.h"
 
 
 // local helper debugging macros to improve code readability
@@ -59,712 +66,1378 @@
 
 using namespace std; 
 
-// todo
-// generalize the main function to take the parameters as input
-// so that we can invoke the entire algorithm on different regions
-// when requested to run in parallel
-// take the targets (or whole genome) and make small jobs
-// run the main function for each region in an omp parallel for loop
-// only do this if the --parallel flag is set > 1
+// the number of sites which may wait between the stages of --pipeline
+#define SITE_QUEUE_SIZE 64
 
-// freebayes main
-int main (int argc, char *argv[]) {
+// a position which has passed our input filters, along with everything we
+// need to genotype and report it once the parser has moved past it
+class Site {
 
-    // install segfault handler
-    signal(SIGSEGV, segfaultHandler);
+public:
+
+    // filled by prepareSite
+    string sequenceName;
+    long int position;          // 0-based
+    int target;                 // the index of the parser's target
+    char currentReferenceBase;
+    string referenceBase;       // the reference haplotype
+    int haplotypeLength;
+    bool hasInputVariantAlleles;
+    Samples samples;
+    int coverage;
+    map<string, vector<Allele*> > alleleGroups;
+    map<string, vector<Allele*> > partialObservationGroups;
+    map<Allele*, set<Allele*> > partialObservationSupport;
+    vector<Allele> genotypeAlleles;
+    bool usingNull;
+    vector<int> ploidies;
+    map<string, int> samplePloidies;
+    int copiesOfLocus;
+    map<string, int> repeats;
+    map<string, int> homopolymerRuns; // by genotype allele base
+
+    // filled by genotypeSite
+    bool genotyped; // false if no sample had any genotype likelihoods
+    map<int, vector<Genotype> > genotypesByPloidy;
+    Results results;
+    map<string, SampleDataLikelihoods> sampleDataLikelihoodsByPopulation;
+    BigFloat pHom;
+    Real bestComboOddsRatio;
+    GenotypeCombo bestCombo;
+    vector<Allele> alts;
+    int genotypingTotalIterations;
+
+    Site(void)
+        : position(0)
+        , currentReferenceBase('N')
+        , haplotypeLength(0)
+        , hasInputVariantAlleles(false)
+        , coverage(0)
+        , usingNull(false)
+        , copiesOfLocus(0)
+        , genotyped(false)
+        , bestComboOddsRatio(0)
+        , genotypingTotalIterations(0)
+    { }
+
+    // replaces the observations, which belong to the parser, with copies
+    // owned by the site, so that it can be genotyped after the parser has
+    // moved on
+    void copyObservations(void);
+
+private:
+
+    deque<Allele> observations;
+    Allele* copy(Allele* allele, map<Allele*, Allele*>& copies);
+    void copy(vector<Allele*>& alleles, map<Allele*, Allele*>& copies);
+    void copy(map<Allele*, set<Allele*> >& support, map<Allele*, Allele*>& copies);
+
+};
+
+Allele* Site::copy(Allele* allele, map<Allele*, Allele*>& copies) {
+    map<Allele*, Allele*>::iterator c = copies.find(allele);
+    if (c != copies.end()) {
+        return c->second;
+    }
+    observations.push_back(*allele);
+    Allele* a = &observations.back();
+    a->currentReferencePosition = &position;
+    a->currentReferenceBase = &currentReferenceBase;
+    a->alignmentAlleles = NULL; // only used while building haplotype alleles
+    copies[allele] = a;
+    return a;
+}
+
+void Site::copy(vector<Allele*>& alleles, map<Allele*, Allele*>& copies) {
+    for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
+        *a = copy(*a, copies);
+    }
+}
+
+// the supported alleles are genotype alleles, which are only counted, so
+// only the partial observations need to be replaced
+void Site::copy(map<Allele*, set<Allele*> >& support, map<Allele*, Allele*>& copies) {
+    map<Allele*, set<Allele*> > copied;
+    for (map<Allele*, set<Allele*> >::iterator p = support.begin(); p != support.end(); ++p) {
+        copied[copy(p->first, copies)] = p->second;
+    }
+    support.swap(copied);
+}
+
+void Site::copyObservations(void) {
+    map<Allele*, Allele*> copies;
+    for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
+        Sample& sample = s->second;
+        for (Sample::iterator g = sample.begin(); g != sample.end(); ++g) {
+            copy(g->second, copies);
+        }
+        copy(sample.partialObservations, copies);
+    }
+    for (map<string, vector<Allele*> >::iterator g = alleleGroups.begin(); g != alleleGroups.end(); ++g) {
+        copy(g->second, copies);
+    }
+    for (map<string, vector<Allele*> >::iterator g = partialObservationGroups.begin(); g != partialObservationGroups.end(); ++g) {
+        copy(g->second, copies);
+    }
+    copy(partialObservationSupport, copies);
+}
+
+// applies our input filters to the alleles the parser has found at its
+// current position, and if they pass, records the site in site
+// returns false if the position should not be genotyped
+bool prepareSite(AlleleParser* parser,
+                 Samples& samples,
+                 Site& site,
+                 int allowedAlleleTypes,
+                 Allele& nullAllele) {
 
-    AlleleParser* parser = new AlleleParser(argc, argv);
     Parameters& parameters = parser->parameters;
-    list<Allele*> alleles;
 
-    Samples samples;
+    DEBUG2("at start of main loop");
 
-    ostream& out = *(parser->output);
+    // don't process non-ATGC's in the reference
+    string cb = parser->currentReferenceBaseString();
+    if (cb != "A" && cb != "T" && cb != "C" && cb != "G") {
+        DEBUG2("current reference base is N");
+        return false;
+    }
 
-    Bias observationBias;
-    if (!parameters.alleleObservationBiasFile.empty()) {
-        observationBias.open(parameters.alleleObservationBiasFile);
+    if (parameters.trace) {
+        for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
+            const string& name = s->first;
+            for (Sample::iterator g = s->second.begin(); g != s->second.end(); ++g) {
+                vector<Allele*>& group = g->second;
+                for (vector<Allele*>::iterator a = group.begin(); a != group.end(); ++a) {
+                    Allele& allele = **a;
+                    parser->traceFile << parser->currentSequenceName << "," << (long unsigned int) parser->currentPosition + 1  
+                                      << ",allele," << name << "," << allele.readID << "," << allele.base() << ","
+                                      << allele.currentQuality() << "," << allele.mapQuality << endl;
+                }
+            }
+        }
+        DEBUG2("after trace generation");
     }
 
-    Contamination contaminationEstimates(0.5+parameters.probContamination, parameters.probContamination);
-    if (!parameters.contaminationEstimateFile.empty()) {
-        contaminationEstimates.open(parameters.contaminationEstimateFile);
+    if (!parser->inTarget()) {
+        DEBUG("position: " << parser->currentSequenceName << ":" << (long unsigned int) parser->currentPosition + 1
+              << " is not inside any targets, skipping");
+        return false;
     }
 
-    // this can be uncommented to force operation on a specific set of genotypes
-    vector<Allele> allGenotypeAlleles;
-    allGenotypeAlleles.push_back(genotypeAllele(ALLELE_GENOTYPE, "A", 1));
-    allGenotypeAlleles.push_back(genotypeAllele(ALLELE_GENOTYPE, "T", 1));
-    allGenotypeAlleles.push_back(genotypeAllele(ALLELE_GENOTYPE, "G", 1));
-    allGenotypeAlleles.push_back(genotypeAllele(ALLELE_GENOTYPE, "C", 1));
+    int coverage = countAlleles(samples);
 
-    int allowedAlleleTypes = ALLELE_REFERENCE;
-    if (parameters.allowSNPs) {
-        allowedAlleleTypes |= ALLELE_SNP;
+    DEBUG("position: " << parser->currentSequenceName << ":" << (long unsigned int) parser->currentPosition + 1 << " coverage: " << coverage);
+
+    bool hasInputVariantAlleles = parser->hasInputVariantAllelesAtCurrentPosition();
+
+    if (!hasInputVariantAlleles) {
+        // skips 0-coverage regions
+        if (coverage == 0) {
+            DEBUG("no alleles left at this site after filtering");
+            return false;
+        } else if (coverage < parameters.minCoverage) {
+            DEBUG("post-filtering coverage of " << coverage << " is less than --min-coverage of " << parameters.minCoverage);
+            return false;
+        } else if (parameters.onlyUseInputAlleles) {
+            DEBUG("no input alleles, but using only input alleles for analysis, skipping position");
+            return false;
+        }
+
+        DEBUG2("coverage " << parser->currentSequenceName << ":" << parser->currentPosition << " == " << coverage);
+
+        // establish a set of possible alternate alleles to evaluate at this location
+
+        if (!parameters.reportMonomorphic
+            && !sufficientAlternateObservations(samples, parameters.minAltCount, parameters.minAltFraction)) {
+            DEBUG("insufficient alternate observations");
+            return false;
+        }
+        if (parameters.reportMonomorphic) {
+            DEBUG("calling at site even though there are no alternate observations");
+        }
     }
-    if (parameters.allowIndels) {
-        allowedAlleleTypes |= ALLELE_INSERTION;
-        allowedAlleleTypes |= ALLELE_DELETION;
+
+    // establish genotype alleles using input filters
+    map<string, vector<Allele*> > alleleGroups;
+    groupAlleles(samples, alleleGroups);
+    DEBUG2("grouped alleles by equivalence");
+
+    vector<Allele> genotypeAlleles = parser->genotypeAlleles(alleleGroups, samples, parameters.onlyUseInputAlleles);
+
+    // always include the reference allele as a possible genotype, even when we don't include it by default
+    if (!parameters.useRefAllele) {
+        vector<Allele> refAlleleVector;
+        refAlleleVector.push_back(genotypeAllele(ALLELE_REFERENCE, string(1, parser->currentReferenceBase), 1, "1M"));
+        genotypeAlleles = alleleUnion(genotypeAlleles, refAlleleVector);
     }
-    if (parameters.allowMNPs) {
-        allowedAlleleTypes |= ALLELE_MNP;
+
+    map<string, vector<Allele*> > partialObservationGroups;
+    map<Allele*, set<Allele*> > partialObservationSupport;
+
+    // build haplotype alleles matching the current longest allele (often will do nothing)
+    // this will adjust genotypeAlleles if changes are made
+    DEBUG("building haplotype alleles, currently there are " << genotypeAlleles.size() << " genotype alleles");
+    DEBUG(genotypeAlleles);
+    parser->buildHaplotypeAlleles(genotypeAlleles,
+                                  samples,
+                                  alleleGroups,
+                                  partialObservationGroups,
+                                  partialObservationSupport,
+                                  allowedAlleleTypes);
+    DEBUG("built haplotype alleles, now there are " << genotypeAlleles.size() << " genotype alleles");
+    DEBUG(genotypeAlleles);
+
+    // if we have only one viable allele, we don't have evidence for variation at this site
+    if (!hasInputVariantAlleles && !parameters.reportMonomorphic && genotypeAlleles.size() <= 1 && genotypeAlleles.front().isReference()) {
+        DEBUG("no alternate genotype alleles passed filters at " << parser->currentSequenceName << ":" << parser->currentPosition);
+        return false;
     }
-    if (parameters.allowComplex) {
-        allowedAlleleTypes |= ALLELE_COMPLEX;
+    DEBUG("genotype alleles: " << genotypeAlleles);
+
+    // add the null genotype
+    bool usingNull = false;
+    if (parameters.excludeUnobservedGenotypes && genotypeAlleles.size() > 2) {
+        genotypeAlleles.push_back(nullAllele);
+        usingNull = true;
     }
 
-    // output VCF header
-    if (parameters.output == "vcf") {
-        out << parser->variantCallFile.header << endl;
+    // record everything we need from the parser's current state
+    site.sequenceName = parser->currentSequenceName;
+    site.position = parser->currentPosition;
+    site.target = parser->currentTarget ? parser->currentTarget - &parser->targets.front() : 0;
+    site.currentReferenceBase = parser->currentReferenceBase;
+    site.referenceBase = parser->currentReferenceHaplotype();
+    site.haplotypeLength = parser->lastHaplotypeLength;
+    site.hasInputVariantAlleles = hasInputVariantAlleles;
+    // re-calculate coverage, as this could change now that we've built haplotype alleles
+    site.coverage = countAlleles(samples);
+    site.alleleGroups.swap(alleleGroups);
+    site.partialObservationGroups.swap(partialObservationGroups);
+    site.partialObservationSupport.swap(partialObservationSupport);
+    site.genotypeAlleles.swap(genotypeAlleles);
+    site.usingNull = usingNull;
+
+    site.ploidies = parser->currentPloidies(samples);
+    site.copiesOfLocus = parser->copiesOfLocus(samples);
+    for (vector<string>::iterator n = parser->sampleList.begin(); n != parser->sampleList.end(); ++n) {
+        if (samples.find(*n) != samples.end() || hasInputVariantAlleles || parameters.reportMonomorphic) {
+            site.samplePloidies[*n] = parser->currentSamplePloidy(*n);
+        }
     }
 
-    Allele nullAllele = genotypeAllele(ALLELE_NULL, "N", 1, "1N");
+    if (parameters.showReferenceRepeats) {
+        site.repeats = parser->repeatCounts(parser->currentSequencePosition(), parser->currentSequence, 12);
+    }
 
-    unsigned long total_sites = 0;
-    unsigned long processed_sites = 0;
+    for (vector<Allele>::iterator a = site.genotypeAlleles.begin(); a != site.genotypeAlleles.end(); ++a) {
+        string base = a->base();
+        site.homopolymerRuns[base] = parser->homopolymerRunLeft(base) + 1 + parser->homopolymerRunRight(base);
+    }
 
-    while (parser->getNextAlleles(samples, allowedAlleleTypes)) {
+    return true;
 
-        ++total_sites;
+}
 
-        DEBUG2("at start of main loop");
+// the data likelihood calculations for the samples at a site, which are run
+// concurrently on the genotyping pool
+class SampleDataLikelihoodTasks {
+public:
+    Parameters* parameters;
+    Bias* observationBias;
+    Contamination* contaminationEstimates;
+    vector<Allele>* genotypeAlleles;
+    map<string, double>* estimatedAlleleFrequencies;
+    bool usingNull;
+    // by task
+    vector<string*> sampleNames;
+    vector<int> sampleIndexes;  // in the parser's sampleList
+    vector<Sample*> samples;
+    vector<vector<Genotype>*> genotypes;
+    vector<vector<pair<Genotype*, Real> > > probs; // empty if the sample is skipped
+    // by thread
+    vector<vector<Genotype*> > genotypesWithObs;
+    vector<ObservationBuffer> observations;
+    // samples with the same bucketed observations and genotypes share their
+    // likelihoods, which at low coverage is common.  the memo is shared by
+    // all the threads, under memoMutex; two threads may both calculate the
+    // same likelihoods, which only costs time.
+    map<string, vector<pair<Genotype*, Real> > > likelihoodMemo;
+    pthread_mutex_t memoMutex;
+
+    SampleDataLikelihoodTasks(void) {
+        pthread_mutex_init(&memoMutex, NULL);
+    }
+    ~SampleDataLikelihoodTasks(void) {
+        pthread_mutex_destroy(&memoMutex);
+    }
+};
 
-        // don't process non-ATGC's in the reference
-        string cb = parser->currentReferenceBaseString();
-        if (cb != "A" && cb != "T" && cb != "C" && cb != "G") {
-            DEBUG2("current reference base is N");
-            continue;
+void calculateSampleDataLikelihoods(int i, int thread, void* data) {
+
+    SampleDataLikelihoodTasks& tasks = *(SampleDataLikelihoodTasks*) data;
+    Parameters& parameters = *tasks.parameters;
+    Sample& sample = *tasks.samples.at(i);
+    vector<Genotype>& genotypes = *tasks.genotypes.at(i);
+
+    vector<Genotype*>& genotypesWithObs = tasks.genotypesWithObs.at(thread);
+    genotypesWithObs.clear();
+    for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
+        if (parameters.excludePartiallyObservedGenotypes) {
+            if (g->sampleHasSupportingObservationsForAllAlleles(sample)) {
+                genotypesWithObs.push_back(&*g);
+            }
+        } else if (parameters.excludeUnobservedGenotypes && tasks.usingNull) {
+            if (g->sampleHasSupportingObservations(sample)) {
+                //cerr << sampleName << " has suppporting obs for " << *g << endl;
+                genotypesWithObs.push_back(&*g);
+            } else if (g->hasNullAllele() && g->homozygous) {
+                // this genotype will never be added if we are running in observed-only mode, but
+                // we still need it for consistency
+                genotypesWithObs.push_back(&*g);
+            }
+        } else {
+            genotypesWithObs.push_back(&*g);
         }
+    }
 
-        if (parameters.trace) {
-            for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
-                const string& name = s->first;
-                for (Sample::iterator g = s->second.begin(); g != s->second.end(); ++g) {
-                    vector<Allele*>& group = g->second;
-                    for (vector<Allele*>::iterator a = group.begin(); a != group.end(); ++a) {
-                        Allele& allele = **a;
-                        parser->traceFile << parser->currentSequenceName << "," << (long unsigned int) parser->currentPosition + 1  
-                                          << ",allele," << name << "," << allele.readID << "," << allele.base() << ","
-                                          << allele.currentQuality() << "," << allele.mapQuality << endl;
-                    }
-                }
+    if (genotypesWithObs.empty()) {
+        return;
+    }
+
+    ObservationBuffer& observations = tasks.observations.at(thread);
+    observations.build(sample, *tasks.genotypeAlleles, *tasks.contaminationEstimates,
+                       parameters.useMappingQuality, parameters.standardGLs);
+
+    string key((const char*) &genotypesWithObs.front(), genotypesWithObs.size() * sizeof(Genotype*));
+    observations.signature(key);
+    pthread_mutex_lock(&tasks.memoMutex);
+    map<string, vector<pair<Genotype*, Real> > >::iterator m = tasks.likelihoodMemo.find(key);
+    bool found = m != tasks.likelihoodMemo.end();
+    if (found) {
+        tasks.probs.at(i) = m->second;
+    }
+    pthread_mutex_unlock(&tasks.memoMutex);
+    if (found) {
+        return;
+    }
+
+    tasks.probs.at(i)
+        = probObservedAllelesGivenGenotypes(observations, sample, genotypesWithObs,
+                                            parameters.RDF, *tasks.observationBias,
+                                            parameters.standardGLs);
+    pthread_mutex_lock(&tasks.memoMutex);
+    tasks.likelihoodMemo.insert(make_pair(key, tasks.probs.at(i)));
+    pthread_mutex_unlock(&tasks.memoMutex);
+
+}
+
+// the genotype combination searches for the populations at a site, which
+// are run concurrently on the genotyping pool
+class PopulationComboSearchTasks {
+public:
+    Parameters* parameters;
+    Samples* samples;
+    vector<Allele>* genotypeAlleles;
+    map<string, int>* inputAlleleCounts;
+    Real theta;
+    int estimatedMinorAllelesAtLocus;
+    // by task
+    vector<const string*> populations;
+    vector<SampleDataLikelihoods*> sampleDataLikelihoods;
+    vector<GenotypeComboResults*> genotypeCombos;
+    vector<list<GenotypeCombo>*> glMaxCombos; // NULL unless we report the GL maximum
+    vector<int> iterations;
+};
+
+void searchPopulationGenotypeCombos(int i, int thread, void* data) {
+
+    PopulationComboSearchTasks& tasks = *(PopulationComboSearchTasks*) data;
+    Parameters& parameters = *tasks.parameters;
+    Samples& samples = *tasks.samples;
+    vector<Allele>& genotypeAlleles = *tasks.genotypeAlleles;
+    map<string, int>& inputAlleleCounts = *tasks.inputAlleleCounts;
+    Real theta = tasks.theta;
+    int estimatedMinorAllelesAtLocus = tasks.estimatedMinorAllelesAtLocus;
+
+    const string& population = *tasks.populations.at(i);
+    SampleDataLikelihoods& sampleDataLikelihoods = *tasks.sampleDataLikelihoods.at(i);
+    GenotypeComboResults& populationGenotypeCombos = *tasks.genotypeCombos.at(i);
+    int& genotypingTotalIterations = tasks.iterations.at(i);
+
+    DEBUG2("genqerating banded genotype combinations from " << sampleDataLikelihoods.size() << " sample genotypes in population " << population);
+
+    // cap the number of iterations at 2 x the number of alternate alleles
+    // max it at parameters.genotypingMaxIterations iterations, min at 10
+    int itermax = min(max(10, 2 * estimatedMinorAllelesAtLocus), parameters.genotypingMaxIterations);
+    //int itermax = parameters.genotypingMaxIterations;
+
+    // XXX HACK
+    // passing 0 for bandwidth and banddepth means "exhaustive local search"
+    // this produces properly normalized GQ's at polyallelic sites
+    int adjustedBandwidth = 0;
+    int adjustedBanddepth = 0;
+    // however, this can lead to huge performance problems at complex sites,
+    // so we implement this hack...
+    if (parameters.genotypingMaxBandDepth > 0 &&
+        genotypeAlleles.size() > parameters.genotypingMaxBandDepth) {
+        adjustedBandwidth = 1;
+        adjustedBanddepth = parameters.genotypingMaxBandDepth;
+    }
+
+    GenotypeCombo nullCombo;
+    SampleDataLikelihoods nullSampleDataLikelihoods;
+
+    // this is the genotype-likelihood maximum
+    if (parameters.reportGenotypeLikelihoodMax) {
+        GenotypeCombo comboKing;
+        vector<int> initialPosition;
+        initialPosition.assign(sampleDataLikelihoods.size(), 0);
+        SampleDataLikelihoods nullDataLikelihoods; // dummy variable
+        makeComboByDatalLikelihoodRank(comboKing,
+                                       initialPosition,
+                                       sampleDataLikelihoods,
+                                       nullDataLikelihoods,
+                                       inputAlleleCounts,
+                                       theta,
+                                       parameters.pooledDiscrete,
+                                       parameters.ewensPriors,
+                                       parameters.permute,
+                                       parameters.hwePriors,
+                                       parameters.obsBinomialPriors,
+                                       parameters.alleleBalancePriors,
+                                       parameters.diffusionPriorScalar);
+
+        // computed here, as it needs only this population's likelihoods
+        tasks.glMaxCombos.at(i)->push_back(comboKing);
+    }
+
+    // search much longer for convergence
+    convergentGenotypeComboSearch(
+        populationGenotypeCombos,
+        nullCombo,
+        sampleDataLikelihoods, // vary everything
+        sampleDataLikelihoods,
+        nullSampleDataLikelihoods,
+        samples,
+        genotypeAlleles,
+        inputAlleleCounts,
+        adjustedBandwidth,
+        adjustedBanddepth,
+        theta,
+        parameters.pooledDiscrete,
+        parameters.ewensPriors,
+        parameters.permute,
+        parameters.hwePriors,
+        parameters.obsBinomialPriors,
+        parameters.alleleBalancePriors,
+        parameters.diffusionPriorScalar,
+        itermax,
+        genotypingTotalIterations,
+        true); // add homozygous combos
+        // ^^ combo results are sorted by default
+
+}
+
+// calculates genotype likelihoods at the site and searches the space of
+// genotypings across samples for the best one
+// reads only the parser's sample lists and parameters, which don't change
+// as it moves, so this may run after the parser has left the site
+void genotypeSite(AlleleParser* parser,
+                  Site& site,
+                  Bias& observationBias,
+                  Contamination& contaminationEstimates,
+                  ThreadPool& pool) {
+
+    Parameters& parameters = parser->parameters;
+
+    Samples& samples = site.samples;
+    vector<Allele>& genotypeAlleles = site.genotypeAlleles;
+    string& referenceBase = site.referenceBase;
+    bool usingNull = site.usingNull;
+
+    // estimate theta using the haplotype length
+    Real theta = parameters.TH * site.haplotypeLength;
+
+    // generate possible genotypes
+
+    // for each possible ploidy in the dataset, generate all possible genotypes
+    map<int, vector<Genotype> >& genotypesByPloidy = site.genotypesByPloidy;
+    genotypesByPloidy = getGenotypesByPloidy(site.ploidies, genotypeAlleles);
+    int numCopiesOfLocus = site.copiesOfLocus;
+
+
+    DEBUG2("generated all possible genotypes:");
+    if (parameters.debug2) {
+        for (map<int, vector<Genotype> >::iterator s = genotypesByPloidy.begin(); s != genotypesByPloidy.end(); ++s) {
+            vector<Genotype>& genotypes = s->second;
+            for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
+                DEBUG2(*g);
             }
-            DEBUG2("after trace generation");
         }
+    }
 
-        if (!parser->inTarget()) {
-            DEBUG("position: " << parser->currentSequenceName << ":" << (long unsigned int) parser->currentPosition + 1
-                  << " is not inside any targets, skipping");
+    // get estimated allele frequencies using sum of estimated qualities
+    map<string, double> estimatedAlleleFrequencies = samples.estimatedAlleleFrequencies();
+    double estimatedMaxAlleleFrequency = 0;
+    double estimatedMaxAlleleCount = 0;
+    double estimatedMajorFrequency = estimatedAlleleFrequencies[referenceBase];
+    if (estimatedMajorFrequency < 0.5) estimatedMajorFrequency = 1-estimatedMajorFrequency;
+    double estimatedMinorFrequency = 1-estimatedMajorFrequency;
+    //cerr << "num copies of locus " << numCopiesOfLocus << endl;
+    int estimatedMinorAllelesAtLocus = max(1, (int) ceil((double) numCopiesOfLocus * estimatedMinorFrequency));
+    //cerr << "estimated minor frequency " << estimatedMinorFrequency << endl;
+    //cerr << "estimated minor count " << estimatedMinorAllelesAtLocus << endl;
+    
+
+    Results& results = site.results;
+    map<string, vector<vector<SampleDataLikelihood> > >& sampleDataLikelihoodsByPopulation = site.sampleDataLikelihoodsByPopulation;
+    map<string, vector<vector<SampleDataLikelihood> > > variantSampleDataLikelihoodsByPopulation;
+    map<string, vector<vector<SampleDataLikelihood> > > invariantSampleDataLikelihoodsByPopulation;
+
+    map<string, int> inputAlleleCounts;
+    int inputLikelihoodCount = 0;
+
+    DEBUG2("calculating data likelihoods");
+    // calculate data likelihoods
+    // samples are independent here, so we calculate them on the pool and
+    // then collect the results in sample order
+    SampleDataLikelihoodTasks tasks;
+    tasks.parameters = &parameters;
+    tasks.observationBias = &observationBias;
+    tasks.contaminationEstimates = &contaminationEstimates;
+    tasks.genotypeAlleles = &genotypeAlleles;
+    tasks.estimatedAlleleFrequencies = &estimatedAlleleFrequencies;
+    tasks.usingNull = usingNull;
+    //for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
+    for (vector<string>::iterator n = parser->sampleList.begin(); n != parser->sampleList.end(); ++n) {
+
+        //string sampleName = s->first;
+        string& sampleName = *n;
+        //DEBUG2("sample: " << sampleName);
+        //Sample& sample = s->second;
+        if (samples.find(sampleName) == samples.end()
+            && !(site.hasInputVariantAlleles
+                 || parameters.reportMonomorphic)) {
             continue;
         }
+        tasks.sampleNames.push_back(&sampleName);
+        tasks.sampleIndexes.push_back(n - parser->sampleList.begin());
+        tasks.samples.push_back(&samples[sampleName]);
+        tasks.genotypes.push_back(&genotypesByPloidy[site.samplePloidies[sampleName]]);
+    }
+    tasks.probs.resize(tasks.samples.size());
+    tasks.genotypesWithObs.resize(pool.size());
+    tasks.observations.resize(pool.size());
+    pool.run(tasks.samples.size(), calculateSampleDataLikelihoods, &tasks);
 
-        int coverage = countAlleles(samples);
+    for (int i = 0; i < tasks.samples.size(); ++i) {
 
-        DEBUG("position: " << parser->currentSequenceName << ":" << (long unsigned int) parser->currentPosition + 1 << " coverage: " << coverage);
+        string& sampleName = *tasks.sampleNames.at(i);
+        Sample& sample = *tasks.samples.at(i);
+        vector<pair<Genotype*, Real> >& probs = tasks.probs.at(i);
 
-        if (!parser->hasInputVariantAllelesAtCurrentPosition()) {
-            // skips 0-coverage regions
-            if (coverage == 0) {
-                DEBUG("no alleles left at this site after filtering");
-                continue;
-            } else if (coverage < parameters.minCoverage) {
-                DEBUG("post-filtering coverage of " << coverage << " is less than --min-coverage of " << parameters.minCoverage);
-                continue;
-            } else if (parameters.onlyUseInputAlleles) {
-                DEBUG("no input alleles, but using only input alleles for analysis, skipping position");
-                continue;
+        // skip this sample if we have no observations supporting any of the genotypes we are going to evaluate
+        if (probs.empty()) {
+            continue;
+        }
+
+#ifdef VERBOSE_DEBUG
+        if (parameters.debug2) {
+            for (vector<pair<Genotype*, Real> >::iterator p = probs.begin(); p != probs.end(); ++p) {
+                cerr << site.sequenceName << "," << (long unsigned int) site.position + 1 << ","
+                     << sampleName << ",likelihood," << *(p->first) << "," << p->second << endl;
             }
+        }
+#endif
 
-            DEBUG2("coverage " << parser->currentSequenceName << ":" << parser->currentPosition << " == " << coverage);
+        Result& sampleData = results[sampleName];
+        sampleData.name = sampleName;
+        sampleData.observations = &sample;
+        sampleData.observationCounters = sampleObservationCounters(sample, genotypeAlleles);
+        for (vector<pair<Genotype*, Real> >::iterator p = probs.begin(); p != probs.end(); ++p) {
+            sampleData.push_back(SampleDataLikelihood(sampleName, &sample, p->first, p->second, 0));
+            sampleData.back().observationCounters = &sampleData.observationCounters;
+        }
 
-            // establish a set of possible alternate alleles to evaluate at this location
+        sortSampleDataLikelihoods(sampleData);
 
-            if (!parameters.reportMonomorphic
-                && !sufficientAlternateObservations(samples, parameters.minAltCount, parameters.minAltFraction)) {
-                DEBUG("insufficient alternate observations");
-                continue;
-            }
-            if (parameters.reportMonomorphic) {
-                DEBUG("calling at site even though there are no alternate observations");
+        const string& population = parser->samplePopulations.at(tasks.sampleIndexes.at(i));
+        vector<vector<SampleDataLikelihood> >& sampleDataLikelihoods = sampleDataLikelihoodsByPopulation[population];
+        vector<vector<SampleDataLikelihood> >& variantSampleDataLikelihoods = variantSampleDataLikelihoodsByPopulation[population];
+        vector<vector<SampleDataLikelihood> >& invariantSampleDataLikelihoods = invariantSampleDataLikelihoodsByPopulation[population];
+
+        if (parameters.genotypeVariantThreshold != 0) {
+            if (sampleData.size() > 1
+                && abs(sampleData.at(1).prob - sampleData.front().prob)
+                < parameters.genotypeVariantThreshold) {
+                variantSampleDataLikelihoods.push_back(sampleData);
+            } else {
+                invariantSampleDataLikelihoods.push_back(sampleData);
             }
         } else {
-            /*
-            cerr << "has input variants at " << parser->currentSequenceName << ":" << parser->currentPosition << endl;
-            vector<Allele>& inputs = parser->inputVariantAlleles[parser->currentSequenceName][parser->currentPosition];
-            for (vector<Allele>::iterator a = inputs.begin(); a != inputs.end(); ++a) {
-                cerr << *a << endl;
-            }
-            */
+            variantSampleDataLikelihoods.push_back(sampleData);
         }
+        sampleDataLikelihoods.push_back(sampleData);
+
+    }
+
+    DEBUG2("finished calculating data likelihoods");
 
+
+    // this section is a hack to make output of trace identical to BamBayes trace
+    // and also outputs the list of samples
+    vector<bool> samplesWithData;
+    if (parameters.trace) {
         // to ensure proper ordering of output stream
         vector<string> sampleListPlusRef;
-
         for (vector<string>::iterator s = parser->sampleList.begin(); s != parser->sampleList.end(); ++s) {
             sampleListPlusRef.push_back(*s);
         }
         if (parameters.useRefAllele) {
-            sampleListPlusRef.push_back(parser->currentSequenceName);
+            sampleListPlusRef.push_back(site.sequenceName);
         }
+        parser->traceFile << site.sequenceName << "," << (long unsigned int) site.position + 1 << ",samples,";
+        for (vector<string>::iterator s = sampleListPlusRef.begin(); s != sampleListPlusRef.end(); ++s) {
+            if (parameters.trace) parser->traceFile << *s << ":";
+            Results::iterator r = results.find(*s);
+            if (r != results.end()) {
+                samplesWithData.push_back(true);
+            } else {
+                samplesWithData.push_back(false);
+            }
+        }
+        parser->traceFile << endl;
+    }
 
-        // establish genotype alleles using input filters
-        map<string, vector<Allele*> > alleleGroups;
-        groupAlleles(samples, alleleGroups);
-        DEBUG2("grouped alleles by equivalence");
-
-        vector<Allele> genotypeAlleles = parser->genotypeAlleles(alleleGroups, samples, parameters.onlyUseInputAlleles);
-
-        // always include the reference allele as a possible genotype, even when we don't include it by default
-        if (!parameters.useRefAllele) {
-            vector<Allele> refAlleleVector;
-            refAlleleVector.push_back(genotypeAllele(ALLELE_REFERENCE, string(1, parser->currentReferenceBase), 1, "1M"));
-            genotypeAlleles = alleleUnion(genotypeAlleles, refAlleleVector);
+    // if somehow we get here without any possible sample genotype likelihoods, bail out
+    bool hasSampleLikelihoods = false;
+    for (map<string, vector<vector<SampleDataLikelihood> > >::iterator s = sampleDataLikelihoodsByPopulation.begin(); s != sampleDataLikelihoodsByPopulation.end(); ++s) {
+        if (!s->second.empty()) {
+            hasSampleLikelihoods = true;
+            break;
         }
+    }
+    if (!hasSampleLikelihoods) {
+        return;
+    }
 
-        map<string, vector<Allele*> > partialObservationGroups;
-        map<Allele*, set<Allele*> > partialObservationSupport;
+    DEBUG2("calulating combo posteriors over " << parser->populationSamples.size() << " populations");
 
-        // build haplotype alleles matching the current longest allele (often will do nothing)
-        // this will adjust genotypeAlleles if changes are made
-        DEBUG("building haplotype alleles, currently there are " << genotypeAlleles.size() << " genotype alleles");
-        DEBUG(genotypeAlleles);
-        parser->buildHaplotypeAlleles(genotypeAlleles,
-                                      samples,
-                                      alleleGroups,
-                                      partialObservationGroups,
-                                      partialObservationSupport,
-                                      allowedAlleleTypes);
-        DEBUG("built haplotype alleles, now there are " << genotypeAlleles.size() << " genotype alleles");
-        DEBUG(genotypeAlleles);
+    // XXX
+    // TODO skip these steps in the case that there is only one population?
 
-        string referenceBase = parser->currentReferenceHaplotype();
 
+    // we provide p(var|data), or the probability that the location has
+    // variation between individuals relative to the probability that it
+    // has no variation
+    //
+    // in other words:
+    // p(var|d) = 1 - p(AA|d) - p(TT|d) - P(GG|d) - P(CC|d)
+    //
+    // the approach is go through all the homozygous combos
+    // and then subtract this from 1... resolving p(var|d)
 
-        /* for debugging
-        for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
-            string sampleName = s->first;
-            Sample& sample = s->second;
-            cerr << sampleName << ": " << sample << endl;
-        }
-        */
+    BigFloat pVar = 1.0;
+    BigFloat& pHom = site.pHom;
+    pHom = 0.0;
 
-        // re-calculate coverage, as this could change now that we've built haplotype alleles
-        coverage = countAlleles(samples);
+    Real& bestComboOddsRatio = site.bestComboOddsRatio;
 
-        // estimate theta using the haplotype length
-        long double theta = parameters.TH * parser->lastHaplotypeLength;
+    bool bestOverallComboIsHet = false;
+    GenotypeCombo& bestCombo = site.bestCombo;
 
-        // if we have only one viable allele, we don't have evidence for variation at this site
-        if (!parser->hasInputVariantAllelesAtCurrentPosition() && !parameters.reportMonomorphic && genotypeAlleles.size() <= 1 && genotypeAlleles.front().isReference()) {
-            DEBUG("no alternate genotype alleles passed filters at " << parser->currentSequenceName << ":" << parser->currentPosition);
-            continue;
-        }
-        DEBUG("genotype alleles: " << genotypeAlleles);
-
-        // add the null genotype
-        bool usingNull = false;
-        if (parameters.excludeUnobservedGenotypes && genotypeAlleles.size() > 2) {
-            genotypeAlleles.push_back(nullAllele);
-            usingNull = true;
+    // what a hack...
+    /*
+    if (parameters.trace) {
+        for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
+            vector<Genotype*> comboGenotypes;
+            for (GenotypeCombo::iterator g = gc->begin(); g != gc->end(); ++g)
+                comboGenotypes.push_back((*g)->genotype);
+            Real posteriorProb = gc->posteriorProb;
+            Real dataLikelihoodln = gc->probObsGivenGenotypes;
+            Real priorln = gc->posteriorProb;
+            Real priorlnG_Af = gc->priorProbG_Af;
+            Real priorlnAf = gc->priorProbAf;
+            Real priorlnBin = gc->priorProbObservations;
+
+            parser->traceFile << parser->currentSequenceName << "," << (long unsigned int) parser->currentPosition + 1 << ",genotypecombo,";
+
+            int j = 0;
+            GenotypeCombo::iterator i = gc->begin();
+            for (vector<bool>::iterator d = samplesWithData.begin(); d != samplesWithData.end(); ++d) {
+                if (*d) {
+                    parser->traceFile << IUPAC(*(*i)->genotype);
+                    ++i;
+                } else {
+                    parser->traceFile << "?";
+                }
+            }
+            // TODO cleanup this and above
+            parser->traceFile 
+                << "," << dataLikelihoodln
+                << "," << priorln
+                << "," << priorlnG_Af
+                << "," << priorlnAf
+                << "," << priorlnBin
+                << "," << posteriorProb
+                << "," << safe_exp(posteriorProb - posteriorNormalizer)
+                << endl;
         }
+    }
+    */
+
+    // the second clause guards against float underflow causing us not to output a position
+    // practically, parameters.PVL == 0 means "report all genotypes which pass our input filters"
+
+
+    GenotypeCombo bestGenotypeComboByMarginals;
+    vector<vector<SampleDataLikelihood> > allSampleDataLikelihoods;
+
+    DEBUG("searching genotype space");
+
+    // resample the posterior, this time without bounds on the
+    // samples we vary, ensuring that we can generate marginals for
+    // all sample/genotype combinations
+
+    //SampleDataLikelihoods marginalLikelihoods = sampleDataLikelihoods;  // heavyweight copy...
+    map<string, GenotypeComboResults> genotypeCombosByPopulation;
+    int& genotypingTotalIterations = site.genotypingTotalIterations; // tally total iterations required to reach convergence
+    map<string, list<GenotypeCombo> > glMaxCombos;
+
+    // the populations are independent, so we search them concurrently
+    PopulationComboSearchTasks searches;
+    searches.parameters = &parameters;
+    searches.samples = &samples;
+    searches.genotypeAlleles = &genotypeAlleles;
+    searches.inputAlleleCounts = &inputAlleleCounts;
+    searches.theta = theta;
+    searches.estimatedMinorAllelesAtLocus = estimatedMinorAllelesAtLocus;
+    for (map<string, SampleDataLikelihoods>::iterator p = sampleDataLikelihoodsByPopulation.begin(); p != sampleDataLikelihoodsByPopulation.end(); ++p) {
+        const string& population = p->first;
+        searches.populations.push_back(&population);
+        searches.sampleDataLikelihoods.push_back(&p->second);
+        searches.genotypeCombos.push_back(&genotypeCombosByPopulation[population]);
+        searches.glMaxCombos.push_back(parameters.reportGenotypeLikelihoodMax ? &glMaxCombos[population] : NULL);
+    }
+    searches.iterations.resize(searches.populations.size(), 0);
+    pool.run(searches.populations.size(), searchPopulationGenotypeCombos, &searches);
+    // as in a serial search, report the iterations of the last population
+    if (!searches.iterations.empty()) {
+        genotypingTotalIterations = searches.iterations.back();
+    }
 
-        ++processed_sites;
+    // generate the GL max combo
+    GenotypeCombo glMax;
+    if (parameters.reportGenotypeLikelihoodMax) {
+        list<GenotypeCombo> glMaxGenotypeCombos;
+        combinePopulationCombos(glMaxGenotypeCombos, glMaxCombos);
+        glMax = glMaxGenotypeCombos.front();
+    }
 
-        // generate possible genotypes
+    // accumulate combos from independently-calculated populations into the list of combos
+    GenotypeComboResults genotypeCombos; // build new combos into this list
+    combinePopulationCombos(genotypeCombos, genotypeCombosByPopulation);
+
+    // the posterior normalizer is totalled over all the combos scored, not
+    // only those kept
+    Real posteriorNormalizer = genotypeCombos.posteriorNormalizer;
+
+    pVar = 1.0;
+    pHom = 0.0;
+    // calculates pvar and gets the best het combo
+    // the homozygous combos are always kept, so the kept combos have all the
+    // homozygous reference mass
+    list<GenotypeCombo>::iterator gc = genotypeCombos.combos.begin();
+    bestCombo = *gc;
+    for ( ; gc != genotypeCombos.combos.end(); ++gc) {
+        if (gc->isHomozygous() && gc->alleles().front() == referenceBase) {
+            pVar -= big_exp(gc->posteriorProb - posteriorNormalizer);
+            pHom += big_exp(gc->posteriorProb - posteriorNormalizer);
+        } else if (gc == genotypeCombos.combos.begin()) {
+            bestOverallComboIsHet = true;
+        }
+    }
 
-        // for each possible ploidy in the dataset, generate all possible genotypes
-        vector<int> ploidies = parser->currentPloidies(samples);
-        map<int, vector<Genotype> > genotypesByPloidy = getGenotypesByPloidy(ploidies, genotypeAlleles);
-        int numCopiesOfLocus = parser->copiesOfLocus(samples);
+    // odds ratio between the first and second-best combinations
+    if (genotypeCombos.combos.size() > 1) {
+        bestComboOddsRatio = genotypeCombos.front().posteriorProb - (++genotypeCombos.combos.begin())->posteriorProb;
+    }
 
+    if (parameters.calculateMarginals) {
+        // make a combined, all-populations sample data likelihoods vector to accumulate marginals
+        SampleDataLikelihoods allSampleDataLikelihoods;
+        for (map<string, SampleDataLikelihoods>::iterator p = sampleDataLikelihoodsByPopulation.begin(); p != sampleDataLikelihoodsByPopulation.end(); ++p) {
+            SampleDataLikelihoods& sdls = p->second;
+            allSampleDataLikelihoods.reserve(allSampleDataLikelihoods.size() + distance(sdls.begin(), sdls.end()));
+            allSampleDataLikelihoods.insert(allSampleDataLikelihoods.end(), sdls.begin(), sdls.end());
+        }
+        // calculate the marginal likelihoods for this population
+        marginalGenotypeLikelihoods(genotypeCombos, allSampleDataLikelihoods);
+        // store the marginal data likelihoods in the results, for easy parsing
+        // like a vector -> map conversion...
+        results.update(allSampleDataLikelihoods);
+    }
 
-        DEBUG2("generated all possible genotypes:");
-        if (parameters.debug2) {
-            for (map<int, vector<Genotype> >::iterator s = genotypesByPloidy.begin(); s != genotypesByPloidy.end(); ++s) {
-                vector<Genotype>& genotypes = s->second;
-                for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
-                    DEBUG2(*g);
+    vector<Allele>& alts = site.alts;
+    if (parameters.onlyUseInputAlleles
+        || parameters.reportAllHaplotypeAlleles
+        || parameters.pooledContinuous) {
+        //alts = genotypeAlleles;
+        for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
+            if (!a->isReference()) {
+                alts.push_back(*a);
+            }
+        }
+    } else {
+        // get the unique alternate alleles in this combo, sorted by frequency in the combo
+        vector<pair<Allele, int> > alternates = alternateAlleles(bestCombo, referenceBase);
+        for (vector<pair<Allele, int> >::iterator a = alternates.begin(); a != alternates.end(); ++a) {
+            Allele& alt = a->first;
+            if (!alt.isNull() && !alt.isReference())
+                alts.push_back(alt);
+        }
+        // if there are no alternate alleles in the best combo, use the genotype alleles
+        // XXX ...
+        if (alts.empty()) {
+            for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
+                if (!a->isReference()) {
+                    alts.push_back(*a);
                 }
             }
         }
+    }
 
-        // get estimated allele frequencies using sum of estimated qualities
-        map<string, double> estimatedAlleleFrequencies = samples.estimatedAlleleFrequencies();
-        double estimatedMaxAlleleFrequency = 0;
-        double estimatedMaxAlleleCount = 0;
-        double estimatedMajorFrequency = estimatedAlleleFrequencies[referenceBase];
-        if (estimatedMajorFrequency < 0.5) estimatedMajorFrequency = 1-estimatedMajorFrequency;
-        double estimatedMinorFrequency = 1-estimatedMajorFrequency;
-        //cerr << "num copies of locus " << numCopiesOfLocus << endl;
-        int estimatedMinorAllelesAtLocus = max(1, (int) ceil((double) numCopiesOfLocus * estimatedMinorFrequency));
-        //cerr << "estimated minor frequency " << estimatedMinorFrequency << endl;
-        //cerr << "estimated minor count " << estimatedMinorAllelesAtLocus << endl;
-        
-
-        Results results;
-        map<string, vector<vector<SampleDataLikelihood> > > sampleDataLikelihoodsByPopulation;
-        map<string, vector<vector<SampleDataLikelihood> > > variantSampleDataLikelihoodsByPopulation;
-        map<string, vector<vector<SampleDataLikelihood> > > invariantSampleDataLikelihoodsByPopulation;
-
-        map<string, int> inputAlleleCounts;
-        int inputLikelihoodCount = 0;
-
-        DEBUG2("calculating data likelihoods");
-        // calculate data likelihoods
-        //for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
-        for (vector<string>::iterator n = parser->sampleList.begin(); n != parser->sampleList.end(); ++n) {
-
-            //string sampleName = s->first;
-            string& sampleName = *n;
-            //DEBUG2("sample: " << sampleName);
-            //Sample& sample = s->second;
-            if (samples.find(sampleName) == samples.end()
-                && !(parser->hasInputVariantAllelesAtCurrentPosition()
-                     || parameters.reportMonomorphic)) {
-                continue;
+    // reporting the GL maximum *over all alleles*
+    if (parameters.reportGenotypeLikelihoodMax) {
+        bestCombo = glMax;
+    } else {
+        // the default behavior is to report the GL maximum genotyping over the alleles in the best posterior genotyping
+
+        // select the maximum-likelihood GL given the alternates we have
+        // this is not the same thing as the GL max over all alleles!
+        // it is the GL max over the selected alleles at this point
+
+        vector<Allele> alleles = alts;
+        for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
+            if (a->isReference()) {
+                alleles.push_back(*a);
             }
-            Sample& sample = samples[sampleName];
-            vector<Genotype>& genotypes = genotypesByPloidy[parser->currentSamplePloidy(sampleName)];
-            vector<Genotype*> genotypesWithObs;
-            for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
-                if (parameters.excludePartiallyObservedGenotypes) {
-                    if (g->sampleHasSupportingObservationsForAllAlleles(sample)) {
-                        genotypesWithObs.push_back(&*g);
-                    }
-                } else if (parameters.excludeUnobservedGenotypes && usingNull) {
-                    if (g->sampleHasSupportingObservations(sample)) {
-                        //cerr << sampleName << " has suppporting obs for " << *g << endl;
-                        genotypesWithObs.push_back(&*g);
-                    } else if (g->hasNullAllele() && g->homozygous) {
-                        // this genotype will never be added if we are running in observed-only mode, but
-                        // we still need it for consistency
-                        genotypesWithObs.push_back(&*g);
+        }
+        map<string, list<GenotypeCombo> > glMaxComboBasedOnAltsByPop;
+        for (map<string, SampleDataLikelihoods>::iterator p = sampleDataLikelihoodsByPopulation.begin(); p != sampleDataLikelihoodsByPopulation.end(); ++p) {
+            const string& population = p->first;
+            SampleDataLikelihoods& sampleDataLikelihoods = p->second;
+            GenotypeCombo glMaxBasedOnAlts;
+            for (SampleDataLikelihoods::iterator v = sampleDataLikelihoods.begin(); v != sampleDataLikelihoods.end(); ++v) {
+                SampleDataLikelihood* m = NULL;
+                for (vector<SampleDataLikelihood>::iterator d = v->begin(); d != v->end(); ++d) {
+                    if (d->genotype->matchesAlleles(alleles)) {
+                        m = &*d;
+                        break;
                     }
-                } else {
-                    genotypesWithObs.push_back(&*g);
                 }
+                assert(m != NULL);
+                glMaxBasedOnAlts.push_back(m);
             }
+            glMaxComboBasedOnAltsByPop[population].push_back(glMaxBasedOnAlts);
+        }
+        list<GenotypeCombo> glMaxBasedOnAltsGenotypeCombos; // build new combos into this list
+        combinePopulationCombos(glMaxBasedOnAltsGenotypeCombos, glMaxComboBasedOnAltsByPop);
+        bestCombo = glMaxBasedOnAltsGenotypeCombos.front();
+    }
 
-            // skip this sample if we have no observations supporting any of the genotypes we are going to evaluate
-            if (genotypesWithObs.empty()) {
-                continue;
-            }
+    DEBUG("best combo: " << bestCombo);
 
-            vector<pair<Genotype*, long double> > probs
-                = probObservedAllelesGivenGenotypes(sample, genotypesWithObs,
-                                                    parameters.RDF, parameters.useMappingQuality,
-                                                    observationBias, parameters.standardGLs,
-                                                    genotypeAlleles,
-                                                    contaminationEstimates,
-                                                    estimatedAlleleFrequencies);
-            
-#ifdef VERBOSE_DEBUG
-            if (parameters.debug2) {
-                for (vector<pair<Genotype*, long double> >::iterator p = probs.begin(); p != probs.end(); ++p) {
-                    cerr << parser->currentSequenceName << "," << (long unsigned int) parser->currentPosition + 1 << ","
-                         << sampleName << ",likelihood," << *(p->first) << "," << p->second << endl;
-                }
-            }
-#endif
+    site.genotyped = true;
 
-            Result& sampleData = results[sampleName];
-            sampleData.name = sampleName;
-            sampleData.observations = &sample;
-            for (vector<pair<Genotype*, long double> >::iterator p = probs.begin(); p != probs.end(); ++p) {
-                sampleData.push_back(SampleDataLikelihood(sampleName, &sample, p->first, p->second, 0));
-            }
+}
 
-            sortSampleDataLikelihoods(sampleData);
+// writes the VCF record for the site, or its alleles to the failed alleles
+// file if it doesn't pass --pvar
+void reportSite(AlleleParser* parser,
+                Site& site,
+                ostream& out,
+                ostream& failed) {
 
-            string& population = parser->samplePopulation[sampleName];
-            vector<vector<SampleDataLikelihood> >& sampleDataLikelihoods = sampleDataLikelihoodsByPopulation[population];
-            vector<vector<SampleDataLikelihood> >& variantSampleDataLikelihoods = variantSampleDataLikelihoodsByPopulation[population];
-            vector<vector<SampleDataLikelihood> >& invariantSampleDataLikelihoods = invariantSampleDataLikelihoodsByPopulation[population];
+    Parameters& parameters = parser->parameters;
 
-            if (parameters.genotypeVariantThreshold != 0) {
-                if (sampleData.size() > 1
-                    && abs(sampleData.at(1).prob - sampleData.front().prob)
-                    < parameters.genotypeVariantThreshold) {
-                    variantSampleDataLikelihoods.push_back(sampleData);
-                } else {
-                    invariantSampleDataLikelihoods.push_back(sampleData);
-                }
-            } else {
-                variantSampleDataLikelihoods.push_back(sampleData);
-            }
-            sampleDataLikelihoods.push_back(sampleData);
+    if (!site.genotyped) {
+        return;
+    }
 
+    if (!site.alts.empty() && (1 - site.pHom.ToDouble()) >= parameters.PVL || parameters.PVL == 0) {
+
+        vcf::Variant var(parser->variantCallFile);
+
+        out << site.results.vcf(
+            var,
+            site.pHom,
+            site.bestComboOddsRatio,
+            site.samples,
+            site.referenceBase,
+            site.alts,
+            site.repeats,
+            site.genotypingTotalIterations,
+            parser->sampleList,
+            site.coverage,
+            site.bestCombo,
+            site.alleleGroups,
+            site.partialObservationGroups,
+            site.partialObservationSupport,
+            site.genotypesByPloidy,
+            parser->sequencingTechnologies,
+            site.sequenceName,
+            site.position,
+            site.homopolymerRuns,
+            parameters)
+            << "\n";
+
+    } else if (!parameters.failedFile.empty()) {
+        // get the unique alternate alleles in this combo, sorted by frequency in the combo
+        long unsigned int position = site.position;
+        for (vector<Allele>::iterator ga =  site.genotypeAlleles.begin(); ga != site.genotypeAlleles.end(); ++ga) {
+            if (ga->type == ALLELE_REFERENCE)
+                continue;
+            failed
+                << site.sequenceName << "\t"
+                << position << "\t"
+                << position + ga->length << "\t"
+                << *ga << "\n";
         }
+        // BED format
+    }
 
-        DEBUG2("finished calculating data likelihoods");
+}
 
 
-        // this section is a hack to make output of trace identical to BamBayes trace
-        // and also outputs the list of samples
-        vector<bool> samplesWithData;
-        if (parameters.trace) {
-            parser->traceFile << parser->currentSequenceName << "," << (long unsigned int) parser->currentPosition + 1 << ",samples,";
-            for (vector<string>::iterator s = sampleListPlusRef.begin(); s != sampleListPlusRef.end(); ++s) {
-                if (parameters.trace) parser->traceFile << *s << ":";
-                Results::iterator r = results.find(*s);
-                if (r != results.end()) {
-                    samplesWithData.push_back(true);
-                } else {
-                    samplesWithData.push_back(false);
-                }
-            }
-            parser->traceFile << endl;
+// a thread running one of the later stages of --pipeline, which takes sites
+// from its input queue, and passes them on to its output queue
+// a NULL site marks the end of a shard, or the end of the input if stopping
+// is set
+struct PipelineStage {
+    pthread_t thread;
+    AlleleParser* parser;
+    BoundedQueue<Site*>* input;
+    BoundedQueue<Site*>* output;
+    ostream* out;
+    ostream* failed;
+    Bias* observationBias;
+    Contamination* contaminationEstimates;
+    ThreadPool* pool;
+    Checkpoint* checkpoint;
+    volatile bool stopping;
+};
+
+void* genotypeSites(void* arg) {
+    PipelineStage* stage = (PipelineStage*) arg;
+    Site* site;
+    do {
+        site = stage->input->front();
+        stage->input->pop();
+        if (site) {
+            genotypeSite(stage->parser, *site,
+                         *stage->observationBias, *stage->contaminationEstimates,
+                         *stage->pool);
         }
+        stage->output->push(site);
+    } while (site || !stage->stopping);
+    return NULL;
+}
 
-        // if somehow we get here without any possible sample genotype likelihoods, bail out
-        bool hasSampleLikelihoods = false;
-        for (map<string, vector<vector<SampleDataLikelihood> > >::iterator s = sampleDataLikelihoodsByPopulation.begin(); s != sampleDataLikelihoodsByPopulation.end(); ++s) {
-            if (!s->second.empty()) {
-                hasSampleLikelihoods = true;
-                break;
+// the reporter passes on the NULL at the end of each shard, once it has
+// written all of its sites
+void* reportSites(void* arg) {
+    PipelineStage* stage = (PipelineStage*) arg;
+    while (true) {
+        Site* site = stage->input->front();
+        stage->input->pop();
+        if (site) {
+            reportSite(stage->parser, *site, *stage->out, *stage->failed);
+            if (stage->checkpoint) {
+                stage->checkpoint->update(site->target, site->position);
             }
+            delete site;
+        } else if (stage->stopping) {
+            break;
+        } else {
+            stage->output->push(site);
         }
-        if (!hasSampleLikelihoods) {
-            continue;
-        }
+    }
+    return NULL;
+}
 
-        DEBUG2("calulating combo posteriors over " << parser->populationSamples.size() << " populations");
-
-        // XXX
-        // TODO skip these steps in the case that there is only one population?
-
-
-        // we provide p(var|data), or the probability that the location has
-        // variation between individuals relative to the probability that it
-        // has no variation
-        //
-        // in other words:
-        // p(var|d) = 1 - p(AA|d) - p(TT|d) - P(GG|d) - P(CC|d)
-        //
-        // the approach is go through all the homozygous combos
-        // and then subtract this from 1... resolving p(var|d)
-
-        BigFloat pVar = 1.0;
-        BigFloat pHom = 0.0;
-
-        long double bestComboOddsRatio = 0;
-
-        bool bestOverallComboIsHet = false;
-        GenotypeCombo bestCombo; // = NULL;
-
-        // what a hack...
-        /*
-        if (parameters.trace) {
-            for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
-                vector<Genotype*> comboGenotypes;
-                for (GenotypeCombo::iterator g = gc->begin(); g != gc->end(); ++g)
-                    comboGenotypes.push_back((*g)->genotype);
-                long double posteriorProb = gc->posteriorProb;
-                long double dataLikelihoodln = gc->probObsGivenGenotypes;
-                long double priorln = gc->posteriorProb;
-                long double priorlnG_Af = gc->priorProbG_Af;
-                long double priorlnAf = gc->priorProbAf;
-                long double priorlnBin = gc->priorProbObservations;
-
-                parser->traceFile << parser->currentSequenceName << "," << (long unsigned int) parser->currentPosition + 1 << ",genotypecombo,";
-
-                int j = 0;
-                GenotypeCombo::iterator i = gc->begin();
-                for (vector<bool>::iterator d = samplesWithData.begin(); d != samplesWithData.end(); ++d) {
-                    if (*d) {
-                        parser->traceFile << IUPAC(*(*i)->genotype);
-                        ++i;
-                    } else {
-                        parser->traceFile << "?";
-                    }
-                }
-                // TODO cleanup this and above
-                parser->traceFile 
-                    << "," << dataLikelihoodln
-                    << "," << priorln
-                    << "," << priorlnG_Af
-                    << "," << priorlnAf
-                    << "," << priorlnBin
-                    << "," << posteriorProb
-                    << "," << safe_exp(posteriorProb - posteriorNormalizer)
-                    << endl;
-            }
+// the threads which callVariants hands its work to: the genotyping pool, and
+// with --pipeline the genotyping and reporting stages.  they are started once
+// for the run, or for each --threads worker, and reused for each shard.
+class CallingThreads {
+public:
+    CallingThreads(AlleleParser* parser, Bias& observationBias, Contamination& contaminationEstimates);
+    ~CallingThreads(void);
+    ThreadPool pool;
+    bool pipeline;
+    BoundedQueue<Site*> sitesToGenotype;
+    BoundedQueue<Site*> sitesToReport;
+    BoundedQueue<Site*> reportedShards;
+    PipelineStage genotyper;
+    PipelineStage reporter;
+};
+
+CallingThreads::CallingThreads(AlleleParser* parser, Bias& observationBias, Contamination& contaminationEstimates)
+    : pool(parser->parameters.genotypingThreads)
+    , pipeline(parser->parameters.pipeline)
+    , sitesToGenotype(SITE_QUEUE_SIZE)
+    , sitesToReport(SITE_QUEUE_SIZE)
+    , reportedShards(1)
+{
+    if (pipeline) {
+        genotyper.parser = parser;
+        genotyper.input = &sitesToGenotype;
+        genotyper.output = &sitesToReport;
+        genotyper.observationBias = &observationBias;
+        genotyper.contaminationEstimates = &contaminationEstimates;
+        genotyper.pool = &pool;
+        genotyper.checkpoint = NULL;
+        genotyper.stopping = false;
+        // the outputs are set by callVariants for each shard
+        reporter.parser = parser;
+        reporter.input = &sitesToReport;
+        reporter.output = &reportedShards;
+        reporter.out = NULL;
+        reporter.failed = NULL;
+        reporter.checkpoint = NULL;
+        reporter.stopping = false;
+        if (pthread_create(&genotyper.thread, NULL, genotypeSites, &genotyper)
+            || pthread_create(&reporter.thread, NULL, reportSites, &reporter)) {
+            ERROR("could not create thread");
+            exit(1);
         }
-        */
+    }
+}
 
-        // the second clause guards against float underflow causing us not to output a position
-        // practically, parameters.PVL == 0 means "report all genotypes which pass our input filters"
+CallingThreads::~CallingThreads(void) {
+    if (pipeline) {
+        genotyper.stopping = true;
+        reporter.stopping = true;
+        sitesToGenotype.push(NULL);
+        pthread_join(genotyper.thread, NULL);
+        pthread_join(reporter.thread, NULL);
+    }
+}
 
+// calls variants at each position the parser visits, writing VCF records to
+// out and alleles which fail --pvar to failed
+//
+// when processing a piece of a shard, we hand off half of what remains of it
+void callVariants(AlleleParser* parser,
+                      ostream& out,
+                      ostream& failed,
+                      Bias& observationBias,
+                      Contamination& contaminationEstimates,
+                      CallingThreads& threads,
+                      ShardQueue* shards = NULL,
+                      Shard* shard = NULL) {
 
-        GenotypeCombo bestGenotypeComboByMarginals;
-        vector<vector<SampleDataLikelihood> > allSampleDataLikelihoods;
+    Parameters& parameters = parser->parameters;
 
-        DEBUG("searching genotype space");
+    Samples samples;
 
-        // resample the posterior, this time without bounds on the
-        // samples we vary, ensuring that we can generate marginals for
-        // all sample/genotype combinations
+    int allowedAlleleTypes = ALLELE_REFERENCE;
+    if (parameters.allowSNPs) {
+        allowedAlleleTypes |= ALLELE_SNP;
+    }
+    if (parameters.allowIndels) {
+        allowedAlleleTypes |= ALLELE_INSERTION;
+        allowedAlleleTypes |= ALLELE_DELETION;
+    }
+    if (parameters.allowMNPs) {
+        allowedAlleleTypes |= ALLELE_MNP;
+    }
+    if (parameters.allowComplex) {
+        allowedAlleleTypes |= ALLELE_COMPLEX;
+    }
 
-        //SampleDataLikelihoods marginalLikelihoods = sampleDataLikelihoods;  // heavyweight copy...
-        map<string, list<GenotypeCombo> > genotypeCombosByPopulation;
-        int genotypingTotalIterations = 0; // tally total iterations required to reach convergence
-        map<string, list<GenotypeCombo> > glMaxCombos;
+    Allele nullAllele = genotypeAllele(ALLELE_NULL, "N", 1, "1N");
 
-        for (map<string, SampleDataLikelihoods>::iterator p = sampleDataLikelihoodsByPopulation.begin(); p != sampleDataLikelihoodsByPopulation.end(); ++p) {
+    // shards are checkpointed as they are written out
+    Checkpoint* checkpoint = shard ? NULL : parser->checkpoint;
 
-            const string& population = p->first;
-            SampleDataLikelihoods& sampleDataLikelihoods = p->second;
-            list<GenotypeCombo>& populationGenotypeCombos = genotypeCombosByPopulation[population];
-
-            DEBUG2("genqerating banded genotype combinations from " << sampleDataLikelihoods.size() << " sample genotypes in population " << population);
-
-            // cap the number of iterations at 2 x the number of alternate alleles
-            // max it at parameters.genotypingMaxIterations iterations, min at 10
-            int itermax = min(max(10, 2 * estimatedMinorAllelesAtLocus), parameters.genotypingMaxIterations);
-            //int itermax = parameters.genotypingMaxIterations;
-
-            // XXX HACK
-            // passing 0 for bandwidth and banddepth means "exhaustive local search"
-            // this produces properly normalized GQ's at polyallelic sites
-            int adjustedBandwidth = 0;
-            int adjustedBanddepth = 0;
-            // however, this can lead to huge performance problems at complex sites,
-            // so we implement this hack...
-            if (parameters.genotypingMaxBandDepth > 0 &&
-                genotypeAlleles.size() > parameters.genotypingMaxBandDepth) {
-                adjustedBandwidth = 1;
-                adjustedBanddepth = parameters.genotypingMaxBandDepth;
-            }
+    // the reporter is idle between shards, so we can point it at our outputs
+    if (parameters.pipeline) {
+        threads.reporter.out = &out;
+        threads.reporter.failed = &failed;
+        threads.reporter.checkpoint = checkpoint;
+    }
 
-            GenotypeCombo nullCombo;
-            SampleDataLikelihoods nullSampleDataLikelihoods;
-
-            // this is the genotype-likelihood maximum
-            if (parameters.reportGenotypeLikelihoodMax) {
-                GenotypeCombo comboKing;
-                vector<int> initialPosition;
-                initialPosition.assign(sampleDataLikelihoods.size(), 0);
-                SampleDataLikelihoods nullDataLikelihoods; // dummy variable
-                makeComboByDatalLikelihoodRank(comboKing,
-                                               initialPosition,
-                                               sampleDataLikelihoods,
-                                               nullDataLikelihoods,
-                                               inputAlleleCounts,
-                                               theta,
-                                               parameters.pooledDiscrete,
-                                               parameters.ewensPriors,
-                                               parameters.permute,
-                                               parameters.hwePriors,
-                                               parameters.obsBinomialPriors,
-                                               parameters.alleleBalancePriors,
-                                               parameters.diffusionPriorScalar);
-
-                glMaxCombos[population].push_back(comboKing);
-            }
+    unsigned long total_sites = 0;
+    unsigned long processed_sites = 0;
 
-            // search much longer for convergence
-            convergentGenotypeComboSearch(
-                populationGenotypeCombos,
-                nullCombo,
-                sampleDataLikelihoods, // vary everything
-                sampleDataLikelihoods,
-                nullSampleDataLikelihoods,
-                samples,
-                genotypeAlleles,
-                inputAlleleCounts,
-                adjustedBandwidth,
-                adjustedBanddepth,
-                theta,
-                parameters.pooledDiscrete,
-                parameters.ewensPriors,
-                parameters.permute,
-                parameters.hwePriors,
-                parameters.obsBinomialPriors,
-                parameters.alleleBalancePriors,
-                parameters.diffusionPriorScalar,
-                itermax,
-                genotypingTotalIterations,
-                true); // add homozygous combos
-                // ^^ combo results are sorted by default
-        }
-
-        // generate the GL max combo
-        GenotypeCombo glMax;
-        if (parameters.reportGenotypeLikelihoodMax) {
-            list<GenotypeCombo> glMaxGenotypeCombos;
-            combinePopulationCombos(glMaxGenotypeCombos, glMaxCombos);
-            glMax = glMaxGenotypeCombos.front();
-        }
-
-        // accumulate combos from independently-calculated populations into the list of combos
-        list<GenotypeCombo> genotypeCombos; // build new combos into this list
-        combinePopulationCombos(genotypeCombos, genotypeCombosByPopulation);
-        // TODO factor out the following blocks as they are repeated from above
-
-        // re-get posterior normalizer
-        vector<long double> comboProbs;
-        for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
-            comboProbs.push_back(gc->posteriorProb);
-        }
-        long double posteriorNormalizer = logsumexp_probs(comboProbs);
-
-        // recalculate posterior normalizer
-        pVar = 1.0;
-        pHom = 0.0;
-        // calculates pvar and gets the best het combo
-        list<GenotypeCombo>::iterator gc = genotypeCombos.begin();
-        bestCombo = *gc;
-        for ( ; gc != genotypeCombos.end(); ++gc) {
-            if (gc->isHomozygous() && gc->alleles().front() == referenceBase) {
-                pVar -= big_exp(gc->posteriorProb - posteriorNormalizer);
-                pHom += big_exp(gc->posteriorProb - posteriorNormalizer);
-            } else if (gc == genotypeCombos.begin()) {
-                bestOverallComboIsHet = true;
+    Site* site = new Site;
+
+    while (parser->getNextAlleles(samples, allowedAlleleTypes)) {
+
+        ++total_sites;
+
+        // this builds any haplotype here, which decides where the parser
+        // goes next, so we do it even where we won't report the site
+        bool prepared = prepareSite(parser, samples, *site, allowedAlleleTypes, nullAllele);
+
+        if (shard && shard->splitRequested) {
+            if (shards->split(*shard, parser->currentPosition)) {
+                parser->currentOwnedTarget()->right = shard->target.right;
+                parser->currentTarget->right = min((long int) shard->bounds.right,
+                                                   shard->target.right + parameters.regionMargin);
+                DEBUG("split shard, now processing " << shard->target.seq << ":" << shard->target.left
+                      << "-" << shard->target.right + 1);
             }
         }
 
-        // odds ratio between the first and second-best combinations
-        if (genotypeCombos.size() > 1) {
-            bestComboOddsRatio = genotypeCombos.front().posteriorProb - (++genotypeCombos.begin())->posteriorProb;
+        if (!prepared) {
+            continue;
         }
 
-        if (parameters.calculateMarginals) {
-            // make a combined, all-populations sample data likelihoods vector to accumulate marginals
-            SampleDataLikelihoods allSampleDataLikelihoods;
-            for (map<string, SampleDataLikelihoods>::iterator p = sampleDataLikelihoodsByPopulation.begin(); p != sampleDataLikelihoodsByPopulation.end(); ++p) {
-                SampleDataLikelihoods& sdls = p->second;
-                allSampleDataLikelihoods.reserve(allSampleDataLikelihoods.size() + distance(sdls.begin(), sdls.end()));
-                allSampleDataLikelihoods.insert(allSampleDataLikelihoods.end(), sdls.begin(), sdls.end());
-            }
-            // calculate the marginal likelihoods for this population
-            marginalGenotypeLikelihoods(genotypeCombos, allSampleDataLikelihoods);
-            // store the marginal data likelihoods in the results, for easy parsing
-            // like a vector -> map conversion...
-            results.update(allSampleDataLikelihoods);
+        // with soft target boundaries, we only report sites which start in
+        // the target itself
+        BedTarget* owned = parser->currentOwnedTarget();
+        if (owned && (parser->currentPosition < owned->left || parser->currentPosition > owned->right)) {
+            continue;
         }
 
-        map<string, int> repeats;
-        if (parameters.showReferenceRepeats) {
-            repeats = parser->repeatCounts(parser->currentSequencePosition(), parser->currentSequence, 12);
-        }
+        ++processed_sites;
 
-        vector<Allele> alts;
-        if (parameters.onlyUseInputAlleles
-            || parameters.reportAllHaplotypeAlleles
-            || parameters.pooledContinuous) {
-            //alts = genotypeAlleles;
-            for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
-                if (!a->isReference()) {
-                    alts.push_back(*a);
-                }
-            }
+        if (parameters.pipeline) {
+            site->samples = samples;
+            site->copyObservations();
+            threads.sitesToGenotype.push(site);
         } else {
-            // get the unique alternate alleles in this combo, sorted by frequency in the combo
-            vector<pair<Allele, int> > alternates = alternateAlleles(bestCombo, referenceBase);
-            for (vector<pair<Allele, int> >::iterator a = alternates.begin(); a != alternates.end(); ++a) {
-                Allele& alt = a->first;
-                if (!alt.isNull() && !alt.isReference())
-                    alts.push_back(alt);
-            }
-            // if there are no alternate alleles in the best combo, use the genotype alleles
-            // XXX ...
-            if (alts.empty()) {
-                for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
-                    if (!a->isReference()) {
-                        alts.push_back(*a);
-                    }
-                }
+            // the parser's observations stay valid until we move on
+            site->samples.swap(samples);
+            genotypeSite(parser, *site, observationBias, contaminationEstimates, threads.pool);
+            reportSite(parser, *site, out, failed);
+            if (checkpoint) {
+                checkpoint->update(site->target, site->position);
             }
+            samples.swap(site->samples);
+            delete site;
         }
+        site = new Site;
 
-        // reporting the GL maximum *over all alleles*
-        if (parameters.reportGenotypeLikelihoodMax) {
-            bestCombo = glMax;
-        } else {
-            // the default behavior is to report the GL maximum genotyping over the alleles in the best posterior genotyping
+        DEBUG2("finished position");
 
-            // select the maximum-likelihood GL given the alternates we have
-            // this is not the same thing as the GL max over all alleles!
-            // it is the GL max over the selected alleles at this point
+    }
 
-            vector<Allele> alleles = alts;
-            for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
-                if (a->isReference()) {
-                    alleles.push_back(*a);
-                }
+    delete site;
+
+    // wait for the pipeline to write out the shard
+    if (parameters.pipeline) {
+        threads.sitesToGenotype.push(NULL);
+        threads.reportedShards.front();
+        threads.reportedShards.pop();
+    }
+
+    DEBUG("total sites: " << total_sites << endl
+          << "processed sites: " << processed_sites << endl
+          << "ratio: " << (float) processed_sites / (float) total_sites);
+
+}
+
+// a thread calling variants over shards of the targets with its own parser
+struct ShardWorker {
+    pthread_t thread;
+    AlleleParser* parser;
+    ShardQueue* shards;
+    OrderedOutput* output;
+    OrderedOutput* failed;
+    Bias* observationBias;
+    Contamination* contaminationEstimates;
+    Checkpoint* checkpoint;
+};
+
+void* callVariantsInShards(void* arg) {
+    ShardWorker* worker = (ShardWorker*) arg;
+    CallingThreads threads(worker->parser, *worker->observationBias, *worker->contaminationEstimates);
+    Shard* shard;
+    while (worker->shards->next(shard)) {
+        vector<BedTarget> targets(1, shard->target);
+        vector<BedTarget> bounds(1, shard->bounds);
+        worker->parser->setSoftTargets(targets, bounds, worker->parser->parameters.regionMargin);
+        stringstream out;
+        stringstream failed;
+        callVariants(worker->parser, out, failed,
+                     *worker->observationBias, *worker->contaminationEstimates,
+                     threads, worker->shards, shard);
+        worker->output->write(*shard, out.str());
+        worker->failed->write(*shard, failed.str());
+        if (worker->shards->finish(*shard)) {
+            // the outputs must be flushed to the same shard when we checkpoint
+            Checkpoint* checkpoint = worker->checkpoint;
+            if (checkpoint) {
+                checkpoint->lock();
             }
-            map<string, list<GenotypeCombo> > glMaxComboBasedOnAltsByPop;
-            for (map<string, SampleDataLikelihoods>::iterator p = sampleDataLikelihoodsByPopulation.begin(); p != sampleDataLikelihoodsByPopulation.end(); ++p) {
-                const string& population = p->first;
-                SampleDataLikelihoods& sampleDataLikelihoods = p->second;
-                GenotypeCombo glMaxBasedOnAlts;
-                for (SampleDataLikelihoods::iterator v = sampleDataLikelihoods.begin(); v != sampleDataLikelihoods.end(); ++v) {
-                    SampleDataLikelihood* m = NULL;
-                    for (vector<SampleDataLikelihood>::iterator d = v->begin(); d != v->end(); ++d) {
-                        if (d->genotype->matchesAlleles(alleles)) {
-                            m = &*d;
-                            break;
-                        }
-                    }
-                    assert(m != NULL);
-                    glMaxBasedOnAlts.push_back(m);
+            worker->output->complete(shard->index);
+            worker->failed->complete(shard->index);
+            if (checkpoint) {
+                int flushed = worker->output->flushed();
+                if (flushed) {
+                    checkpoint->update(worker->shards->targetIndexes.at(flushed - 1),
+                                       worker->shards->shards.at(flushed - 1).right);
                 }
-                glMaxComboBasedOnAltsByPop[population].push_back(glMaxBasedOnAlts);
+                checkpoint->unlock();
             }
-            list<GenotypeCombo> glMaxBasedOnAltsGenotypeCombos; // build new combos into this list
-            combinePopulationCombos(glMaxBasedOnAltsGenotypeCombos, glMaxComboBasedOnAltsByPop);
-            bestCombo = glMaxBasedOnAltsGenotypeCombos.front();
-        }
-
-        DEBUG("best combo: " << bestCombo);
-
-        // output
-
-        if (!alts.empty() && (1 - pHom.ToDouble()) >= parameters.PVL || parameters.PVL == 0) {
-
-            vcf::Variant var(parser->variantCallFile);
-
-            out << results.vcf(
-                var,
-                pHom,
-                bestComboOddsRatio,
-                samples,
-                referenceBase,
-                alts,
-                repeats,
-                genotypingTotalIterations,
-                parser->sampleList,
-                coverage,
-                bestCombo,
-                alleleGroups,
-                partialObservationGroups,
-                partialObservationSupport,
-                genotypesByPloidy,
-                parser->sequencingTechnologies,
-                parser)
-                << endl;
+        }
+    }
+    return NULL;
+}
+
+// prints regions of the targets which contain similar amounts of data
+void planRegions(AlleleParser* parser, ostream& out) {
+
+    Parameters& parameters = parser->parameters;
+
+    if (parser->targets.empty()) {
+        parser->loadTargetsFromBams();
+    }
+
+    vector<string> sequenceNames;
+    for (RefVector::iterator r = parser->referenceSequences.begin(); r != parser->referenceSequences.end(); ++r) {
+        sequenceNames.push_back(r->RefName);
+    }
+    RegionPlanner planner(sequenceNames);
+    for (vector<string>::iterator b = parameters.bams.begin(); b != parameters.bams.end(); ++b) {
+        if (!planner.addBam(*b)) {
+            ERROR("could not read the BAM index of " << *b);
+            exit(1);
+        }
+    }
+
+    vector<vector<BedTarget> > regions = planner.plan(parser->targets, parameters.planRegions, parameters.planRegionSlack);
+    DEBUG("planned " << regions.size() << " regions");
+    for (vector<vector<BedTarget> >::iterator r = regions.begin(); r != regions.end(); ++r) {
+        for (vector<BedTarget>::iterator t = r->begin(); t != r->end(); ++t) {
+            // 0-based, half-open, as taken by --region
+            out << t->seq << ":" << t->left << "-" << t->right + 1 << endl;
+        }
+    }
+
+}
+
+// freebayes main
+int main (int argc, char *argv[]) {
+
+    // install segfault handler
+    signal(SIGSEGV, segfaultHandler);
+
+    AlleleParser* parser = new AlleleParser(argc, argv);
+    Parameters& parameters = parser->parameters;
+
+    ostream& out = *(parser->output);
+
+    if (parameters.planRegions) {
+        planRegions(parser, out);
+        delete parser;
+        return 0;
+    }
+
+    Bias observationBias;
+    if (!parameters.alleleObservationBiasFile.empty()) {
+        observationBias.open(parameters.alleleObservationBiasFile);
+    }
+
+    Contamination contaminationEstimates(0.5+parameters.probContamination, parameters.probContamination);
+    if (!parameters.contaminationEstimateFile.empty()) {
+        contaminationEstimates.open(parameters.contaminationEstimateFile);
+    }
+    contaminationEstimates.resolveReadGroups();
 
-        } else if (!parameters.failedFile.empty()) {
-            // get the unique alternate alleles in this combo, sorted by frequency in the combo
-            long unsigned int position = parser->currentPosition;
-            for (vector<Allele>::iterator ga =  genotypeAlleles.begin(); ga != genotypeAlleles.end(); ++ga) {
-                if (ga->type == ALLELE_REFERENCE)
-                    continue;
-                parser->failedFile
-                    << parser->currentSequenceName << "\t"
-                    << position << "\t"
-                    << position + ga->length << "\t"
-                    << *ga << endl;
+    Checkpoint* checkpoint = parser->checkpoint;
+
+    // output VCF header, unless we are appending to the output of a run we
+    // are resuming
+    if (parameters.output == "vcf" && !(checkpoint && checkpoint->resuming)) {
+        out << parser->variantCallFile.header << endl;
+    }
+
+    // without targets we process every sequence in the alignments, which we
+    // need to do explicitly to shard them or record our progress through them
+    if ((parameters.threads > 1 || checkpoint) && parser->targets.empty()) {
+        parser->loadTargetsFromBams();
+        vector<BedTarget> sequences = parser->targets;
+        parser->setTargets(sequences);
+    }
+
+    // the targets whose sites we report, and the bounds within which their
+    // ends may be soft (the targets themselves, unless --region-margin made
+    // them soft already)
+    vector<BedTarget> targets = parser->targets;
+    vector<BedTarget> bounds = parser->targets;
+    if (!parser->ownedTargets.empty()) {
+        targets = parser->ownedTargets;
+        for (vector<BedTarget>::iterator b = bounds.begin(); b != bounds.end(); ++b) {
+            b->left = 0;
+            b->right = parser->reference.sequenceLength(b->seq) - 1;
+        }
+    } else if (parameters.regionMargin == 0) {
+        parameters.regionMargin = SHARD_MARGIN;
+    }
+
+    // skip what we did before the checkpoint, and start just after it with a
+    // soft boundary, so that we pick up exactly where we left off
+    if (checkpoint && checkpoint->resuming) {
+        DEBUG("resuming from target " << checkpoint->target << " after position " << checkpoint->position);
+        targets.erase(targets.begin(), targets.begin() + checkpoint->target);
+        bounds.erase(bounds.begin(), bounds.begin() + checkpoint->target);
+        checkpoint->firstTarget = checkpoint->target;
+        if (!targets.empty()) {
+            targets.front().left = checkpoint->position + 1;
+            if (targets.front().left > targets.front().right) {
+                targets.erase(targets.begin());
+                bounds.erase(bounds.begin());
+                ++checkpoint->firstTarget;
             }
-            // BED format
         }
-        DEBUG2("finished position");
+        parser->setSoftTargets(targets, bounds, parameters.regionMargin);
+    }
 
+    if (checkpoint && checkpoint->resuming && targets.empty()) {
+        DEBUG("nothing left to do after the checkpoint");
+    } else if (parameters.threads == 1) {
+        CallingThreads threads(parser, observationBias, contaminationEstimates);
+        callVariants(parser, out, parser->failedFile, observationBias, contaminationEstimates, threads);
+    } else {
+        ShardQueue shardQueue(targets, bounds, parameters.shardLength, parameters.minSplitLength);
+        DEBUG("calling variants in " << shardQueue.shards.size() << " shards using " << parameters.threads << " threads");
+
+        OrderedOutput orderedOutput(out);
+        OrderedOutput orderedFailed(parser->failedFile);
+
+        // each thread gets its own parser, and so its own reference and
+        // alignment file handles; the first reuses the one we've opened
+        vector<ShardWorker> workers(parameters.threads);
+        for (vector<ShardWorker>::iterator w = workers.begin(); w != workers.end(); ++w) {
+            w->parser = (w == workers.begin()) ? parser : new AlleleParser(parameters);
+            w->shards = &shardQueue;
+            w->output = &orderedOutput;
+            w->failed = &orderedFailed;
+            w->observationBias = &observationBias;
+            w->contaminationEstimates = &contaminationEstimates;
+            w->checkpoint = checkpoint;
+        }
+        for (vector<ShardWorker>::iterator w = workers.begin(); w != workers.end(); ++w) {
+            if (pthread_create(&w->thread, NULL, callVariantsInShards, &*w)) {
+                ERROR("could not create thread");
+                exit(1);
+            }
+        }
+        for (vector<ShardWorker>::iterator w = workers.begin(); w != workers.end(); ++w) {
+            pthread_join(w->thread, NULL);
+            if (w->parser != parser) {
+                delete w->parser;
+            }
+        }
     }
 
-    DEBUG("total sites: " << total_sites << endl
-          << "processed sites: " << processed_sites << endl
-          << "ratio: " << (float) processed_sites / (float) total_sites);
+    if (checkpoint) {
+        checkpoint->remove();
+    }
 
     delete parser;
 
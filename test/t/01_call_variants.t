@@ -5,7 +5,7 @@ BASH_TAP_ROOT=bash-tap
 
 PATH=../bin:$PATH # for freebayes
 
-plan tests 4
+plan tests 33
 
 is $(echo "$(comm -12 <(cat tiny/NA12878.chr22.tiny.giab.vcf | grep -v "^#" | cut -f 2 | sort) <(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | cut -f 2 | sort) | wc -l) >= 13" | bc) 1 "variant calling recovers most of the GiAB variants in a test region"
 
@@ -65,3 +65,262 @@ is $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam -t targets.bed | grep -v
 
 is $(samtools view -u tiny/NA12878.chr22.tiny.bam | freebayes -f tiny/q.fa --stdin | grep -v "^#" | wc -l) \
     $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | wc -l) "reading from stdin or not makes no difference"
+
+is $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam -t targets.bed --threads 4 | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam -t targets.bed | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    "calling with --threads produces the same output as calling with a single thread"
+
+# without targets, each sequence is split into shards, whose ends are soft
+# (with a margin of 1000) so that sites near them are called as serially
+is $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --threads 4 --shard-length 1000 --min-split-length 1000000 \
+        | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    "calling whole sequences in many shards with --threads produces the same output as calling serially"
+
+# with more threads than shards, the idle threads ask for the running
+# shards to be split as soon as they start
+freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --threads 8 --shard-length 4000 --min-split-length 100 \
+    -d >split.vcf 2>split.log
+
+is $(echo "$(grep -c "^split shard" split.log) >= 2" | bc) 1 \
+    "idle threads split the shards of others with --threads"
+
+is $(grep -v "^#" split.vcf | md5sum | cut -f 1 -d\ ) \
+    $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    "calling with --threads produces the same output as calling serially when shards are split"
+rm -f split.vcf split.log
+
+is $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --pipeline | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    "calling with --pipeline produces the same output as calling serially"
+
+# a duplicate of a read, which is filtered out, with a read group which is
+# not in the header, which must still be reported
+samtools view -h tiny/NA12878.chr22.tiny.bam \
+    | awk 'BEGIN { OFS = "\t" }
+           { print }
+           !/^@/ && ++n == 100 {
+               $2 += 1024
+               line = $1
+               for (i = 2; i <= NF; ++i) if ($i !~ /^RG:Z:/) line = line OFS $i
+               print line, "RG:Z:nosuchgroup" }' \
+    | samtools view -b -o rg.bam -
+samtools index rg.bam
+
+# the exit status, and the messages about read groups
+read_group_errors() {
+    freebayes -f tiny/q.fa rg.bam "$@" 2>&1 >/dev/null | grep -i "read group" | md5sum | cut -f 1 -d\ 
+    echo ${PIPESTATUS[0]}
+}
+
+is "$(read_group_errors --pipeline)" "$(read_group_errors)" \
+    "calling with --pipeline reports filtered reads with unknown read groups as calling serially does"
+rm -f rg.bam rg.bam.bai
+
+is $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --genotyping-threads 4 | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    "calling with --genotyping-threads produces the same output as calling serially"
+
+is $((for region in q:0-3000 q:3000-6000 q:6000-9000 q:9000-12356;
+      do
+          freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --region-margin 1000 -r $region | grep -v "^#"
+      done) | md5sum | cut -f 1 -d\ ) \
+    $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    "calling adjacent regions with --region-margin produces the same output as calling them at once"
+
+for region in q:0-3000 q:3000-6000 q:6000-9000 q:9000-12356;
+do
+    freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --region-margin 1000 -r $region >merge.$region.vcf
+done
+
+is $(freebayes-merge -f tiny/q.fa merge.q:9000-12356.vcf merge.q:3000-6000.vcf merge.q:0-3000.vcf merge.q:6000-9000.vcf \
+        | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    "freebayes-merge combines the output of regions into the output of a single run"
+
+is $(freebayes-merge -f tiny/q.fa --max-open 2 merge.q:9000-12356.vcf merge.q:3000-6000.vcf merge.q:0-3000.vcf merge.q:6000-9000.vcf \
+        | md5sum | cut -f 1 -d\ ) \
+    $(freebayes-merge -f tiny/q.fa merge.q:9000-12356.vcf merge.q:3000-6000.vcf merge.q:0-3000.vcf merge.q:6000-9000.vcf \
+        | md5sum | cut -f 1 -d\ ) \
+    "freebayes-merge gives the same output when it has to merge in several passes"
+rm -f merge.q:*.vcf
+
+# the double-precision build should make the same calls with nearly the same qualities
+is $(paste <(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | cut -f 1,2,4,5,6) \
+           <(freebayes-double -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | cut -f 1,2,4,5,6) \
+        | awk '{ d = $5 - $10; if (d < 0) d = -d;
+                 if ($1 != $6 || $2 != $7 || $3 != $8 || $4 != $9 || d > 0.001 * $5 + 0.01) ++n }
+               END { print n + 0 }') \
+    0 "calling with double rather than long double precision produces the same calls and qualities"
+
+# the checking build aborts if a prior kept from the prior terms of a combo
+# differs from its full recomputation
+is $(for options in "" "-t targets.bed" "--ploidy 4" "--pooled-continuous" "--report-monomorphic -r q:1000-3000";
+     do
+         freebayes-checkpriors -f tiny/q.fa tiny/NA12878.chr22.tiny.bam $options | grep -v "^#"
+     done | md5sum | cut -f 1 -d\ ) \
+    $(for options in "" "-t targets.bed" "--ploidy 4" "--pooled-continuous" "--report-monomorphic -r q:1000-3000";
+      do
+          freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam $options | grep -v "^#"
+      done | md5sum | cut -f 1 -d\ ) \
+    "the priors kept from the counts of genotype combos match their full recomputation (CHECK_PRIORS)"
+
+# without targets, each sequence is called from its first base to its last
+for threads in 1 4;
+do
+    is $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --report-monomorphic --threads $threads \
+            | grep -v "^#" | awk 'NR == FNR { size[$1] = $2; next } $2 > size[$1]' tiny/q.fa.fai - | wc -l) \
+        0 "no position past the end of a sequence is considered without targets, with --threads $threads"
+done
+
+# the vector kernels for data likelihoods, which the host may or may not
+# have, add terms in another order than the scalar one, so qualities may
+# differ slightly
+is $(paste <(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | cut -f 1,2,4,5,6) \
+           <(FREEBAYES_OBSERVATION_KERNEL=scalar freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | cut -f 1,2,4,5,6) \
+        | awk '{ d = $5 - $10; if (d < 0) d = -d;
+                 if ($1 != $6 || $2 != $7 || $3 != $8 || $4 != $9 || d > 0.001 * $5 + 0.01) ++n }
+               END { print n + 0 }') \
+    0 "the data likelihood kernel chosen for the host produces the same calls and qualities as the scalar one"
+
+# reporting every position makes the output span many BGZF blocks
+freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --report-monomorphic >bgzf.plain.vcf
+freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --report-monomorphic --output-bgzf -v bgzf.serial.vcf.gz
+freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --report-monomorphic --output-bgzf -v bgzf.threads.vcf.gz --threads 4
+
+is $(bgzip -t bgzf.serial.vcf.gz && bgzip -t bgzf.threads.vcf.gz && echo ok) ok \
+    "--output-bgzf writes valid BGZF, with or without --threads"
+
+is $(zcat bgzf.serial.vcf.gz | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    $(grep -v "^#" bgzf.plain.vcf | md5sum | cut -f 1 -d\ ) \
+    "--output-bgzf compresses the same records as are written uncompressed"
+
+is $(zcat bgzf.threads.vcf.gz | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    $(grep -v "^#" bgzf.plain.vcf | md5sum | cut -f 1 -d\ ) \
+    "--output-bgzf with --threads compresses the same records as are written uncompressed"
+
+# regions to query in the index: the records around the end of the first
+# few uncompressed blocks, which span two blocks, and some others
+bgzf_regions() {
+    for offset in 65280 130560 195840; do
+        line=$(($(head -c $offset bgzf.plain.vcf | wc -l) + 1))
+        position=$(sed -n ${line}p bgzf.plain.vcf | cut -f 2)
+        echo q:$((position - 20))-$((position + 20))
+    done
+    echo q:1-500 q:5000-5100 q:12000-12356
+}
+
+# the records overlapping each region, as tabix finds them and by filtering
+bgzf_region_records() {
+    for region in $(bgzf_regions); do
+        tabix $1 $region
+    done | md5sum | cut -f 1 -d\ 
+}
+
+bgzf_filtered_records() {
+    for region in $(bgzf_regions); do
+        begin=$(echo $region | cut -f 2 -d: | cut -f 1 -d-)
+        end=$(echo $region | cut -f 2 -d- )
+        grep -v "^#" bgzf.plain.vcf \
+            | awk -v b=$begin -v e=$end '$1 == "q" && $2 <= e && $2 + length($4) - 1 >= b'
+    done | md5sum | cut -f 1 -d\ 
+}
+
+is $(bgzf_region_records bgzf.serial.vcf.gz) $(bgzf_filtered_records) \
+    "the tabix index of --output-bgzf finds the records in regions, including across block boundaries"
+
+is $(bgzf_region_records bgzf.threads.vcf.gz) $(bgzf_filtered_records) \
+    "the tabix index of --output-bgzf with --threads finds the records in regions, including across block boundaries"
+rm -f bgzf.plain.vcf bgzf.serial.vcf.gz bgzf.serial.vcf.gz.tbi bgzf.threads.vcf.gz bgzf.threads.vcf.gz.tbi
+
+# runs a call with --checkpoint, as if it had been killed just after writing
+# the record on line $1 of its output, which is in target $2, and resumes it
+checkpoint_resume() {
+    line=$1
+    target=$2
+    shift 2
+    options="-f tiny/q.fa --vcf ckpt.vcf --checkpoint ckpt.txt${*:+ $*} tiny/NA12878.chr22.tiny.bam"
+    rm -f ckpt.vcf ckpt.txt
+    freebayes $options
+    mv ckpt.vcf ckpt.full.vcf
+    position=$(sed -n ${line}p ckpt.full.vcf | cut -f 2)
+    head -n $line ckpt.full.vcf >ckpt.vcf
+    offset=$(wc -c <ckpt.vcf)
+    # part of what was written after the checkpoint, which must be discarded
+    sed -n "$((line + 1)),$((line + 2))p" ckpt.full.vcf | head -c 100 >>ckpt.vcf
+    printf "options\tfreebayes %s\ntarget\t%d\nposition\t%d\noutput\t%d\nfailed\t0\n" \
+        "$options" $target $((position - 1)) $offset >ckpt.txt
+    freebayes $options
+    cmp -s ckpt.vcf ckpt.full.vcf && [ ! -e ckpt.txt ] && echo ok
+}
+
+# a line about halfway through the records of a call
+checkpoint_line() {
+    records=$(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam "$@" | grep -v "^#" | wc -l)
+    headers=$(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam "$@" | grep -c "^#")
+    echo $((headers + records / 2))
+}
+
+# the index of the target in targets.bed holding the record on line $1 of
+# the output of a call with it
+checkpoint_target() {
+    position=$(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam -t targets.bed | sed -n ${1}p | cut -f 2)
+    awk -v p=$position '$2 <= p - 1 { ++n } END { print n - 1 }' targets.bed
+}
+
+line=$(checkpoint_line)
+is $(checkpoint_resume $line 0) ok \
+    "resuming from a checkpoint discards the output written after it and gives the output of an uninterrupted run"
+
+is $(checkpoint_resume $line 0 --threads 4) ok \
+    "resuming from a checkpoint with --threads gives the output of an uninterrupted run"
+
+line=$(checkpoint_line -t targets.bed)
+target=$(checkpoint_target $line)
+is $(checkpoint_resume $line $target -t targets.bed) ok \
+    "resuming from a checkpoint skips the targets before it and gives the output of an uninterrupted run"
+
+is $(checkpoint_resume $line $target -t targets.bed --threads 4) ok \
+    "resuming from a checkpoint with --threads skips the targets before it and gives the output of an uninterrupted run"
+
+echo partial >ckpt.vcf
+printf "options\tfreebayes -f tiny/q.fa --vcf other.vcf\ntarget\t0\nposition\t1000\noutput\t8\nfailed\t0\n" >ckpt.txt
+freebayes -f tiny/q.fa --vcf ckpt.vcf --checkpoint ckpt.txt tiny/NA12878.chr22.tiny.bam 2>ckpt.err
+status=$?
+is "$status $(grep -c "different options" ckpt.err) $(cat ckpt.vcf)" "1 1 partial" \
+    "a checkpoint made with different options is refused, leaving the output alone"
+rm -f ckpt.vcf ckpt.full.vcf ckpt.txt ckpt.err
+
+# prints "ok" if the regions on stdin cover each sequence in tiny/q.fa.fai
+# from start to end, with no gaps or overlaps
+plan_covers_sequences() {
+    tr ':-' '\t\t' | awk 'NR == FNR { size[$1] = $2; next }
+        { if ($1 != seq) { if (seq != "" && end != size[seq]) bad = 1; if ($2 != 0 || done[$1]) bad = 1; seq = $1; done[$1] = 1 }
+          else if ($2 != end) bad = 1;
+          if ($3 <= $2) bad = 1;
+          end = $3 }
+        END { if (seq == "" || end != size[seq]) bad = 1;
+              for (s in size) if (!done[s]) bad = 1;
+              if (!bad) print "ok" }' tiny/q.fa.fai -
+}
+
+freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --plan-regions 4 >plan.regions
+
+is $(echo "$(grep -c -E "^q:[0-9]+-[0-9]+$" plan.regions) >= 4" | bc) 1 \
+    "--plan-regions prints at least as many regions as asked for, in the form taken by --region"
+
+is $(plan_covers_sequences <plan.regions) ok \
+    "the regions printed by --plan-regions cover the sequences with no gaps or overlaps"
+
+is $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --plan-regions 4 --plan-region-slack 0 | plan_covers_sequences)$( \
+     freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --plan-regions 4 --plan-region-slack 0.5 | plan_covers_sequences) okok \
+    "the regions printed by --plan-regions with more or less --plan-region-slack cover the sequences with no gaps or overlaps"
+
+# as scripts/freebayes-parallel calls them
+is $(for region in $(cat plan.regions);
+     do
+         freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --region-margin 1000 -r $region | grep -v "^#"
+     done | md5sum | cut -f 1 -d\ ) \
+    $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | md5sum | cut -f 1 -d\ ) \
+    "calling the regions printed by --plan-regions produces the same output as calling them at once"
+rm -f plan.regions